@@ -66,7 +66,11 @@ void lua_pre_script(lua_State *L) {
 void lua_post_script(lua_State *L) {
 	sound_stopall();
 	sys_stoptimer(L);
-	lcd_buffer_enable(0);
+	// a script ending mid recording shouldn't swallow everything drawn after it
+	multicore_recording = NULL;
+	lcd_buffer_enable(0, false);
+	lcd_reset_clip();
+	lcd_set_blend(LCD_BLEND_NONE, 255);
 	lua_getglobal(L, "collectgarbage");
 	lua_pcall(L, 0, 0, 0);
 	keyboard_set_interrupt_callback(NULL);
@@ -104,15 +108,17 @@ void lua_main() {
 
 		if (fs_exists(STARTUP_FILE)) {
 			lua_pre_script(L);
-			luaL_dofile(L, STARTUP_FILE);
+			status = luaL_dofile(L, STARTUP_FILE);
 			lua_post_script(L);
+			if (status != LUA_OK) lua_writestringerror("%s\n", lua_tostring(L, -1));
+			lua_settop(L, 0);
 		}
 	}
 
 	while (1) {
 		char line[256];
 		keyboard_flush();
-		lcd_buffer_enable(0);
+		lcd_buffer_enable(0, false);
 		term_set_blinking_cursor(true);
 		int size = term_readline(PROMPT, line, 256, &term_history);
 		term_set_blinking_cursor(false);
@@ -129,22 +135,19 @@ void lua_main() {
 			status = luaL_loadbuffer(L, line, strlen(line), "=stdin");
 			//num_results = 0;
 		} else lua_remove(L, -2);
+		if (status == LUA_OK) status = lua_pcall(L, 0, LUA_MULTRET, 0);
+
+		// results and errors are printed once the script's display list,
+		// buffer mode and clip are undone, or they could end up off screen
+		lua_post_script(L);
 		if (status != LUA_OK) {
 			const char *msg = lua_tostring(L, -1);
 			lua_writestringerror("%s\n", msg);
 		} else {
-			status = lua_pcall(L, 0, LUA_MULTRET, 0);
-			if(status != LUA_OK) {
-				const char *msg = lua_tostring(L, -1);
-				lua_writestringerror("%s\n", msg);
-			} else {
-				printf("\x1b[96m");
-				l_print(L);
-				printf("\x1b[m");
-			}
+			printf("\x1b[96m");
+			l_print(L);
+			printf("\x1b[m");
 		}
-		
-		lua_post_script(L);
 	}
 
 	lua_close(L);
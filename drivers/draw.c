@@ -1,18 +1,17 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 
 #include "draw.h"
 #include "lcd.h"
+#include "../pico_fatfs/fatfs/ff.h"
 
 #define abs(x) ((x) < 0 ? -(x) : (x))
 
+// clipping is done by the lcd
 static void draw_horizontal_line(i32 x1, i32 x2, i32 y, Color color) {
-	if (x1 >= LCD_WIDTH || x2 < 0 || y < 0 || y >= MEM_HEIGHT) return;
-	if (x1 < 0) x1 = 0;
-	if (x2 >= LCD_WIDTH) x2 = LCD_WIDTH;
-	int offset = y * LCD_WIDTH;
 	lcd_fill(color, x1, y, x2 - x1 + 1, 1);
 }
 
@@ -63,17 +62,6 @@ void draw_clear_local() {
 }
 
 void draw_fill_rect_local(i16 x, i16 y, i16 width, i16 height, Color color) {
-	if (x < 0) {
-		width += x;
-		x = 0;
-	}
-	if (y < 0) {
-		height += y;
-		y = 0;
-	}
-	if (x + width > LCD_WIDTH) width = LCD_WIDTH - x;
-	if (y + height > MEM_HEIGHT) height = MEM_HEIGHT - y;
-
 	lcd_fill(color, x, y, width, height);
 }
 
@@ -86,54 +74,588 @@ void draw_rect_local(i16 x, i16 y, i16 width, i16 height, Color color) {
 	draw_horizontal_line(x, x + width, y + height - 1, color);
 }
 
+// finds the opaque runs of every row of an uncompiled bitmap
+static bool draw_sprite_build_runs(Spritesheet* sprite, u32** run_index, u16** runs) {
+	int rows = sprite->count * sprite->height;
+	u32 total = 0;
+	Color* p = sprite->bitmap;
+	for (int r = 0; r < rows; r++) {
+		for (int x = 0; x < sprite->width; x++, p++) {
+			if (*p != sprite->mask && (x == 0 || p[-1] == sprite->mask)) total++;
+		}
+	}
+
+	*run_index = malloc((rows + 1) * sizeof(u32));
+	*runs = malloc((total + 1) * 2 * sizeof(u16));
+	if (!*run_index || !*runs) {
+		free(*run_index);
+		free(*runs);
+		return false;
+	}
+
+	u32 n = 0;
+	p = sprite->bitmap;
+	for (int r = 0; r < rows; r++) {
+		(*run_index)[r] = n;
+		for (int x = 0; x < sprite->width; x++) {
+			if (p[x] == sprite->mask) continue;
+			int start = x;
+			while (x < sprite->width && p[x] != sprite->mask) x++;
+			(*runs)[n * 2] = start;
+			(*runs)[n * 2 + 1] = x - start;
+			n++;
+		}
+		p += sprite->width;
+	}
+	(*run_index)[rows] = n;
+	return true;
+}
+
+// run tables of uncompiled sheets are only touched by core 0, Lua bumps
+// the version when the bitmap or mask changes
+static bool draw_sprite_runs(Spritesheet* sprite) {
+	if (sprite->compiled) return true;
+	u16 version = sprite->version;
+	if (sprite->runs && sprite->runs_version == version) return true;
+
+	free(sprite->run_index);
+	free(sprite->runs);
+	sprite->run_index = NULL;
+	sprite->runs = NULL;
+
+	if (!draw_sprite_build_runs(sprite, &sprite->run_index, &sprite->runs)) return false;
+	sprite->runs_version = version;
+	return true;
+}
+
+bool draw_sprite_index_pixels(Spritesheet* sprite, u32* total) {
+	int rows = sprite->count * sprite->height;
+	sprite->row_pixels = malloc(rows * sizeof(u32));
+	if (!sprite->row_pixels) return false;
+
+	u32 n = 0;
+	for (int r = 0; r < rows; r++) {
+		sprite->row_pixels[r] = n;
+		for (u32 k = sprite->run_index[r]; k < sprite->run_index[r + 1]; k++) n += sprite->runs[k * 2 + 1];
+	}
+	*total = n;
+	return true;
+}
+
+bool draw_sprite_compile(Spritesheet* sprite) {
+	if (sprite->compiled) return true;
+
+	u32* run_index;
+	u16* runs;
+	if (!draw_sprite_build_runs(sprite, &run_index, &runs)) return false;
+
+	Color* bitmap = sprite->bitmap;
+	free(sprite->run_index);
+	free(sprite->runs);
+	sprite->run_index = run_index;
+	sprite->runs = runs;
+
+	u32 total;
+	Color* packed = NULL;
+	if (draw_sprite_index_pixels(sprite, &total)) packed = malloc((total + 1) * sizeof(Color));
+	if (!packed) {
+		free(sprite->row_pixels);
+		sprite->row_pixels = NULL;
+		sprite->runs_version = sprite->version;
+		return false;
+	}
+
+	// only the opaque pixels are kept, in run order
+	u32 n = 0;
+	int rows = sprite->count * sprite->height;
+	for (int r = 0; r < rows; r++) {
+		Color* src = bitmap + r * sprite->width;
+		for (u32 k = run_index[r]; k < run_index[r + 1]; k++) {
+			memcpy(packed + n, src + runs[k * 2], runs[k * 2 + 1] * sizeof(Color));
+			n += runs[k * 2 + 1];
+		}
+	}
+
+	sprite->bitmap = packed;
+	sprite->compiled = true;
+	free(bitmap);
+	return true;
+}
+
+Color draw_sprite_get_pixel(Spritesheet* sprite, int x, int y, int spriteid) {
+	int row = (spriteid % sprite->count) * sprite->height + y;
+	if (!sprite->compiled) return sprite->bitmap[x + row * sprite->width];
+
+	Color* px = sprite->bitmap + sprite->row_pixels[row];
+	for (u32 k = sprite->run_index[row]; k < sprite->run_index[row + 1]; k++) {
+		int start = sprite->runs[k * 2], len = sprite->runs[k * 2 + 1];
+		if (x < start) break;
+		if (x < start + len) return px[x - start];
+		px += len;
+	}
+	return sprite->mask;
+}
+
+// sheets are saved as width, height, count and mask followed by the
+// bitmap. A negative width marks a compiled sheet, followed by its run
+// tables and only the opaque pixels
+static int draw_sprite_read(FIL* file, Spritesheet* sprite) {
+	FRESULT res = f_read(file, &sprite->width, sizeof(sprite->width), NULL);
+	if (res != FR_OK) return res;
+	res = f_read(file, &sprite->height, sizeof(sprite->height), NULL);
+	if (res != FR_OK) return res;
+	res = f_read(file, &sprite->count, sizeof(sprite->count), NULL);
+	if (res != FR_OK) return res;
+	res = f_read(file, &sprite->mask, sizeof(sprite->mask), NULL);
+	if (res != FR_OK) return res;
+
+	if (sprite->width >= 0) {
+		int bitmap_size = sprite->width * sprite->height * sprite->count * sizeof(Color);
+		sprite->bitmap = malloc(bitmap_size);
+		if (!sprite->bitmap) return DRAW_SPRITE_NO_MEMORY;
+		return f_read(file, sprite->bitmap, bitmap_size, NULL);
+	}
+
+	sprite->width = -sprite->width;
+	sprite->compiled = true;
+	int rows = sprite->count * sprite->height;
+	sprite->run_index = malloc((rows + 1) * sizeof(u32));
+	if (!sprite->run_index) return DRAW_SPRITE_NO_MEMORY;
+	res = f_read(file, sprite->run_index, (rows + 1) * sizeof(u32), NULL);
+	if (res != FR_OK) return res;
+
+	u32 runs = sprite->run_index[rows], pixels;
+	sprite->runs = malloc((runs + 1) * 2 * sizeof(u16));
+	if (!sprite->runs) return DRAW_SPRITE_NO_MEMORY;
+	res = f_read(file, sprite->runs, runs * 2 * sizeof(u16), NULL);
+	if (res != FR_OK) return res;
+
+	if (!draw_sprite_index_pixels(sprite, &pixels)) return DRAW_SPRITE_NO_MEMORY;
+	sprite->bitmap = malloc((pixels + 1) * sizeof(Color));
+	if (!sprite->bitmap) return DRAW_SPRITE_NO_MEMORY;
+	return f_read(file, sprite->bitmap, pixels * sizeof(Color), NULL);
+}
+
+int draw_sprite_load(Spritesheet* sprite, const char* filename) {
+	FIL file;
+	FRESULT res = f_open(&file, filename, FA_READ);
+	if (res != FR_OK) return res;
+	int result = draw_sprite_read(&file, sprite);
+	f_close(&file);
+	return result;
+}
+
+static int draw_sprite_write(FIL* file, Spritesheet* sprite) {
+	i16 width = sprite->compiled ? -sprite->width : sprite->width;
+	FRESULT res = f_write(file, &width, sizeof(width), NULL);
+	if (res != FR_OK) return res;
+	res = f_write(file, &sprite->height, sizeof(sprite->height), NULL);
+	if (res != FR_OK) return res;
+	res = f_write(file, &sprite->count, sizeof(sprite->count), NULL);
+	if (res != FR_OK) return res;
+	res = f_write(file, &sprite->mask, sizeof(sprite->mask), NULL);
+	if (res != FR_OK) return res;
+
+	if (!sprite->compiled) {
+		int bitmap_size = sprite->width * sprite->height * sprite->count * sizeof(Color);
+		return f_write(file, sprite->bitmap, bitmap_size, NULL);
+	}
+
+	int rows = sprite->count * sprite->height;
+	u32 runs = sprite->run_index[rows], pixels = 0;
+	res = f_write(file, sprite->run_index, (rows + 1) * sizeof(u32), NULL);
+	if (res != FR_OK) return res;
+	res = f_write(file, sprite->runs, runs * 2 * sizeof(u16), NULL);
+	if (res != FR_OK) return res;
+	for (u32 k = 0; k < runs; k++) pixels += sprite->runs[k * 2 + 1];
+	return f_write(file, sprite->bitmap, pixels * sizeof(Color), NULL);
+}
+
+int draw_sprite_save(Spritesheet* sprite, const char* filename) {
+	FIL file;
+	FRESULT res = f_open(&file, filename, FA_WRITE | FA_CREATE_ALWAYS);
+	if (res != FR_OK) return res;
+	int result = draw_sprite_write(&file, sprite);
+	f_close(&file);
+	return result;
+}
+
+// mirrored runs are reversed into here, they're clipped to the screen first
+static Color draw_span_buf[LCD_WIDTH];
+
 void draw_sprite_local(i16 x, i16 y, Spritesheet* sprite, u8 spriteid, u8 flip) {
-	if (x <= -sprite->width || y <= -sprite->height || x >= LCD_WIDTH || y >= LCD_HEIGHT) return;
-	
-	i16 x_source = 0; // clip left
-	if (x < 0) { x_source = -x; x = 0; }	
-	i16 y_source = 0; // clip top
-	if (y < 0) { y_source = -y; y = 0; }
-	i16 w_stop = sprite->width - x_source; // clip right
-	if (x + sprite->width >= LCD_WIDTH) { w_stop -= x + sprite->width - LCD_WIDTH - 1; }
-	i16 h_stop = sprite->height - y_source; // clip bottom
-	if (y + sprite->height >= LCD_HEIGHT) { h_stop -= y + sprite->height - LCD_HEIGHT - 1; }
-
-	int y_offset;
-	int spr_offset = sprite->width * sprite->height * (spriteid % sprite->count);
-	Color c;
-	for (int j = 0; j < h_stop; j++) {
-		if (flip & DRAW_MIRROR_V) y_offset = (sprite->height - j - y_source) * sprite->width;
-		else y_offset = (j + y_source) * sprite->width;
-		for (int i = 0; i < w_stop; i++) {
-			if (flip & DRAW_MIRROR_H) c = sprite->bitmap[spr_offset + y_offset + (sprite->width - i - x_source)];
-			else c = sprite->bitmap[spr_offset + y_offset + i + x_source];
-			if (c != sprite->mask) draw_point(x + i, y + j, c);
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+	if (!sprite->bitmap) return;
+	if (x <= cx1 - sprite->width || y <= cy1 - sprite->height || x >= cx2 || y >= cy2) return;
+
+	int j_start = y < cy1 ? cy1 - y : 0; // clip top
+	int j_stop = y + sprite->height > cy2 ? cy2 - y : sprite->height; // clip bottom
+	int frame = (spriteid % sprite->count) * sprite->height;
+
+	if (!draw_sprite_runs(sprite)) {
+		// out of memory for the run tables, go pixel by pixel
+		for (int j = j_start; j < j_stop; j++) {
+			int row = (flip & DRAW_MIRROR_V) ? sprite->height - 1 - j : j;
+			Color* src = sprite->bitmap + (frame + row) * sprite->width;
+			for (int i = 0; i < sprite->width; i++) {
+				Color c = (flip & DRAW_MIRROR_H) ? src[sprite->width - 1 - i] : src[i];
+				if (c != sprite->mask) draw_point(x + i, y + j, c);
+			}
+		}
+		return;
+	}
+
+	for (int j = j_start; j < j_stop; j++) {
+		int row = frame + ((flip & DRAW_MIRROR_V) ? sprite->height - 1 - j : j);
+		// compiled sheets store only the opaque pixels, one run after another
+		Color* src = sprite->compiled ? sprite->bitmap + sprite->row_pixels[row] : sprite->bitmap + row * sprite->width;
+
+		for (u32 k = sprite->run_index[row]; k < sprite->run_index[row + 1]; k++) {
+			int start = sprite->runs[k * 2];
+			int len = sprite->runs[k * 2 + 1];
+			int dx = x + ((flip & DRAW_MIRROR_H) ? sprite->width - start - len : start);
+			Color* px = sprite->compiled ? src : src + start;
+			if (sprite->compiled) src += len;
+
+			// visible part of the run on screen
+			int skip = dx < cx1 ? cx1 - dx : 0;
+			int end = dx + len > cx2 ? cx2 - dx : len;
+			if (end <= skip) continue;
+
+			if (flip & DRAW_MIRROR_H) {
+				for (int i = skip; i < end; i++) draw_span_buf[i - skip] = px[len - 1 - i];
+				lcd_draw(draw_span_buf, dx + skip, y + j, end - skip, 1);
+			} else {
+				lcd_draw(px + skip, dx + skip, y + j, end - skip, 1);
+			}
+		}
+	}
+}
+
+// copies the opaque pixels of sprite columns lo..hi of one row to dst, or
+// draws them straight to the screen at sx, sy when dst is NULL; returns how
+// many pixels were opaque
+static int draw_sprite_row(Spritesheet* sprite, int spriteid, int j, Color* dst, int lo, int hi, int sx, int sy) {
+	int row = (spriteid % sprite->count) * sprite->height + j;
+	Color* src = sprite->compiled ? sprite->bitmap + sprite->row_pixels[row] : sprite->bitmap + row * sprite->width;
+	int covered = 0;
+
+	for (u32 k = sprite->run_index[row]; k < sprite->run_index[row + 1]; k++) {
+		int start = sprite->runs[k * 2];
+		int len = sprite->runs[k * 2 + 1];
+		Color* px = sprite->compiled ? src : src + start;
+		if (sprite->compiled) src += len;
+
+		int a = start < lo ? lo : start;
+		int b = start + len > hi ? hi : start + len;
+		if (a >= b) continue;
+		if (dst) memcpy(dst + a - lo, px + a - start, (b - a) * sizeof(Color));
+		else lcd_draw(px + a - start, sx + a, sy, b - a, 1);
+		covered += b - a;
+	}
+	return covered;
+}
+
+// tile ids of the cell row being drawn, DRAW_TILE_EMPTY for cells to skip
+static u8 draw_tile_row[LCD_WIDTH + 1];
+// cells of that row that changed since they were drawn and get cleared first
+static bool draw_tile_erase[LCD_WIDTH + 1];
+
+// which cells draw_tilemap_cells draws: all of them over what's on screen,
+// only the changed ones, or all of them where scrolling uncovered the rect.
+// Changed and uncovered cells are cleared to the erase colour first
+#define DRAW_CELLS_FULL 0
+#define DRAW_CELLS_DIRTY 1
+#define DRAW_CELLS_EXPOSED 2
+
+// draws the cells of a map with its top left corner at x, y that fall in the
+// rect cx1, cy1, cx2, cy2, which is already inside the clip
+static void draw_tilemap_cells(Tilemap* map, int x, int y, int cx1, int cy1, int cx2, int cy2, int mode, Color color) {
+	Spritesheet* sheet = map->sheet;
+	bool erase = mode != DRAW_CELLS_FULL;
+	int tw = sheet->width, th = sheet->height;
+	int mx2 = x + map->width * tw, my2 = y + map->height * th;
+	if (cx2 <= cx1 || cy2 <= cy1) return;
+
+	if (mode == DRAW_CELLS_EXPOSED) {
+		// no cell covers what scrolled in from beyond the edges of the map
+		int top = y < cy1 ? cy1 : (y > cy2 ? cy2 : y);
+		int bottom = my2 > cy2 ? cy2 : (my2 < top ? top : my2);
+		int left = x < cx1 ? cx1 : (x > cx2 ? cx2 : x);
+		int right = mx2 > cx2 ? cx2 : (mx2 < left ? left : mx2);
+		if (top > cy1) lcd_fill(color, cx1, cy1, cx2 - cx1, top - cy1);
+		if (bottom < cy2) lcd_fill(color, cx1, bottom, cx2 - cx1, cy2 - bottom);
+		if (bottom > top && left > cx1) lcd_fill(color, cx1, top, left - cx1, bottom - top);
+		if (bottom > top && right < cx2) lcd_fill(color, right, top, cx2 - right, bottom - top);
+	}
+	if (x >= cx2 || y >= cy2 || mx2 <= cx1 || my2 <= cy1) return;
+
+	// visible cells
+	int i0 = x < cx1 ? (cx1 - x) / tw : 0;
+	int j0 = y < cy1 ? (cy1 - y) / th : 0;
+	int i1 = (cx2 - x + tw - 1) / tw;
+	int j1 = (cy2 - y + th - 1) / th;
+	if (i1 > map->width) i1 = map->width;
+	if (j1 > map->height) j1 = map->height;
+
+	for (int j = j0; j < j1; j++) {
+		// take the row's tiles up front so Lua changing them mid-draw only
+		// marks them dirty for the next frame
+		bool any = false;
+		u8* tiles = map->tiles + j * map->width;
+		u8* dirty = map->dirty + j * map->width;
+		for (int i = i0; i < i1; i++) {
+			if (mode == DRAW_CELLS_DIRTY && !dirty[i]) {
+				draw_tile_row[i - i0] = DRAW_TILE_EMPTY;
+				draw_tile_erase[i - i0] = false;
+				continue;
+			}
+			if (mode != DRAW_CELLS_EXPOSED) dirty[i] = 0;
+			draw_tile_row[i - i0] = tiles[i];
+			// the old tile is still on screen under a changed cell
+			draw_tile_erase[i - i0] = erase;
+			if (tiles[i] != DRAW_TILE_EMPTY || erase) any = true;
+		}
+		if (!any) continue;
+
+		int ty = y + j * th;
+		int r0 = ty < cy1 ? cy1 - ty : 0;
+		int r1 = ty + th > cy2 ? cy2 - ty : th;
+
+		for (int r = r0; r < r1; r++) {
+			// opaque cells next to each other are gathered into one span
+			int span_x1 = 0, span_x2 = 0;
+
+			for (int i = i0; i <= i1; i++) {
+				u8 tile = i < i1 ? draw_tile_row[i - i0] : DRAW_TILE_EMPTY;
+				int tx = x + i * tw;
+				int lo = tx < cx1 ? cx1 - tx : 0;
+				int hi = tx + tw > cx2 ? cx2 - tx : tw;
+				int under = tile == map->underlay ? -1 : map->underlay;
+
+				bool opaque = false;
+				if (i < i1 && draw_tile_erase[i - i0]) {
+					// cleared first, so the whole row of the cell is opaque
+					Color* dst = draw_span_buf + tx + lo - cx1;
+					for (int k = 0; k < hi - lo; k++) dst[k] = color;
+					if (tile != DRAW_TILE_EMPTY) {
+						if (under >= 0) draw_sprite_row(sheet, under, r, dst, lo, hi, 0, 0);
+						draw_sprite_row(sheet, tile, r, dst, lo, hi, 0, 0);
+					}
+					opaque = true;
+				} else if (tile != DRAW_TILE_EMPTY) {
+					Color* dst = draw_span_buf + tx + lo - cx1;
+					opaque = draw_sprite_row(sheet, tile, r, dst, lo, hi, 0, 0) == hi - lo;
+					// the underlay only matters under see-through rows
+					if (!opaque && under >= 0 && draw_sprite_row(sheet, under, r, dst, lo, hi, 0, 0) == hi - lo) {
+						draw_sprite_row(sheet, tile, r, dst, lo, hi, 0, 0);
+						opaque = true;
+					}
+				}
+
+				if (opaque) {
+					if (span_x2 == span_x1) span_x1 = tx + lo;
+					span_x2 = tx + hi;
+					continue;
+				}
+
+				if (span_x2 > span_x1) lcd_draw(draw_span_buf + span_x1 - cx1, span_x1, ty + r, span_x2 - span_x1, 1);
+				span_x1 = span_x2 = 0;
+
+				// cells with see-through pixels keep what's behind them
+				if (tile != DRAW_TILE_EMPTY) {
+					if (under >= 0) draw_sprite_row(sheet, under, r, NULL, lo, hi, tx, ty + r);
+					draw_sprite_row(sheet, tile, r, NULL, lo, hi, tx, ty + r);
+				}
+			}
+		}
+	}
+}
+
+void draw_tilemap_local(int x, int y, Tilemap* map, int scroll_x, int scroll_y, int width, int height, Color erase) {
+	Spritesheet* sheet = map->sheet;
+	int cx1, cy1, cx2, cy2;
+	// lists can still replay a map or sheet after it was closed
+	if (!map->tiles || !sheet->bitmap || !draw_sprite_runs(sheet)) return;
+
+	// the viewport cut to the clip rect
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+	if (cx1 < x) cx1 = x;
+	if (cy1 < y) cy1 = y;
+	if (cx2 > x + width) cx2 = x + width;
+	if (cy2 > y + height) cy2 = y + height;
+	if (cx2 < cx1) cx2 = cx1;
+	if (cy2 < cy1) cy2 = cy1;
+	x -= scroll_x;
+	y -= scroll_y;
+
+	// changing the viewport, the clip or the sheet redraws every cell
+	u16 version = map->version;
+	bool full = map->drawn_version != version || map->drawn_sheet_version != sheet->version ||
+		map->drawn_clip[0] != cx1 || map->drawn_clip[1] != cy1 || map->drawn_clip[2] != cx2 || map->drawn_clip[3] != cy2;
+	int dx = x - map->drawn_x, dy = y - map->drawn_y;
+	map->drawn_version = version;
+	map->drawn_sheet_version = sheet->version;
+	map->drawn_x = x;
+	map->drawn_y = y;
+	map->drawn_clip[0] = cx1;
+	map->drawn_clip[1] = cy1;
+	map->drawn_clip[2] = cx2;
+	map->drawn_clip[3] = cy2;
+
+	if (full) {
+		draw_tilemap_cells(map, x, y, cx1, cy1, cx2, cy2, DRAW_CELLS_FULL, erase);
+		return;
+	}
+
+	// scrolling moves what's already in the viewport and only draws the
+	// columns and rows it uncovers, unless the framebuffer can't be read
+	if (dx || dy) {
+		int w = cx2 - cx1, h = cy2 - cy1;
+		if (dx < w && -dx < w && dy < h && -dy < h && lcd_move_local(cx1, cy1, w, h, dx, dy)) {
+			if (dx > 0) draw_tilemap_cells(map, x, y, cx1, cy1, cx1 + dx, cy2, DRAW_CELLS_EXPOSED, erase);
+			if (dx < 0) draw_tilemap_cells(map, x, y, cx2 + dx, cy1, cx2, cy2, DRAW_CELLS_EXPOSED, erase);
+			if (dy > 0) draw_tilemap_cells(map, x, y, cx1, cy1, cx2, cy1 + dy, DRAW_CELLS_EXPOSED, erase);
+			if (dy < 0) draw_tilemap_cells(map, x, y, cx1, cy2 + dy, cx2, cy2, DRAW_CELLS_EXPOSED, erase);
+		} else {
+			draw_tilemap_cells(map, x, y, cx1, cy1, cx2, cy2, DRAW_CELLS_EXPOSED, erase);
 		}
 	}
+	draw_tilemap_cells(map, x, y, cx1, cy1, cx2, cy2, DRAW_CELLS_DIRTY, erase);
+}
+
+int draw_batch_stride(u8 kind) {
+	switch (kind) {
+		case DRAW_BATCH_POINTS: return 2;
+		case DRAW_BATCH_CIRCLES:
+		case DRAW_BATCH_CIRCLESFILL: return 3;
+		default: return 4;
+	}
+}
+
+void draw_batch_local(u8 kind, int count, i16* data, i32 color) {
+	int stride = draw_batch_stride(kind) + (color < 0 ? 1 : 0);
+	Color c = color;
+
+	for (i16* d = data; count > 0; count--, d += stride) {
+		if (color < 0) c = d[stride - 1];
+		switch (kind) {
+			case DRAW_BATCH_POINTS: lcd_point_local(c, d[0], d[1]); break;
+			case DRAW_BATCH_LINES: draw_line_local(d[0], d[1], d[2], d[3], c); break;
+			case DRAW_BATCH_RECTS: draw_rect_local(d[0], d[1], d[2], d[3], c); break;
+			case DRAW_BATCH_RECTSFILL: lcd_fill_local(c, d[0], d[1], d[2], d[3]); break;
+			case DRAW_BATCH_CIRCLES: draw_circle_local(d[0], d[1], d[2], c); break;
+			case DRAW_BATCH_CIRCLESFILL: draw_fill_circle_local(d[0], d[1], d[2], c); break;
+		}
+	}
+}
+
+#define DRAW_OUT_LEFT 1
+#define DRAW_OUT_RIGHT 2
+#define DRAW_OUT_TOP 4
+#define DRAW_OUT_BOTTOM 8
+
+static inline int draw_outcode(int x, int y, int cx1, int cy1, int cx2, int cy2) {
+	int code = 0;
+	if (x < cx1) code |= DRAW_OUT_LEFT;
+	else if (x >= cx2) code |= DRAW_OUT_RIGHT;
+	if (y < cy1) code |= DRAW_OUT_TOP;
+	else if (y >= cy2) code |= DRAW_OUT_BOTTOM;
+	return code;
 }
 
+// first step along the long axis where the short one has moved by n
+static inline int draw_line_first_step(int n, int da, int db) {
+	if (n <= 0) return 0;
+	int64_t num = (int64_t)(2 * n - 1) * da;
+	return (num + 2 * db - 1) / (2 * db);
+}
+
+// lines are stepped along their long axis with the short one at
+// round(k * db / da), so the first visible step can be found without
+// walking to it and clipping doesn't move any pixel
 void draw_line_local(i16 x0, i16 y0, i16 x1, i16 y1, Color color) {
-	i16 dx =  abs(x1-x0);
-	i16 sx = x0 < x1 ? 1 : -1;
-	i16 dy = -abs(y1-y0);
-	i16 sy = y0<y1 ? 1 : -1;
-	i16 err = dx + dy;  /* error value e_xy */
-	while (1) {   /* loop */
-		draw_point(x0, y0, color);
-		if (x0 == x1 && y0 == y1) break;
-		i16 e2 = 2*err;
-		if (e2 >= dy) { /* e_xy+e_x > 0 */
-			err += dy;
-			x0 += sx;
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+	if (cx1 >= cx2 || cy1 >= cy2) return;
+	if (draw_outcode(x0, y0, cx1, cy1, cx2, cy2) & draw_outcode(x1, y1, cx1, cy1, cx2, cy2)) return;
+
+	// the outcodes already rejected axis aligned lines beside the clip
+	if (y0 == y1) {
+		int from = x0 < x1 ? x0 : x1, to = x0 < x1 ? x1 : x0;
+		if (from < cx1) from = cx1;
+		if (to >= cx2) to = cx2 - 1;
+		lcd_fill(color, from, y0, to - from + 1, 1);
+		return;
+	}
+	if (x0 == x1) {
+		int from = y0 < y1 ? y0 : y1, to = y0 < y1 ? y1 : y0;
+		if (from < cy1) from = cy1;
+		if (to >= cy2) to = cy2 - 1;
+		lcd_fill(color, x0, from, 1, to - from + 1);
+		return;
+	}
+
+	// a is the long axis, b the short one
+	bool steep = abs(y1 - y0) > abs(x1 - x0);
+	int a0 = steep ? y0 : x0, a1 = steep ? y1 : x1;
+	int b0 = steep ? x0 : y0, b1 = steep ? x1 : y1;
+	int alo = steep ? cy1 : cx1, ahi = (steep ? cy2 : cx2) - 1;
+	int blo = steep ? cx1 : cy1, bhi = (steep ? cx2 : cy2) - 1;
+	int sa = a1 > a0 ? 1 : -1, sb = b1 > b0 ? 1 : -1;
+	int da = abs(a1 - a0), db = abs(b1 - b0);
+
+	// steps where both axes are inside the clip
+	int k0 = 0, k1 = da;
+	int lo = sa > 0 ? alo - a0 : a0 - ahi;
+	int hi = sa > 0 ? ahi - a0 : a0 - alo;
+	if (lo > k0) k0 = lo;
+	if (hi < k1) k1 = hi;
+	lo = sb > 0 ? blo - b0 : b0 - bhi;
+	hi = sb > 0 ? bhi - b0 : b0 - blo;
+	if (lo > 0) {
+		int k = draw_line_first_step(lo, da, db);
+		if (k > k0) k0 = k;
+	}
+	if (hi < db) {
+		int k = draw_line_first_step(hi + 1, da, db) - 1;
+		if (k < k1) k1 = k;
+	}
+	if (k0 > k1) return;
+
+	int64_t num = (int64_t)2 * k0 * db + da;
+	int b = num / (2 * da);
+	int rem = num % (2 * da);
+	int a = a0 + sa * k0, len = 0;
+
+	// pixels sharing a row (or column for steep lines) go out as one fill
+	for (int k = k0; k <= k1; k++) {
+		len++;
+		rem += 2 * db;
+		bool step_b = rem >= 2 * da;
+		if (step_b || k == k1) {
+			int start = sa > 0 ? a : a - len + 1;
+			if (steep) lcd_fill(color, b0 + sb * b, start, 1, len);
+			else lcd_fill(color, start, b0 + sb * b, len, 1);
+			a += sa * len;
+			len = 0;
 		}
-		if (e2 <= dx) { /* e_xy+e_y < 0 */
-			err += dx;
-			y0 += sy;
+		if (step_b) {
+			rem -= 2 * da;
+			b++;
 		}
 	}
 }
 
+static bool draw_circle_visible(i16 xm, i16 ym, i16 r) {
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+	return xm + r >= cx1 && ym + r >= cy1 && xm - r < cx2 && ym - r < cy2;
+}
+
 void draw_circle_local(i16 xm, i16 ym, i16 r, Color color) {
+	if (!draw_circle_visible(xm, ym, r)) return;
 	 i16 x = -r, y = 0, err = 2 - 2 * r; /* II. Quadrant */
 	 do {
 			draw_point(xm - x, ym + y, color); /*   I. Quadrant */
@@ -147,6 +669,7 @@ void draw_circle_local(i16 xm, i16 ym, i16 r, Color color) {
 }
 
 void draw_fill_circle_local(i16 xm, i16 ym, i16 r, Color color) {
+	if (!draw_circle_visible(xm, ym, r)) return;
 	 i16 x = -r, y = 0, err = 2 - 2 * r; /* II. Quadrant */
 	 do {
 			draw_horizontal_line(xm + x, xm - x, ym - y, color);
@@ -163,48 +686,116 @@ void draw_polygon_local(int n, float* points, Color color) {
 	}
 }
 
-void draw_fill_polygon_local(int n, float* points, Color color) {
-	int polyCorners = n >> 1;
-	int nodes, nodeX[n], pixelX, pixelY, i, j, swap;
+// first pixel whose center is at or past v
+static inline int draw_fix_first(int64_t v) {
+	return (int)((v + 0x7fff) >> 16);
+}
+
+typedef struct {
+	// 16.16 at the center of the current scanline
+	int64_t x;
+	int64_t step;
+	int y_start;
+	int y_end;
+	int dir;
+} draw_poly_edge_t;
+
+// edge tables are only used by core 0 and grow to the biggest polygon seen
+static draw_poly_edge_t* draw_poly_edges = NULL;
+static draw_poly_edge_t** draw_poly_active = NULL;
+static int draw_poly_capacity = 0;
+
+static int draw_poly_edge_cmp(const void* a, const void* b) {
+	return ((const draw_poly_edge_t*)a)->y_start - ((const draw_poly_edge_t*)b)->y_start;
+}
+
+// active edge table filler, pixels are drawn when their center is inside
+// the polygon as decided by the fill rule
+void draw_fill_polygon_local(int n, float* points, Color color, u8 rule) {
+	int corners = n >> 1;
+	if (corners < 3) return;
 
-	// determine bounding segment on Y axis
-	int minY = MEM_HEIGHT, maxY = 0;
-	for (int i = 0; i < n; i += 2) {
-		if (points[i + 1] < minY) minY = points[i + 1];
-		if (points[i + 1] > maxY) maxY = points[i + 1];
+	if (corners > draw_poly_capacity) {
+		draw_poly_edge_t* edges = realloc(draw_poly_edges, corners * sizeof(draw_poly_edge_t));
+		if (edges) draw_poly_edges = edges;
+		draw_poly_edge_t** active = realloc(draw_poly_active, corners * sizeof(draw_poly_edge_t*));
+		if (active) draw_poly_active = active;
+		if (!edges || !active) return;
+		draw_poly_capacity = corners;
 	}
 
-	for (pixelY = minY; pixelY <= maxY; pixelY++) {
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
 
-		//  Build a list of nodes.
-		nodes = 0; j = polyCorners - 1;
-		for (i = 0; i < polyCorners; i++) {
-			int ii = i << 1;
-			int jj = j << 1;
-			if (points[ii + 1] < pixelY && points[jj + 1] >= pixelY || points[jj + 1] < pixelY && points[ii + 1] >= pixelY) {
-				nodeX[nodes++] = (int) (points[ii] + (pixelY - points[ii + 1]) / (points[jj + 1] - points[ii + 1]) *(points[jj] - points[ii])); 
-			}
-			j = i; 
+	// edge table, horizontal edges and ones between scanlines are left out
+	int count = 0, y_from = cy2, y_to = cy1;
+	for (int i = 0, j = corners - 1; i < corners; j = i++) {
+		i32 xa = DRAW_FIX(points[j * 2]), ya = DRAW_FIX(points[j * 2 + 1]);
+		i32 xb = DRAW_FIX(points[i * 2]), yb = DRAW_FIX(points[i * 2 + 1]);
+		int dir = 1;
+		if (yb < ya) {
+			i32 t = xa; xa = xb; xb = t;
+			t = ya; ya = yb; yb = t;
+			dir = -1;
 		}
 
-		//  Sort the nodes, via a simple "Bubble" sort.
-		i = 0;
-		while (i < nodes - 1) {
-			if (nodeX[i] > nodeX[i + 1]) {
-				swap = nodeX[i]; nodeX[i] = nodeX[i + 1]; nodeX[i + 1] = swap; if (i) i--; 
-			} else {
-				i++; 
+		draw_poly_edge_t* e = &draw_poly_edges[count];
+		e->y_start = draw_fix_first(ya);
+		e->y_end = draw_fix_first(yb);
+		if (e->y_start >= e->y_end) continue;
+		e->step = (int64_t)(xb - xa) * 0x10000 / (yb - ya);
+		e->x = xa + (((int64_t)e->y_start * 0x10000 + 0x8000 - ya) * e->step >> 16);
+		e->dir = dir;
+		if (e->y_start < y_from) y_from = e->y_start;
+		if (e->y_end > y_to) y_to = e->y_end;
+		count++;
+	}
+	if (y_from < cy1) y_from = cy1;
+	if (y_to > cy2) y_to = cy2;
+	if (y_from >= y_to) return;
+	qsort(draw_poly_edges, count, sizeof(draw_poly_edge_t), draw_poly_edge_cmp);
+
+	int next = 0, active = 0;
+	for (int y = y_from; y < y_to; y++) {
+		int k = 0;
+		for (int i = 0; i < active; i++) {
+			if (draw_poly_active[i]->y_end > y) draw_poly_active[k++] = draw_poly_active[i];
+		}
+		active = k;
+
+		// edges that start above the clip join at its first scanline
+		while (next < count && draw_poly_edges[next].y_start <= y) {
+			draw_poly_edge_t* e = &draw_poly_edges[next++];
+			if (e->y_end <= y) continue;
+			e->x += (y - e->y_start) * e->step;
+			draw_poly_active[active++] = e;
+		}
+
+		// the order barely changes between scanlines, so insertion sort
+		for (int i = 1; i < active; i++) {
+			draw_poly_edge_t* e = draw_poly_active[i];
+			int j = i - 1;
+			while (j >= 0 && draw_poly_active[j]->x > e->x) {
+				draw_poly_active[j + 1] = draw_poly_active[j];
+				j--;
 			}
+			draw_poly_active[j + 1] = e;
 		}
 
-		//  Fill the pixels between node pairs.
-		for (i = 0; i < nodes; i += 2) {
-			if   (nodeX[i] >= LCD_WIDTH) break;
-			if   (nodeX[i + 1] > 0 ) {
-				if (nodeX[i] < 0 ) nodeX[i] = 0;
-				if (nodeX[i + 1] >= LCD_WIDTH ) nodeX[i + 1] = LCD_WIDTH - 1;
-				draw_horizontal_line(nodeX[i], nodeX[i + 1], pixelY, color);
+		int winding = 0;
+		int64_t span_start = 0;
+		for (int i = 0; i < active; i++) {
+			draw_poly_edge_t* e = draw_poly_active[i];
+			bool inside = rule == DRAW_FILL_NONZERO ? winding != 0 : (i & 1);
+			if (!inside) span_start = e->x;
+			winding += e->dir;
+			if (inside && (rule != DRAW_FILL_NONZERO || winding == 0)) {
+				int x1 = draw_fix_first(span_start), x2 = draw_fix_first(e->x);
+				if (x1 < cx1) x1 = cx1;
+				if (x2 > cx2) x2 = cx2;
+				if (x1 < x2) lcd_fill(color, x1, y, x2 - x1, 1);
 			}
+			e->x += e->step;
 		}
 	}
 }
@@ -226,109 +817,233 @@ Color draw_color_mul(Color c, float factor) {
 	return RGB((u8)(r * factor), (u8)(g * factor), (u8)(b * factor));
 }
 
+// triangles take 16.16 fixed point vertices and cover the pixels whose
+// centers are inside, pixels on a top or left edge included, so triangles
+// sharing an edge neither leave gaps nor draw it twice
+#define DRAW_TRI_FLAT 0
+#define DRAW_TRI_SHADED 1
+#define DRAW_TRI_TEXTURED 2
+
 typedef struct {
-	Color c1, c2;
-	int x1, x2;
-} span_t;
+	i32 x, y;
+	// r, g, b for shaded triangles, u, v in 28.4 texels for textured ones
+	i32 v[3];
+} draw_vertex_t;
 
-static void draw_span(span_t span, int y) {
-	int xdiff = span.x2 - span.x1;
-	if(xdiff == 0)
-		return;
+typedef struct {
+	// 16.16 at the center of the current scanline
+	int64_t x;
+	int64_t step;
+} draw_edge_t;
+
+// edges always go top to bottom, so both triangles sharing one step it the
+// same way from the same scanline
+static void draw_edge_init(draw_edge_t* e, const draw_vertex_t* a, const draw_vertex_t* b, int y) {
+	e->step = (int64_t)(b->x - a->x) * 0x10000 / (b->y - a->y);
+	e->x = a->x + (((int64_t)y * 0x10000 + 0x8000 - a->y) * e->step >> 16);
+}
+
+static void draw_triangle_raster(draw_vertex_t* p, int values, int mode, Color color, Spritesheet* sprite, u8 spriteid) {
+	draw_vertex_t t;
+	if (p[1].y < p[0].y) { t = p[0]; p[0] = p[1]; p[1] = t; }
+	if (p[2].y < p[1].y) { t = p[1]; p[1] = p[2]; p[2] = t; }
+	if (p[1].y < p[0].y) { t = p[0]; p[0] = p[1]; p[1] = t; }
 
-	Color colordiff = draw_color_subtract(span.c2, span.c1);
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+	int y_top = draw_fix_first(p[0].y), y_mid = draw_fix_first(p[1].y), y_end = draw_fix_first(p[2].y);
+	int y_from = y_top < cy1 ? cy1 : y_top, y_to = y_end > cy2 ? cy2 : y_end;
+	if (y_from >= y_to) return;
 
-	float factor = 0.0f;
-	float factorStep = 1.0f / (float)xdiff;
+	// the gradients are worked out in 28.4 to keep the products in 64 bits
+	i32 dx1 = (p[1].x - p[0].x) >> 12, dy1 = (p[1].y - p[0].y) >> 12;
+	i32 dx2 = (p[2].x - p[0].x) >> 12, dy2 = (p[2].y - p[0].y) >> 12;
+	int64_t area = (int64_t)dx1 * dy2 - (int64_t)dx2 * dy1;
+	if (area == 0) return;
 
-	// draw each pixel in the span
-	for(int x = span.x1; x < span.x2; x++) {
-		draw_point(x, y, draw_color_add(span.c1, draw_color_mul(colordiff, factor)));
-		factor += factorStep;
+	// 16.16 change of each value per pixel
+	i32 gx[3], gy[3];
+	for (int n = 0; n < values; n++) {
+		int64_t dv1 = p[1].v[n] - p[0].v[n], dv2 = p[2].v[n] - p[0].v[n];
+		gx[n] = (dv1 * dy2 - dv2 * dy1) * 0x100000 / area;
+		gy[n] = (dv2 * dx1 - dv1 * dx2) * 0x100000 / area;
 	}
-}
 
-typedef struct {
-	Color c1, c2;
-	int x1, y1, x2, y2;
-} edge_t;
-
-static void draw_spans_between_edges(edge_t e1, edge_t e2) {
-	// calculate difference between the y coordinates
-	// of the first edge and return if 0
-	float e1ydiff = (float)(e1.y2 - e1.y1);
-	if(e1ydiff == 0.0f)
-		return;
+	// the long edge runs top to bottom, the middle vertex is on the right
+	// of it when the area is positive
+	bool mid_right = area > 0;
+	draw_edge_t long_edge, short_edge;
+	draw_edge_init(&long_edge, &p[0], &p[2], y_top);
+	long_edge.x += (y_from - y_top) * long_edge.step;
 
-	// calculate difference between the y coordinates
-	// of the second edge and return if 0
-	float e2ydiff = (float)(e2.y2 - e2.y1);
-	if(e2ydiff == 0.0f)
-		return;
+	Color* texels = NULL;
+	if (mode == DRAW_TRI_TEXTURED && !sprite->compiled) texels = sprite->bitmap + (spriteid % sprite->count) * sprite->width * sprite->height;
 
-	// calculate differences between the x coordinates
-	// and colors of the points of the edges
-	float e1xdiff = (float)(e1.x2 - e1.x1);
-	float e2xdiff = (float)(e2.x2 - e2.x1);
-	Color e1colordiff = (e1.c2 - e1.c1);
-	Color e2colordiff = (e2.c2 - e2.c1);
-
-	// calculate factors to use for interpolation
-	// with the edges and the step values to increase
-	// them by after drawing each span
-	float factor1 = (float)(e2.y1 - e1.y1) / e1ydiff;
-	float factorStep1 = 1.0f / e1ydiff;
-	float factor2 = 0.0f;
-	float factorStep2 = 1.0f / e2ydiff;
-
-	// loop through the lines between the edges and draw spans
-	for(int y = e2.y1; y < e2.y2; y++) {
-		// create and draw span
-		span_t span = {e1.c1 + (e1colordiff * factor1),
-							e1.x1 + (int)(e1xdiff * factor1),
-							e2.c1 + (e2colordiff * factor2),
-							e2.x1 + (int)(e2xdiff * factor2)};
-		draw_span(span, y);
-
-		// increase factors
-		factor1 += factorStep1;
-		factor2 += factorStep2;
-	}
-}
-
-void draw_triangle_shaded_local(Color c1, float x1, float y1, Color c2, float x2, float y2, Color c3, float x3, float y3) {
-	// create edges for the triangle
-	edge_t edges[3] = {
-		{c1, (int)x1, (int)y1, c2, (int)x2, (int)y2},
-		{c2, (int)x2, (int)y2, c3, (int)x3, (int)y3},
-		{c3, (int)x3, (int)y3, c1, (int)x1, (int)y1}
-	};
+	for (int y = y_from; y < y_to; y++) {
+		if (y == y_from || y == y_mid) {
+			if (y < y_mid) {
+				draw_edge_init(&short_edge, &p[0], &p[1], y_top);
+				short_edge.x += (y - y_top) * short_edge.step;
+			} else {
+				draw_edge_init(&short_edge, &p[1], &p[2], y_mid);
+				short_edge.x += (y - y_mid) * short_edge.step;
+			}
+		}
+
+		int x_from = draw_fix_first(mid_right ? long_edge.x : short_edge.x);
+		int x_to = draw_fix_first(mid_right ? short_edge.x : long_edge.x);
+		long_edge.x += long_edge.step;
+		short_edge.x += short_edge.step;
+		if (x_from < cx1) x_from = cx1;
+		if (x_to > cx2) x_to = cx2;
+		if (x_from >= x_to) continue;
+
+		if (mode == DRAW_TRI_FLAT) {
+			lcd_fill(color, x_from, y, x_to - x_from, 1);
+			continue;
+		}
 
-	int maxLength = 0;
-	int longEdge = 0;
+		// values at the center of the first pixel
+		i32 v[3];
+		int64_t px = ((int64_t)x_from << 16) + 0x8000 - p[0].x, py = ((int64_t)y << 16) + 0x8000 - p[0].y;
+		for (int n = 0; n < values; n++) v[n] = (p[0].v[n] << 16) + ((gx[n] * px + gy[n] * py) >> 16);
 
-	// find edge with the greatest length in the y axis
-	for(int i = 0; i < 3; i++) {
-		int length = edges[i].y2 - edges[i].y1;
-		if(length > maxLength) {
-			maxLength = length;
-			longEdge = i;
+		if (mode == DRAW_TRI_SHADED) {
+			for (int x = x_from; x < x_to; x++) {
+				// pixel centers past the vertices can overshoot a little
+				int c[3];
+				for (int n = 0; n < 3; n++) {
+					c[n] = v[n] < 0 ? 0 : (v[n] > 0xffffff ? 0xff : v[n] >> 16);
+					v[n] += gx[n];
+				}
+				draw_span_buf[x - x_from] = RGB(c[0], c[1], c[2]);
+			}
+			lcd_draw(draw_span_buf, x_from, y, x_to - x_from, 1);
+			continue;
 		}
+
+		// textures wrap around, masked texels leave gaps in the span
+		int run = x_from;
+		for (int x = x_from; x < x_to; x++) {
+			int u = v[0] >> 20, w = v[1] >> 20;
+			v[0] += gx[0];
+			v[1] += gx[1];
+			if ((unsigned)u >= (unsigned)sprite->width) u = (u % sprite->width + sprite->width) % sprite->width;
+			if ((unsigned)w >= (unsigned)sprite->height) w = (w % sprite->height + sprite->height) % sprite->height;
+
+			Color c = texels ? texels[u + w * sprite->width] : draw_sprite_get_pixel(sprite, u, w, spriteid);
+			if (c == sprite->mask) {
+				if (x > run) lcd_draw(draw_span_buf + run - x_from, run, y, x - run, 1);
+				run = x + 1;
+				continue;
+			}
+			draw_span_buf[x - x_from] = c;
+		}
+		if (x_to > run) lcd_draw(draw_span_buf + run - x_from, run, y, x_to - run, 1);
 	}
+}
+
+void draw_triangle_local(i32 x1, i32 y1, i32 x2, i32 y2, i32 x3, i32 y3, Color color) {
+	draw_vertex_t p[3] = {{x1, y1}, {x2, y2}, {x3, y3}};
+	draw_triangle_raster(p, 0, DRAW_TRI_FLAT, color, NULL, 0);
+}
 
-	int shortEdge1 = (longEdge + 1) % 3;
-	int shortEdge2 = (longEdge + 2) % 3;
+void draw_triangle_shaded_local(Color c1, i32 x1, i32 y1, Color c2, i32 x2, i32 y2, Color c3, i32 x3, i32 y3) {
+	draw_vertex_t p[3] = {
+		{x1, y1, {RED(c1), GREEN(c1), BLUE(c1)}},
+		{x2, y2, {RED(c2), GREEN(c2), BLUE(c2)}},
+		{x3, y3, {RED(c3), GREEN(c3), BLUE(c3)}}
+	};
+	draw_triangle_raster(p, 3, DRAW_TRI_SHADED, 0, NULL, 0);
+}
 
-	// draw spans between edges; the long edge can be drawn
-	// with the shorter edges to draw the full triangle
-	draw_spans_between_edges(edges[longEdge], edges[shortEdge1]);
-	draw_spans_between_edges(edges[longEdge], edges[shortEdge2]);
+void draw_triangle_textured_local(Spritesheet* sprite, u8 spriteid, const i32* coords) {
+	if (!sprite->bitmap) return;
+	draw_vertex_t p[3];
+	for (int i = 0; i < 3; i++) {
+		const i32* c = coords + i * 4;
+		p[i] = (draw_vertex_t){c[0], c[1], {c[2] >> 12, c[3] >> 12}};
+	}
+	draw_triangle_raster(p, 2, DRAW_TRI_TEXTURED, 0, sprite, spriteid);
 }
 
-// todo: blit, roto-scale, etc.
+// rotated and scaled blits map every destination pixel center back into
+// the sprite, x, y is where the sprite's center lands and everything is
+// 16.16 fixed point
+void draw_sprite_transformed_local(i32 x, i32 y, Spritesheet* sprite, u8 spriteid, i32 cos, i32 sin, i32 sx, i32 sy) {
+	if (!sprite->bitmap || sx == 0 || sy == 0) return;
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+
+	// bounding box of the rotated sprite
+	int64_t hw = (int64_t)sprite->width * abs(sx) / 2, hh = (int64_t)sprite->height * abs(sy) / 2;
+	int64_t ext_x = (abs(cos) * hw + abs(sin) * hh) >> 16;
+	int64_t ext_y = (abs(sin) * hw + abs(cos) * hh) >> 16;
+	int x_from = draw_fix_first(x - ext_x), x_to = draw_fix_first(x + ext_x) + 1;
+	int y_from = draw_fix_first(y - ext_y), y_to = draw_fix_first(y + ext_y) + 1;
+	if (x_from < cx1) x_from = cx1;
+	if (y_from < cy1) y_from = cy1;
+	if (x_to > cx2) x_to = cx2;
+	if (y_to > cy2) y_to = cy2;
+	if (x_from >= x_to || y_from >= y_to) return;
+
+	// inverse transform, destination to sprite pixels
+	i32 ua = ((int64_t)cos << 16) / sx, ub = ((int64_t)sin << 16) / sx;
+	i32 va = -((int64_t)sin << 16) / sy, vb = ((int64_t)cos << 16) / sy;
+	Color* texels = sprite->compiled ? NULL : sprite->bitmap + (spriteid % sprite->count) * sprite->width * sprite->height;
+
+	int64_t dx = (int64_t)x_from * 0x10000 + 0x8000 - x;
+	for (int py = y_from; py < y_to; py++) {
+		int64_t dy = (int64_t)py * 0x10000 + 0x8000 - y;
+		i32 u = ((ua * dx + ub * dy) >> 16) + (sprite->width << 15);
+		i32 v = ((va * dx + vb * dy) >> 16) + (sprite->height << 15);
+
+		// opaque pixels next to each other go out as one span
+		int run = x_from;
+		for (int px = x_from; px < x_to; px++, u += ua, v += va) {
+			int tu = u >> 16, tv = v >> 16;
+			Color c = sprite->mask;
+			if ((unsigned)tu < (unsigned)sprite->width && (unsigned)tv < (unsigned)sprite->height) {
+				c = texels ? texels[tu + tv * sprite->width] : draw_sprite_get_pixel(sprite, tu, tv, spriteid);
+			}
+			if (c == sprite->mask) {
+				if (px > run) lcd_draw(draw_span_buf + run - x_from, run, py, px - run, 1);
+				run = px + 1;
+				continue;
+			}
+			draw_span_buf[px - x_from] = c;
+		}
+		if (x_to > run) lcd_draw(draw_span_buf + run - x_from, run, py, x_to - run, 1);
+	}
+}
+
+// goes through the buffer rather than its pixels so a list replayed after
+// the buffer was closed draws nothing
+void draw_pixelbuffer_local(int x, int y, Pixelbuffer* buffer) {
+	if (!buffer->pixels) return;
+	lcd_draw_local(buffer->pixels, x, y, buffer->width, buffer->height);
+}
+
+// lists run with their own clip state on top of the current one, moved by
+// x, y. Only core 0 may replay a list
+void draw_list_local(multicore_list_t* list, int x, int y) {
+	int ox, oy, x1, y1, x2, y2;
+	if (list->failed) return;
+	// past the clip stack's depth a pop restores nothing, so the origin and
+	// clip are put back by hand, the push and pop keep the depth balanced
+	lcd_get_origin(&ox, &oy);
+	lcd_clip_bounds(&x1, &y1, &x2, &y2);
+	lcd_push_clip_local();
+	lcd_set_origin_local(ox + x, oy + y);
+	multicore_list_replay(list);
+	lcd_pop_clip_local();
+	lcd_set_origin_local(ox, oy);
+	lcd_set_clip_local(x1, y1, x2 - x1, y2 - y1);
+}
 
 int draw_fifo_receiver(uint32_t message) {
 	uint32_t x1, y1, c1, x2, y2, c2, x3, y3, c3;
+	i32 coords[12];
 	
 	switch (message) {
 		case FIFO_DRAW_CLEAR:
@@ -336,86 +1051,141 @@ int draw_fifo_receiver(uint32_t message) {
 			return 1;
 
 		case FIFO_DRAW_RECT:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			y2 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			y2 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
 			draw_rect_local((i16)x1, (i16)y1, (i16)x2, (i16)y2, (Color)c1);
 			return 1;
 
 		case FIFO_DRAW_RECTFILL:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			y2 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			y2 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
 			draw_fill_rect_local((i16)x1, (i16)y1, (i16)x2, (i16)y2, (Color)c1);
 			return 1;
 
 		case FIFO_DRAW_LINE:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			y2 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			y2 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
 			draw_line_local((i16)x1, (i16)y1, (i16)x2, (i16)y2, (Color)c1);
 			return 1;
 
 		case FIFO_DRAW_CIRC:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
 			draw_circle_local((i16)x1, (i16)y1, (i16)x2, (Color)c1);
 			return 1;
 
 		case FIFO_DRAW_CIRCFILL:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
 			draw_fill_circle_local((i16)x1, (i16)y1, (i16)x2, (Color)c1);
 			return 1;
 
 		case FIFO_DRAW_POLY:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
 			draw_polygon_local((int)x1, (float*)y1, (Color)c1);
-			free((float*)y1);
+			multicore_cmd_free((float*)y1);
 			return 1;
 
 		case FIFO_DRAW_POLYFILL:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
-			draw_fill_polygon_local((int)x1, (float*)y1, (Color)c1);
-			free((float*)y1);
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			c2 = multicore_cmd_pop();
+			draw_fill_polygon_local((int)x1, (float*)y1, (Color)c1, (u8)c2);
+			multicore_cmd_free((float*)y1);
+			return 1;
+
+		case FIFO_DRAW_TRIFILL:
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			y2 = multicore_cmd_pop();
+			x3 = multicore_cmd_pop();
+			y3 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			draw_triangle_local((i32)x1, (i32)y1, (i32)x2, (i32)y2, (i32)x3, (i32)y3, (Color)c1);
 			return 1;
 
 		case FIFO_DRAW_TRI:
-			c1 = multicore_fifo_pop_blocking_inline();
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			c2 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			y2 = multicore_fifo_pop_blocking_inline();
-			c3 = multicore_fifo_pop_blocking_inline();
-			x3 = multicore_fifo_pop_blocking_inline();
-			y3 = multicore_fifo_pop_blocking_inline();
-			draw_triangle_shaded_local((Color)c1, (float)x1, (float)y1, (Color)c2, (float)x2, (float)y2, (Color)c3, (float)x3, (float)y3);
+			c1 = multicore_cmd_pop();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c2 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			y2 = multicore_cmd_pop();
+			c3 = multicore_cmd_pop();
+			x3 = multicore_cmd_pop();
+			y3 = multicore_cmd_pop();
+			draw_triangle_shaded_local((Color)c1, (i32)x1, (i32)y1, (Color)c2, (i32)x2, (i32)y2, (Color)c3, (i32)x3, (i32)y3);
+			return 1;
+
+		case FIFO_DRAW_TRITEX:
+			c1 = multicore_cmd_pop();
+			c2 = multicore_cmd_pop();
+			for (int i = 0; i < 12; i++) coords[i] = (i32)multicore_cmd_pop();
+			draw_triangle_textured_local((Spritesheet*)c1, (u8)c2, coords);
 			return 1;
 
 		case FIFO_DRAW_SPRITE:
-			x1 = multicore_fifo_pop_blocking_inline();
-			y1 = multicore_fifo_pop_blocking_inline();
-			c1 = multicore_fifo_pop_blocking_inline();
-			x2 = multicore_fifo_pop_blocking_inline();
-			y2 = multicore_fifo_pop_blocking_inline();
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			y2 = multicore_cmd_pop();
 			draw_sprite_local((i16)x1, (i16)y1, (Spritesheet*)c1, (u8)x2, (u8)y2);
 			return 1;
 
+		case FIFO_DRAW_BATCH:
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			x2 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			draw_batch_local((u8)x1, (int)y1, (i16*)x2, (i32)c1);
+			multicore_cmd_free((i16*)x2);
+			return 1;
+
+		case FIFO_DRAW_LIST:
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			draw_list_local((multicore_list_t*)c1, (int)x1, (int)y1);
+			return 1;
+
+		case FIFO_DRAW_SPRITEXFORM:
+			for (int i = 0; i < 8; i++) coords[i] = (i32)multicore_cmd_pop();
+			draw_sprite_transformed_local(coords[0], coords[1], (Spritesheet*)coords[2], (u8)coords[3], coords[4], coords[5], coords[6], coords[7]);
+			return 1;
+
+		case FIFO_DRAW_TILEMAP:
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			for (int i = 0; i < 5; i++) coords[i] = (i32)multicore_cmd_pop();
+			draw_tilemap_local((int)x1, (int)y1, (Tilemap*)c1, coords[0], coords[1], coords[2], coords[3], (Color)coords[4]);
+			return 1;
+
+		case FIFO_DRAW_PIXELBUFFER:
+			x1 = multicore_cmd_pop();
+			y1 = multicore_cmd_pop();
+			c1 = multicore_cmd_pop();
+			draw_pixelbuffer_local((int)x1, (int)y1, (Pixelbuffer*)c1);
+			return 1;
+
 		default:
 			return 0;
 	}
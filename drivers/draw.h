@@ -7,6 +7,21 @@
 #define DRAW_MIRROR_H 1
 #define DRAW_MIRROR_V 2
 
+#define DRAW_BATCH_POINTS 0
+#define DRAW_BATCH_LINES 1
+#define DRAW_BATCH_RECTS 2
+#define DRAW_BATCH_RECTSFILL 3
+#define DRAW_BATCH_CIRCLES 4
+#define DRAW_BATCH_CIRCLESFILL 5
+
+#define DRAW_FILL_EVENODD 0
+#define DRAW_FILL_NONZERO 1
+
+#define DRAW_SPRITE_NO_MEMORY -1
+
+// triangle vertices are 16.16 fixed point
+#define DRAW_FIX(v) ((i32)((v) * 65536.0f))
+
 typedef u16 Color;
 
 typedef struct {
@@ -15,146 +30,289 @@ typedef struct {
 	u8 count;
 	Color mask;
 	Color* bitmap;
+	// opaque runs of each row as start, length pairs, built on first blit
+	u32* run_index;
+	u16* runs;
+	u16 version;
+	u16 runs_version;
+	// compiled sheets only keep opaque pixels in bitmap, row_pixels is
+	// where each row starts
+	bool compiled;
+	u32* row_pixels;
 } Spritesheet;
 
+#define DRAW_TILE_EMPTY 0xff
+
+typedef struct {
+	u16 width;
+	u16 height;
+	Spritesheet* sheet;
+	// tile drawn beneath every cell, -1 for none
+	i16 underlay;
+	u8* tiles;
+	// cells changed since the last draw, core 0 clears them as it draws
+	u8* dirty;
+	// the whole map is redrawn when any of these differ from the last draw
+	u16 version;
+	u16 drawn_version;
+	u16 drawn_sheet_version;
+	int drawn_clip[4];
+	// where the map's corner was last drawn, moving it scrolls the viewport
+	int drawn_x;
+	int drawn_y;
+} Tilemap;
+
+// plain pixels written from Lua and sent to the screen in one piece
+typedef struct {
+	u16 width;
+	u16 height;
+	Color* pixels;
+} Pixelbuffer;
+
 Color draw_color_from_hsv(u8 h, u8 s, u8 v);
 void draw_color_to_hsv(Color c, u8* h, u8* s, u8* v);
 Color draw_color_add(Color c1, Color c2);
 Color draw_color_subtract(Color c1, Color c2);
 Color draw_color_mul(Color c, float factor);
 
+bool draw_sprite_compile(Spritesheet* sprite);
+bool draw_sprite_index_pixels(Spritesheet* sprite, u32* total);
+Color draw_sprite_get_pixel(Spritesheet* sprite, int x, int y, int spriteid);
+// return a FRESULT, or DRAW_SPRITE_NO_MEMORY
+int draw_sprite_load(Spritesheet* sprite, const char* filename);
+int draw_sprite_save(Spritesheet* sprite, const char* filename);
+
 void draw_clear_local();
 void draw_sprite_local(i16 x, i16 y, Spritesheet* sprite, u8 spriteid, u8 flip);
+void draw_sprite_transformed_local(i32 x, i32 y, Spritesheet* sprite, u8 spriteid, i32 cos, i32 sin, i32 sx, i32 sy);
 void draw_rect_local(i16 x, i16 y, i16 width, i16 height, Color color);
 void draw_fill_rect_local(i16 x, i16 y, i16 width, i16 height, Color color);
+// draws the part of the map inside the viewport x, y, width, height, scrolled
+// by scroll_x, scroll_y, cells that changed or scrolled in are cleared to erase
+void draw_tilemap_local(int x, int y, Tilemap* map, int scroll_x, int scroll_y, int width, int height, Color erase);
+void draw_pixelbuffer_local(int x, int y, Pixelbuffer* buffer);
+void draw_list_local(multicore_list_t* list, int x, int y);
+int draw_batch_stride(u8 kind);
+void draw_batch_local(u8 kind, int count, i16* data, i32 color);
 void draw_line_local(i16 x0, i16 y0, i16 x1, i16 y1, Color color);
 void draw_circle_local(i16 xm, i16 ym, i16 r, Color color);
 void draw_fill_circle_local(i16 xm, i16 ym, i16 r, Color color);
 void draw_polygon_local(int n, float* points, Color color);
-void draw_fill_polygon_local(int n, float* points, Color color);
-void draw_triangle_shaded_local(Color c1, float x1, float y1, Color c2, float x2, float y2, Color c3, float x3, float y3);
+void draw_fill_polygon_local(int n, float* points, Color color, u8 rule);
+void draw_triangle_local(i32 x1, i32 y1, i32 x2, i32 y2, i32 x3, i32 y3, Color color);
+void draw_triangle_shaded_local(Color c1, i32 x1, i32 y1, Color c2, i32 x2, i32 y2, Color c3, i32 x3, i32 y3);
+void draw_triangle_textured_local(Spritesheet* sprite, u8 spriteid, const i32* coords);
 
 int draw_fifo_receiver(uint32_t message);
 
 static inline void draw_point(i16 x, i16 y, Color color) {
 	if (get_core_num() == 0) lcd_point_local(color, x, y);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_POINT);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
+		multicore_cmd_push(FIFO_LCD_POINT);
+		multicore_cmd_push((uint32_t)color);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
 	}
 }
 
 static inline void draw_clear() {
 	if (get_core_num() == 0) draw_clear_local();
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_CLEAR);
+		multicore_cmd_push(FIFO_DRAW_CLEAR);
 	}
 }
 
 static inline void draw_rect(i16 x, i16 y, i16 width, i16 height, Color color) {
 	if (get_core_num() == 0) draw_rect_local(x, y, width, height, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_RECT);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)width);
-		multicore_fifo_push_blocking_inline((uint32_t)height);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_RECT);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)width);
+		multicore_cmd_push((uint32_t)height);
+		multicore_cmd_push((uint32_t)color);
 	}
 }
 
 static inline void draw_fill_rect(i16 x, i16 y, i16 width, i16 height, Color color) {
 	if (get_core_num() == 0) draw_fill_rect_local(x, y, width, height, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_RECTFILL);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)width);
-		multicore_fifo_push_blocking_inline((uint32_t)height);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_RECTFILL);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)width);
+		multicore_cmd_push((uint32_t)height);
+		multicore_cmd_push((uint32_t)color);
 	}
 }
 
 static inline void draw_line(i16 x0, i16 y0, i16 x1, i16 y1, Color color) {
 	if (get_core_num() == 0) draw_line_local(x0, y0, x1, y1, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_LINE);
-		multicore_fifo_push_blocking_inline((uint32_t)x0);
-		multicore_fifo_push_blocking_inline((uint32_t)y0);
-		multicore_fifo_push_blocking_inline((uint32_t)x1);
-		multicore_fifo_push_blocking_inline((uint32_t)y1);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_LINE);
+		multicore_cmd_push((uint32_t)x0);
+		multicore_cmd_push((uint32_t)y0);
+		multicore_cmd_push((uint32_t)x1);
+		multicore_cmd_push((uint32_t)y1);
+		multicore_cmd_push((uint32_t)color);
 	}
 }
 
 static inline void draw_circle(i16 xm, i16 ym, i16 r, Color color) {
 	if (get_core_num() == 0) draw_circle_local(xm, ym, r, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_CIRC);
-		multicore_fifo_push_blocking_inline((uint32_t)xm);
-		multicore_fifo_push_blocking_inline((uint32_t)ym);
-		multicore_fifo_push_blocking_inline((uint32_t)r);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_CIRC);
+		multicore_cmd_push((uint32_t)xm);
+		multicore_cmd_push((uint32_t)ym);
+		multicore_cmd_push((uint32_t)r);
+		multicore_cmd_push((uint32_t)color);
 	}
 }
 
 static inline void draw_fill_circle(i16 xm, i16 ym, i16 r, Color color) {
 	if (get_core_num() == 0) draw_fill_circle_local(xm, ym, r, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_CIRCFILL);
-		multicore_fifo_push_blocking_inline((uint32_t)xm);
-		multicore_fifo_push_blocking_inline((uint32_t)ym);
-		multicore_fifo_push_blocking_inline((uint32_t)r);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_CIRCFILL);
+		multicore_cmd_push((uint32_t)xm);
+		multicore_cmd_push((uint32_t)ym);
+		multicore_cmd_push((uint32_t)r);
+		multicore_cmd_push((uint32_t)color);
+	}
+}
+
+// data holds count primitives of draw_batch_stride values, followed by
+// their color when color is negative
+static inline void draw_batch(u8 kind, int count, i16* data, i32 color) {
+	if (get_core_num() == 0) draw_batch_local(kind, count, data, color);
+	else {
+		multicore_cmd_push(FIFO_DRAW_BATCH);
+		multicore_cmd_push((uint32_t)kind);
+		multicore_cmd_push((uint32_t)count);
+		multicore_cmd_push((uint32_t)data);
+		multicore_cmd_push((uint32_t)color);
 	}
 }
 
 static inline void draw_polygon(int n, float* points, Color color) {
 	if (get_core_num() == 0) draw_polygon_local(n, points, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_POLY);
-		multicore_fifo_push_blocking_inline(n);
-		multicore_fifo_push_blocking_inline((uint32_t)points);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_POLY);
+		multicore_cmd_push(n);
+		multicore_cmd_push((uint32_t)points);
+		multicore_cmd_push((uint32_t)color);
+	}
+}
+
+static inline void draw_fill_polygon(int n, float* points, Color color, u8 rule) {
+	if (get_core_num() == 0) draw_fill_polygon_local(n, points, color, rule);
+	else {
+		multicore_cmd_push(FIFO_DRAW_POLYFILL);
+		multicore_cmd_push((uint32_t)n);
+		multicore_cmd_push((uint32_t)points);
+		multicore_cmd_push((uint32_t)color);
+		multicore_cmd_push((uint32_t)rule);
 	}
 }
 
-static inline void draw_fill_polygon(int n, float* points, Color color) {
-	if (get_core_num() == 0) draw_fill_polygon_local(n, points, color);
+static inline void draw_triangle(i32 x1, i32 y1, i32 x2, i32 y2, i32 x3, i32 y3, Color color) {
+	if (get_core_num() == 0) draw_triangle_local(x1, y1, x2, y2, x3, y3, color);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_POLYFILL);
-		multicore_fifo_push_blocking_inline((uint32_t)n);
-		multicore_fifo_push_blocking_inline((uint32_t)points);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
+		multicore_cmd_push(FIFO_DRAW_TRIFILL);
+		multicore_cmd_push((uint32_t)x1);
+		multicore_cmd_push((uint32_t)y1);
+		multicore_cmd_push((uint32_t)x2);
+		multicore_cmd_push((uint32_t)y2);
+		multicore_cmd_push((uint32_t)x3);
+		multicore_cmd_push((uint32_t)y3);
+		multicore_cmd_push((uint32_t)color);
 	}
 }
 
-static inline void draw_triangle_shaded(Color c1, float x1, float y1, Color c2, float x2, float y2, Color c3, float x3, float y3) {
+static inline void draw_triangle_shaded(Color c1, i32 x1, i32 y1, Color c2, i32 x2, i32 y2, Color c3, i32 x3, i32 y3) {
 	if (get_core_num() == 0) draw_triangle_shaded_local(c1, x1, y1, c2, x2, y2, c3, x3, y3);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_TRI);
-		multicore_fifo_push_blocking_inline((uint32_t)c1);
-		multicore_fifo_push_blocking_inline((uint32_t)x1);
-		multicore_fifo_push_blocking_inline((uint32_t)y1);
-		multicore_fifo_push_blocking_inline((uint32_t)c2);
-		multicore_fifo_push_blocking_inline((uint32_t)x2);
-		multicore_fifo_push_blocking_inline((uint32_t)y2);
-		multicore_fifo_push_blocking_inline((uint32_t)c3);
-		multicore_fifo_push_blocking_inline((uint32_t)x3);
-		multicore_fifo_push_blocking_inline((uint32_t)y3);
+		multicore_cmd_push(FIFO_DRAW_TRI);
+		multicore_cmd_push((uint32_t)c1);
+		multicore_cmd_push((uint32_t)x1);
+		multicore_cmd_push((uint32_t)y1);
+		multicore_cmd_push((uint32_t)c2);
+		multicore_cmd_push((uint32_t)x2);
+		multicore_cmd_push((uint32_t)y2);
+		multicore_cmd_push((uint32_t)c3);
+		multicore_cmd_push((uint32_t)x3);
+		multicore_cmd_push((uint32_t)y3);
+	}
+}
+
+// coords holds x, y, u, v for each vertex
+static inline void draw_triangle_textured(Spritesheet* sprite, u8 spriteid, const i32* coords) {
+	if (get_core_num() == 0) draw_triangle_textured_local(sprite, spriteid, coords);
+	else {
+		multicore_cmd_push(FIFO_DRAW_TRITEX);
+		multicore_cmd_push((uint32_t)sprite);
+		multicore_cmd_push((uint32_t)spriteid);
+		for (int i = 0; i < 12; i++) multicore_cmd_push((uint32_t)coords[i]);
 	}
 }
 
 static inline void draw_sprite(i16 x, i16 y, Spritesheet* sprite, u8 spriteid, u8 flip) {
 	if (get_core_num() == 0) draw_sprite_local(x, y, sprite, spriteid, flip);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_DRAW_SPRITE);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)sprite);
-		multicore_fifo_push_blocking_inline((uint32_t)spriteid);
-		multicore_fifo_push_blocking_inline((uint32_t)flip);
+		multicore_cmd_push(FIFO_DRAW_SPRITE);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)sprite);
+		multicore_cmd_push((uint32_t)spriteid);
+		multicore_cmd_push((uint32_t)flip);
+	}
+}
+
+static inline void draw_tilemap(int x, int y, Tilemap* map, int scroll_x, int scroll_y, int width, int height, Color erase) {
+	if (get_core_num() == 0) draw_tilemap_local(x, y, map, scroll_x, scroll_y, width, height, erase);
+	else {
+		multicore_cmd_push(FIFO_DRAW_TILEMAP);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)map);
+		multicore_cmd_push((uint32_t)scroll_x);
+		multicore_cmd_push((uint32_t)scroll_y);
+		multicore_cmd_push((uint32_t)width);
+		multicore_cmd_push((uint32_t)height);
+		multicore_cmd_push((uint32_t)erase);
+	}
+}
+
+static inline void draw_pixelbuffer(int x, int y, Pixelbuffer* buffer) {
+	if (get_core_num() == 0) draw_pixelbuffer_local(x, y, buffer);
+	else {
+		multicore_cmd_push(FIFO_DRAW_PIXELBUFFER);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)buffer);
 	}
-}
\ No newline at end of file
+}
+
+static inline void draw_sprite_transformed(i32 x, i32 y, Spritesheet* sprite, u8 spriteid, i32 cos, i32 sin, i32 sx, i32 sy) {
+	if (get_core_num() == 0) draw_sprite_transformed_local(x, y, sprite, spriteid, cos, sin, sx, sy);
+	else {
+		multicore_cmd_push(FIFO_DRAW_SPRITEXFORM);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)sprite);
+		multicore_cmd_push((uint32_t)spriteid);
+		multicore_cmd_push((uint32_t)cos);
+		multicore_cmd_push((uint32_t)sin);
+		multicore_cmd_push((uint32_t)sx);
+		multicore_cmd_push((uint32_t)sy);
+	}
+}
+
+static inline void draw_list(multicore_list_t* list, int x, int y) {
+	if (get_core_num() == 0) draw_list_local(list, x, y);
+	else {
+		multicore_cmd_push(FIFO_DRAW_LIST);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)list);
+	}
+}
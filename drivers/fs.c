@@ -5,10 +5,10 @@
 #include "pico/time.h"
 
 #include "fs.h"
+#include "workqueue.h"
 
 static FATFS global_fs;
 static bool mounted = false;
-volatile atomic_bool fs_needs_remount = false;
 
 #define SD_MISO   16
 #define SD_MOSI   19
@@ -40,26 +40,39 @@ char* fs_error_strings[20] = {
 	"Given parameter is invalid",
 };
 
+static void fs_remount_work(void* arg) {
+	printf("\x1b[91mSD inserted, mounting...");
+	if (fs_mount()) {
+		printf("\x1b[92mOK!\x1b[m\n");
+	} else {
+		printf("Failed to mount!\x1b[m\n");
+	}
+}
+
+static void fs_unplug_work(void* arg) {
+	printf("\x1b[91mSD unplugged! ");
+	if (fs_unmount()) {
+		printf("Unmounted!\x1b[m\n");
+	} else {
+		printf("Failed to unmount!\x1b[m\n");
+	}
+}
+
 static void sd_hotplug(uint gpio, uint32_t events) {
-	// wait debounce_ms and make sure status is still the same, then act accordingly
+	// wait debounce_ms and make sure status is still the same, then let
+	// core 0's main loop mount or unmount outside of the interrupt
 	if (gpio == SD_DETECT) {
 		if (events & GPIO_IRQ_EDGE_RISE) {
 			// sd removed
 			busy_wait_us(DEBOUNCE_US);
 			if (gpio_get(SD_DETECT) == 1) {
-				printf("\x1b[91mSD unplugged! ");
-				if (fs_unmount()) {
-					printf("Unmounted!\x1b[m\n");
-				} else {
-					printf("Failed to unmount!\x1b[m\n");
-				}
+				workqueue_push(fs_unplug_work, NULL, WORK_PRIORITY_NORMAL);
 			}
 		} else if (events & GPIO_IRQ_EDGE_FALL) {
 			// sd inserted
 			busy_wait_us(DEBOUNCE_US);
 			if (gpio_get(SD_DETECT) == 0) {
-				printf("\x1b[91mSD inserted, mounting...");
-				atomic_store(&fs_needs_remount, true);
+				workqueue_push(fs_remount_work, NULL, WORK_PRIORITY_NORMAL);
 			}
 		}
 		gpio_acknowledge_irq(SD_DETECT, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
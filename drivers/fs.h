@@ -1,9 +1,6 @@
 #pragma once
-#include <stdatomic.h>
 #include "../pico_fatfs/fatfs/ff.h"
 
-extern volatile atomic_bool fs_needs_remount;
-
 extern char* fs_error_strings[20];
 
 void fs_init();
@@ -1,6 +1,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
@@ -9,6 +10,8 @@
 #include "hardware/gpio.h"
 #include "hardware/pio.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 #include "st7789_lcd.pio.h"
 #include "psram_spi.h"
 
@@ -27,10 +30,18 @@
 #define LCD_PIO pio1
 #define SERIAL_CLK_DIV 1.f
 
-void(*lcd_draw_ptr) (u16*,int,int,int,int);
+void(*lcd_draw_ptr) (u16*,int,int,int,int,int);
 void(*lcd_fill_ptr) (u16,int,int,int,int);
 void(*lcd_point_ptr) (u16,int,int);
 void(*lcd_clear_ptr) (void);
+// reads a row back for blending, NULL when the mode can't
+void(*lcd_read_ptr) (u16*,int,int,int);
+
+static uint64_t lcd_time_us() {
+	return time_us_64();
+}
+
+uint64_t (*lcd_clock_us)(void) = &lcd_time_us;
 
 psram_spi_inst_t psram_spi;
 psram_spi_inst_t* async_spi_inst;
@@ -41,15 +52,109 @@ uint lcd_offset;
 uint8_t* framebuffer;
 int framebuffer_mode;
 int lcd_current_height;
+lcd_stats_t lcd_stats;
+
+// dirty span of each framebuffer row, x2 < 0 means the row is clean.
+// blit coalesces consecutive dirty rows into bands sent as one region
+static int16_t lcd_dirty_x1[LCD_HEIGHT];
+static int16_t lcd_dirty_x2[LCD_HEIGHT];
+static bool lcd_dirty_tracking;
+
+// pixels a band may waste before it's cheaper to start a new region
+#define LCD_BAND_SLACK 64
+
+// PSRAM byte offsets of the buffer being drawn to and the one on screen,
+// they only differ in LCD_BUFFERMODE_DOUBLE
+#define LCD_FRAME_BYTES (LCD_WIDTH * LCD_HEIGHT * 2)
+static uint32_t lcd_psram_back;
+static uint32_t lcd_psram_front;
+
+// palette of the indexed modes, stored byte swapped ready for the PIO.
+// Pairs expand a whole 4bpp byte to two pixels at once
+static u16 lcd_palette[256];
+static uint32_t lcd_palette_pairs[256];
+
+// clip rect in screen coordinates, x2/y2 exclusive, and the screen position
+// drawing coordinates are relative to
+typedef struct {
+	int x1, y1, x2, y2;
+	int ox, oy;
+} lcd_clip_t;
+
+#define LCD_CLIP_DEPTH 8
+static lcd_clip_t lcd_clip = {0, 0, LCD_WIDTH, MEM_HEIGHT, 0, 0};
+static lcd_clip_t lcd_clip_stack[LCD_CLIP_DEPTH];
+static int lcd_clip_depth = 0;
+
+// framebuffer row shown at the top of the screen, buffered modes scroll by
+// moving this instead of the panel's scroll register
+static int lcd_buffer_scroll;
+
+// blending, alpha is 0-32
+static u8 lcd_blend_mode = LCD_BLEND_NONE;
+static u8 lcd_blend_alpha = 32;
+static u16 lcd_blend_buf[LCD_WIDTH];
 
 #define LCD_TMPBUF_SIZE LCD_WIDTH*2
 uint16_t lcd_tmpbuf[LCD_TMPBUF_SIZE];
 
+// pixels are streamed to the PIO TX FIFO by DMA, one byte per transfer, so
+// line buffers hold byte-swapped (big endian) RGB565 and are double-buffered:
+// one is filled by the CPU while the other is being clocked out
+static int lcd_dma_chan;
+static uint16_t lcd_dma_buf[2][LCD_WIDTH];
+static uint8_t lcd_dma_select;
+static uint16_t lcd_dma_color;
+static bool lcd_dma_pending;
+
+// asynchronous present of the front buffer, driven from the DMA IRQ
+static volatile bool lcd_present_active;
+static int lcd_present_line;
+static int lcd_present_scroll;
+static uint64_t lcd_present_started;
+
 static inline void lcd_set_dc_cs(bool dc, bool cs) {
 	gpio_put_masked((1u << LCD_DC) | (1u << LCD_CS), !!dc << LCD_DC | !!cs << LCD_CS);
 }
 
+// completion fence: waits for any DMA transfer to be clocked out and ends the
+// open RAMWR by raising CS. must be called before sending any command
+void lcd_wait_dma() {
+	while (lcd_present_active) tight_loop_contents();
+	if (!lcd_dma_pending) return;
+	dma_channel_wait_for_finish_blocking(lcd_dma_chan);
+	st7789_lcd_wait_idle(LCD_PIO, lcd_sm);
+	lcd_set_dc_cs(0, 1);
+	lcd_dma_pending = false;
+}
+
+static void lcd_dma_start(const void* src, uint32_t bytes, bool repeat) {
+	dma_channel_config c = dma_channel_get_default_config(lcd_dma_chan);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	// repeat reads the same 2 bytes over and over for solid fills
+	if (repeat) channel_config_set_ring(&c, false, 1);
+	channel_config_set_dreq(&c, pio_get_dreq(LCD_PIO, lcd_sm, true));
+	dma_channel_configure(lcd_dma_chan, &c, &LCD_PIO->txf[lcd_sm], src, bytes, true);
+	lcd_dma_pending = true;
+}
+
+// returns the line buffer that is safe to fill next
+static inline uint16_t* lcd_dma_line() {
+	return lcd_dma_buf[lcd_dma_select];
+}
+
+// queues the filled line buffer and flips to the other one, only waiting
+// for the transfer before it to finish
+static void lcd_dma_send_line(size_t count) {
+	dma_channel_wait_for_finish_blocking(lcd_dma_chan);
+	lcd_dma_start(lcd_dma_buf[lcd_dma_select], count << 1, false);
+	lcd_dma_select ^= 1;
+}
+
 static inline void lcd_write_cmd(const uint8_t *cmd, size_t count) {
+	lcd_wait_dma();
 	st7789_lcd_wait_idle(LCD_PIO, lcd_sm);
 	lcd_set_dc_cs(0, 0);
 	st7789_lcd_put(LCD_PIO, lcd_sm, *cmd++);
@@ -63,15 +168,22 @@ static inline void lcd_write_cmd(const uint8_t *cmd, size_t count) {
 	lcd_set_dc_cs(0, 1);
 }
 
-static inline void lcd_write16(const uint16_t *data, size_t count) {
-	uint16_t color;
-	for (size_t i = 0; i < count; ++i) {
-		color = *data++;
-		st7789_lcd_put(LCD_PIO, lcd_sm, color >> 8);
-		st7789_lcd_put(LCD_PIO, lcd_sm, color & 0xff);
+static void lcd_write16(const uint16_t *data, size_t count) {
+	while (count > 0) {
+		size_t n = count < LCD_WIDTH ? count : LCD_WIDTH;
+		uint16_t* line = lcd_dma_line();
+		for (size_t i = 0; i < n; ++i) line[i] = __builtin_bswap16(*data++);
+		lcd_dma_send_line(n);
+		count -= n;
 	}
 }
 
+static void lcd_write_fill16(uint16_t color, size_t count) {
+	if (count == 0) return;
+	lcd_dma_color = __builtin_bswap16(color);
+	lcd_dma_start(&lcd_dma_color, count << 1, true);
+}
+
 static inline void lcd_initcmd(const uint8_t *init_seq) {
 	const uint8_t *cmd = init_seq;
 	while (*cmd) {
@@ -82,6 +194,7 @@ static inline void lcd_initcmd(const uint8_t *init_seq) {
 }
 
 static void lcd_set_region(int x1, int y1, int x2, int y2) {
+	lcd_wait_dma();
 	lcd_set_dc_cs(0, 0);
 	const uint8_t cmd1[] = {0x2A, (x1 >> 8), (x1 & 0xFF), (x2 >> 8), (x2 & 0xFF)};
 	const uint8_t cmd2[] = {0x2B, (y1 >> 8), (y1 & 0xFF), (y2 >> 8), (y2 & 0xFF)};
@@ -91,6 +204,7 @@ static void lcd_set_region(int x1, int y1, int x2, int y2) {
 	lcd_write_cmd(&cmd, 1);
 	busy_wait_us(1);
 	lcd_set_dc_cs(1, 0);
+	lcd_dma_pending = true;
 }
 
 void lcd_blank() {
@@ -117,37 +231,41 @@ void lcd_off() {
 	lcd_write_cmd(&cmd, 1);
 }
 
-static inline void normalize_coords(int* x, int* y, int* width, int* height) {
-	if (*y < 0) { *height += *y; *y = 0; }
-	*y %= lcd_current_height;
-	*x = (*x < 0 ? 0 : (*x >= LCD_WIDTH ? LCD_WIDTH : *x));
-	*width = (*width < 0 ? 0 : (*x + *width >= LCD_WIDTH ? LCD_WIDTH - *x : *width));
-	*height = (*height < 0 ? 0 : (*y + *height >= lcd_current_height ? lcd_current_height - *y : *height));
+static inline void lcd_mark_dirty(int x, int y, int width, int height) {
+	if (width <= 0 || height <= 0) return;
+	for (int iy = y; iy < y + height; iy++) {
+		if (x < lcd_dirty_x1[iy]) lcd_dirty_x1[iy] = x;
+		if (x + width - 1 > lcd_dirty_x2[iy]) lcd_dirty_x2[iy] = x + width - 1;
+	}
 }
 
-static void lcd_direct_draw(u16* pixels, int x, int y, int width, int height) {
-	if (y < 0) { pixels -= y * width; height += y; y = 0; }
-	// TODO: clip negative X as well
-	normalize_coords(&x, &y, &width, &height);
-	lcd_set_region(x, y, x + width - 1, y + height - 1);
-
-	lcd_write16(pixels, width * height);
+static void lcd_mark_all_dirty() {
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		lcd_dirty_x1[y] = 0;
+		lcd_dirty_x2[y] = LCD_WIDTH - 1;
+	}
+}
 
-	st7789_lcd_wait_idle(LCD_PIO, lcd_sm);
-	lcd_set_dc_cs(0, 1);
+static void lcd_clear_dirty(int y1, int y2) {
+	for (int y = y1; y <= y2; y++) {
+		lcd_dirty_x1[y] = LCD_WIDTH;
+		lcd_dirty_x2[y] = -1;
+	}
 }
 
-static void lcd_direct_fill(u16 color, int x, int y, int width, int height) {
-	normalize_coords(&x, &y, &width, &height);
+static void lcd_direct_draw(u16* pixels, int x, int y, int width, int height, int stride) {
 	lcd_set_region(x, y, x + width - 1, y + height - 1);
-	
-	for (size_t i = 0; i < width * height; ++i) {
-		st7789_lcd_put(LCD_PIO, lcd_sm, color >> 8);
-		st7789_lcd_put(LCD_PIO, lcd_sm, color & 0xff);
+
+	if (stride == width) {
+		lcd_write16(pixels, width * height);
+	} else {
+		for (int j = 0; j < height; j++) lcd_write16(pixels + j * stride, width);
 	}
+}
 
-	st7789_lcd_wait_idle(LCD_PIO, lcd_sm);
-	lcd_set_dc_cs(0, 1);
+static void lcd_direct_fill(u16 color, int x, int y, int width, int height) {
+	lcd_set_region(x, y, x + width - 1, y + height - 1);
+	lcd_write_fill16(color, width * height);
 }
 
 static void lcd_direct_point(u16 color, int x, int y) {
@@ -158,55 +276,108 @@ static void lcd_direct_clear() {
 	lcd_direct_fill(0, 0, 0, LCD_WIDTH, MEM_HEIGHT);
 }
 
-static void lcd_psram_draw(u16* pixels, int x, int y, int width, int height) {
-	normalize_coords(&x, &y, &width, &height);
+// psram_write/psram_read can't go over 27/31 bytes per transaction, the PIO
+// program counts bits in 8 bits including the 32 bit command and address.
+// Rounded down to whole pixels
+#define LCD_PSRAM_WRITE_MAX 26
+#define LCD_PSRAM_READ_MAX 30
+
+static void lcd_psram_write_span(uint32_t addr, const u16* pixels, uint32_t count) {
+	uint32_t bytes = count << 1;
+	const uint8_t* src = (const uint8_t*)pixels;
+	while (bytes) {
+		uint32_t len = bytes < LCD_PSRAM_WRITE_MAX ? bytes : LCD_PSRAM_WRITE_MAX;
+		psram_write(&psram_spi, addr, src, len);
+		addr += len;
+		src += len;
+		bytes -= len;
+		lcd_stats.psram_transactions++;
+	}
+}
 
-	int remain;
-	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
-		remain = width;
-		for (uint32_t ix = x; ix < (x + width); ix+=10) {
-			psram_write(&psram_spi, (iy + ix)<<1, (uint8_t*)pixels, (remain < 10 ? remain<<1 : 20));
-			pixels += (remain < 10 ? remain : 10);
-			remain -= 10;
-		}
+static void lcd_psram_read_span(uint32_t addr, u16* pixels, uint32_t count) {
+	uint32_t bytes = count << 1;
+	uint8_t* dst = (uint8_t*)pixels;
+	while (bytes) {
+		uint32_t len = bytes < LCD_PSRAM_READ_MAX ? bytes : LCD_PSRAM_READ_MAX;
+		psram_read(&psram_spi, addr, dst, len);
+		addr += len;
+		dst += len;
+		bytes -= len;
+		lcd_stats.psram_transactions++;
+	}
+}
+
+static void lcd_psram_draw(u16* pixels, int x, int y, int width, int height, int stride) {
+	lcd_mark_dirty(x, y, width, height);
+
+	uint32_t addr = lcd_psram_back + ((x + y * LCD_WIDTH)<<1);
+	// full width rows are contiguous in PSRAM, send them as one span
+	if (width == LCD_WIDTH && stride == width) {
+		lcd_psram_write_span(addr, pixels, width * height);
+		return;
+	}
+	for (int iy = 0; iy < height; iy++) {
+		lcd_psram_write_span(addr, pixels, width);
+		addr += LCD_WIDTH<<1;
+		pixels += stride;
 	}
 }
 
 static void lcd_psram_fill(u16 color, int x, int y, int width, int height) {
-	normalize_coords(&x, &y, &width, &height);
+	lcd_mark_dirty(x, y, width, height);
 
-	int remain;
-	for (int i = 0; i < 10; i++) lcd_tmpbuf[i] = color;
-	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
-		remain = width;
-		for (uint32_t ix = x; ix < (x + width); ix+=10) {
-			psram_write(&psram_spi, (iy + ix)<<1, (uint8_t*)lcd_tmpbuf, (remain < 10 ? remain<<1 : 20));
-			remain -= 10;
+	for (int i = 0; i < LCD_PSRAM_WRITE_MAX / 2; i++) lcd_tmpbuf[i] = color;
+
+	uint32_t addr = lcd_psram_back + ((x + y * LCD_WIDTH)<<1);
+	uint32_t span = width;
+	if (width == LCD_WIDTH) {
+		span = width * height;
+		height = 1;
+	}
+	for (int iy = 0; iy < height; iy++) {
+		uint32_t a = addr;
+		uint32_t remain = span;
+		while (remain) {
+			uint32_t n = remain < LCD_PSRAM_WRITE_MAX / 2 ? remain : LCD_PSRAM_WRITE_MAX / 2;
+			psram_write(&psram_spi, a, (uint8_t*)lcd_tmpbuf, n<<1);
+			lcd_stats.psram_transactions++;
+			a += n<<1;
+			remain -= n;
 		}
+		addr += LCD_WIDTH<<1;
 	}
 }
 
 static void lcd_psram_point(u16 color, int x, int y) {
-	if (x >= 0 && y >= 0 && x < LCD_WIDTH && y < LCD_HEIGHT)
-		psram_write16(&psram_spi, (x + y * LCD_WIDTH)<<1, color);
+	if (x >= 0 && y >= 0 && x < LCD_WIDTH && y < LCD_HEIGHT) {
+		psram_write16(&psram_spi, lcd_psram_back + ((x + y * LCD_WIDTH)<<1), color);
+		lcd_stats.psram_transactions++;
+		lcd_mark_dirty(x, y, 1, 1);
+	}
+}
+
+static void lcd_psram_read(u16* pixels, int x, int y, int width) {
+	lcd_psram_read_span(lcd_psram_back + ((x + y * LCD_WIDTH)<<1), pixels, width);
 }
 
 static void lcd_psram_clear() {
 	lcd_psram_fill(0, 0, 0, LCD_WIDTH, LCD_HEIGHT);
 }
 
-static void lcd_ram_draw(u16* pixels, int x, int y, int width, int height) {
-	normalize_coords(&x, &y, &width, &height);
+static void lcd_ram_draw(u16* pixels, int x, int y, int width, int height, int stride) {
+	lcd_mark_dirty(x, y, width, height);
 
 	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
 		for (uint32_t ix = x; ix < (x + width); ix++) {
 			framebuffer[iy+ix] = lcd_to8[*pixels++];
 		}
+		pixels += stride - width;
 	}
 }
 
 static void lcd_ram_fill(u16 color, int x, int y, int width, int height) {
-	normalize_coords(&x, &y, &width, &height);
+	lcd_mark_dirty(x, y, width, height);
 
 	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
 		memset(framebuffer + x + iy, lcd_to8[color], width);
@@ -214,101 +385,515 @@ static void lcd_ram_fill(u16 color, int x, int y, int width, int height) {
 }
 
 static void lcd_ram_point(u16 color, int x, int y) {
-	if (x >= 0 && y >= 0 && x < LCD_WIDTH && y < LCD_HEIGHT)
+	if (x >= 0 && y >= 0 && x < LCD_WIDTH && y < LCD_HEIGHT) {
 		framebuffer[(x + y * LCD_WIDTH)] = lcd_to8[color];
+		lcd_mark_dirty(x, y, 1, 1);
+	}
+}
+
+static void lcd_ram_read(u16* pixels, int x, int y, int width) {
+	u8* src = framebuffer + x + y * LCD_WIDTH;
+	for (int i = 0; i < width; i++) pixels[i] = lcd_to16[src[i]];
 }
 
 static void lcd_ram_clear() {
 	memset(framebuffer, 0, LCD_WIDTH * LCD_HEIGHT);
+	lcd_mark_all_dirty();
 }
 
-void lcd_buffer_blit_local() {
-	if (framebuffer_mode == LCD_BUFFERMODE_DIRECT) return;
-	
-	lcd_set_region(0, 0, 319, 319);
+static void lcd_idx8_draw(u16* pixels, int x, int y, int width, int height, int stride) {
+	lcd_mark_dirty(x, y, width, height);
+
+	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
+		for (uint32_t ix = x; ix < (x + width); ix++) {
+			framebuffer[iy+ix] = (u8)*pixels++;
+		}
+		pixels += stride - width;
+	}
+}
+
+static void lcd_idx8_fill(u16 color, int x, int y, int width, int height) {
+	lcd_mark_dirty(x, y, width, height);
+
+	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
+		memset(framebuffer + x + iy, (u8)color, width);
+	}
+}
+
+static void lcd_idx8_point(u16 color, int x, int y) {
+	if (x >= 0 && y >= 0 && x < LCD_WIDTH && y < LCD_HEIGHT) {
+		framebuffer[(x + y * LCD_WIDTH)] = (u8)color;
+		lcd_mark_dirty(x, y, 1, 1);
+	}
+}
+
+// 4bpp keeps even pixels in the high nibble
+static inline void lcd_idx4_set(uint32_t i, u16 color) {
+	u8* p = framebuffer + (i >> 1);
+	if (i & 1) *p = (*p & 0xf0) | (color & 0x0f);
+	else *p = (*p & 0x0f) | ((color & 0x0f) << 4);
+}
+
+static void lcd_idx4_draw(u16* pixels, int x, int y, int width, int height, int stride) {
+	lcd_mark_dirty(x, y, width, height);
+
+	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
+		for (uint32_t ix = x; ix < (x + width); ix++) {
+			lcd_idx4_set(iy + ix, *pixels++);
+		}
+		pixels += stride - width;
+	}
+}
 
-	if (framebuffer_mode == LCD_BUFFERMODE_PSRAM) {
-		for (int y = 0; y < LCD_HEIGHT * LCD_WIDTH; y += LCD_TMPBUF_SIZE) {
-			for (int x = 0; x < LCD_TMPBUF_SIZE; x+=10) {
-				psram_read(&psram_spi, (x+y)<<1, (uint8_t*)(lcd_tmpbuf + x), 20);
+static void lcd_idx4_fill(u16 color, int x, int y, int width, int height) {
+	lcd_mark_dirty(x, y, width, height);
+
+	u8 pair = ((color & 0x0f) << 4) | (color & 0x0f);
+	for (uint32_t iy = y * LCD_WIDTH; iy < (y + height) * LCD_WIDTH; iy += LCD_WIDTH) {
+		uint32_t i = iy + x, end = iy + x + width;
+		if (i & 1) lcd_idx4_set(i++, color);
+		if (end & 1) lcd_idx4_set(--end, color);
+		if (end > i) memset(framebuffer + (i >> 1), pair, (end - i) >> 1);
+	}
+}
+
+static void lcd_idx4_point(u16 color, int x, int y) {
+	if (x >= 0 && y >= 0 && x < LCD_WIDTH && y < LCD_HEIGHT) {
+		lcd_idx4_set(x + y * LCD_WIDTH, color);
+		lcd_mark_dirty(x, y, 1, 1);
+	}
+}
+
+static void lcd_idx4_clear() {
+	memset(framebuffer, 0, LCD_WIDTH * LCD_HEIGHT / 2);
+	lcd_mark_all_dirty();
+}
+
+void lcd_set_palette_local(int start, int count, const u16* colors) {
+	if (start < 0) { count += start; colors -= start; start = 0; }
+	if (start + count > 256) count = 256 - start;
+	for (int i = 0; i < count; i++) {
+		lcd_palette[start + i] = __builtin_bswap16(colors[i]);
+	}
+	if (start < 16) {
+		for (int i = 0; i < 256; i++) {
+			// little endian, the even pixel goes out first
+			lcd_palette_pairs[i] = lcd_palette[i >> 4] | (lcd_palette[i & 15] << 16);
+		}
+	}
+	if (framebuffer_mode == LCD_BUFFERMODE_INDEXED8 || framebuffer_mode == LCD_BUFFERMODE_INDEXED4) {
+		lcd_mark_all_dirty();
+	}
+}
+
+static void lcd_blit_band(int x1, int y1, int x2, int y2) {
+	int width = x2 - x1 + 1;
+	uint16_t* line;
+
+	int screen_y = (y1 - lcd_buffer_scroll + LCD_HEIGHT) % LCD_HEIGHT;
+	lcd_set_region(x1, screen_y, x2, screen_y + y2 - y1);
+
+	for (int y = y1; y <= y2; y++) {
+		line = lcd_dma_line();
+		if (framebuffer_mode == LCD_BUFFERMODE_PSRAM) {
+			// reading the next line overlaps with DMA sending the previous one
+			lcd_psram_read_span(lcd_psram_back + ((x1 + y * LCD_WIDTH)<<1), line, width);
+			for (int x = 0; x < width; x++) line[x] = __builtin_bswap16(line[x]);
+		} else if (framebuffer_mode == LCD_BUFFERMODE_RAM) {
+			uint8_t* src = framebuffer + x1 + y * LCD_WIDTH;
+			for (int x = 0; x < width; x++) line[x] = __builtin_bswap16(lcd_to16[src[x]]);
+		} else if (framebuffer_mode == LCD_BUFFERMODE_INDEXED8) {
+			uint8_t* src = framebuffer + x1 + y * LCD_WIDTH;
+			for (int x = 0; x < width; x++) line[x] = lcd_palette[src[x]];
+		} else if (framebuffer_mode == LCD_BUFFERMODE_INDEXED4) {
+			uint32_t i = x1 + y * LCD_WIDTH;
+			int x = 0;
+			if (i & 1) line[x++] = lcd_palette[framebuffer[i >> 1] & 15];
+			uint8_t* src = framebuffer + ((i + x) >> 1);
+			for (; x + 1 < width; x += 2) {
+				uint32_t pair = lcd_palette_pairs[*src++];
+				line[x] = pair;
+				line[x + 1] = pair >> 16;
 			}
-			lcd_write16(lcd_tmpbuf, LCD_TMPBUF_SIZE);
+			if (x < width) line[x] = lcd_palette[*src >> 4];
 		}
-	} else if (framebuffer_mode == LCD_BUFFERMODE_RAM) {
-		uint16_t color;
-		for (size_t count = 0; count < LCD_WIDTH * LCD_HEIGHT; count++) {
-			color = lcd_to16[framebuffer[count]];
-			st7789_lcd_put(LCD_PIO, lcd_sm, color >> 8);
-			st7789_lcd_put(LCD_PIO, lcd_sm, color & 0xff);
+		lcd_dma_send_line(width);
+	}
+
+	lcd_stats.blit_regions++;
+	lcd_stats.blit_bytes += width * (y2 - y1 + 1) * 2;
+}
+
+static void lcd_present_fetch(uint16_t* line, int y) {
+	y = (y + lcd_present_scroll) % LCD_HEIGHT;
+	lcd_psram_read_span(lcd_psram_front + y * LCD_WIDTH * 2, line, LCD_WIDTH);
+	for (int x = 0; x < LCD_WIDTH; x++) line[x] = __builtin_bswap16(line[x]);
+}
+
+// runs when a line has been clocked out: queues the line fetched in the
+// meantime, then fetches the next one into the buffer that just freed up
+static void lcd_present_irq() {
+	if (!dma_channel_get_irq1_status(lcd_dma_chan)) return;
+	dma_channel_acknowledge_irq1(lcd_dma_chan);
+
+	if (lcd_present_line < LCD_HEIGHT) {
+		lcd_dma_start(lcd_dma_buf[lcd_dma_select], LCD_WIDTH << 1, false);
+		lcd_dma_select ^= 1;
+		if (++lcd_present_line < LCD_HEIGHT) lcd_present_fetch(lcd_dma_line(), lcd_present_line);
+	} else {
+		dma_channel_set_irq1_enabled(lcd_dma_chan, false);
+		lcd_stats.present_us = lcd_clock_us() - lcd_present_started;
+		lcd_present_active = false;
+	}
+}
+
+// swaps the buffers and starts sending the new front buffer in the
+// background, only blocking if the previous present hasn't finished yet
+static void lcd_present() {
+	uint64_t start = lcd_clock_us();
+	lcd_wait_dma();
+	lcd_stats.present_stall_us = lcd_clock_us() - start;
+	if (lcd_stats.present_stall_us > 0) lcd_stats.present_stalls++;
+	lcd_stats.frames++;
+
+	lcd_psram_front = lcd_psram_back;
+	lcd_psram_back = LCD_FRAME_BYTES - lcd_psram_back;
+
+	lcd_set_region(0, 0, LCD_WIDTH - 1, LCD_HEIGHT - 1);
+	lcd_present_scroll = lcd_buffer_scroll;
+
+	// both line buffers are filled up front so the IRQ can never get ahead
+	lcd_present_fetch(lcd_dma_buf[0], 0);
+	lcd_present_fetch(lcd_dma_buf[1], 1);
+	lcd_dma_select = 1;
+	lcd_present_line = 1;
+	lcd_present_started = lcd_clock_us();
+	lcd_present_active = true;
+	dma_channel_acknowledge_irq1(lcd_dma_chan);
+	dma_channel_set_irq1_enabled(lcd_dma_chan, true);
+	lcd_dma_start(lcd_dma_buf[0], LCD_WIDTH << 1, false);
+}
+
+void lcd_buffer_blit_local() {
+	if (framebuffer_mode == LCD_BUFFERMODE_DIRECT) return;
+	uint64_t start = lcd_clock_us();
+	if (framebuffer_mode == LCD_BUFFERMODE_DOUBLE) {
+		lcd_present();
+		lcd_stats.blit_us = lcd_clock_us() - start;
+		return;
+	}
+	if (!lcd_dirty_tracking) lcd_mark_all_dirty();
+
+	lcd_stats.blit_bytes = 0;
+	lcd_stats.blit_regions = 0;
+
+	int y = 0;
+	while (y < LCD_HEIGHT) {
+		if (lcd_dirty_x2[y] < 0) { y++; continue; }
+
+		// grow the band downwards while the union of spans stays tight
+		int x1 = lcd_dirty_x1[y], x2 = lcd_dirty_x2[y], y2 = y;
+		int covered = x2 - x1 + 1;
+		// rows are in framebuffer order, a band can't wrap around the screen edge
+		while (y2 + 1 < LCD_HEIGHT && y2 + 1 != lcd_buffer_scroll && lcd_dirty_x2[y2 + 1] >= 0) {
+			int nx1 = lcd_dirty_x1[y2 + 1] < x1 ? lcd_dirty_x1[y2 + 1] : x1;
+			int nx2 = lcd_dirty_x2[y2 + 1] > x2 ? lcd_dirty_x2[y2 + 1] : x2;
+			int ncovered = covered + lcd_dirty_x2[y2 + 1] - lcd_dirty_x1[y2 + 1] + 1;
+			if ((nx2 - nx1 + 1) * (y2 - y + 2) - ncovered > LCD_BAND_SLACK) break;
+			x1 = nx1; x2 = nx2; covered = ncovered;
+			y2++;
 		}
+
+		lcd_blit_band(x1, y, x2, y2);
+		lcd_clear_dirty(y, y2);
+		y = y2 + 1;
 	}
 
-	st7789_lcd_wait_idle(LCD_PIO, lcd_sm);
-	lcd_set_dc_cs(0, 1);
+	lcd_stats.blit_saved = LCD_WIDTH * LCD_HEIGHT * 2 - lcd_stats.blit_bytes;
+	lcd_stats.blit_us = lcd_clock_us() - start;
+}
+
+// RGB565 with green moved to the top half, so one multiply scales all
+// three channels with room for the carries
+static inline u16 lcd_blend_alpha_px(u16 src, u16 dst, uint32_t alpha) {
+	uint32_t s = (src | (src << 16)) & 0x07e0f81f;
+	uint32_t d = (dst | (dst << 16)) & 0x07e0f81f;
+	d = (d + (((s - d) * alpha) >> 5)) & 0x07e0f81f;
+	return d | (d >> 16);
+}
+
+// saturating add of two RGB565 pixels per word: the top bit of each
+// channel is added separately so carries never cross channels, then
+// overflowing channels are filled with ones
+static inline uint32_t lcd_blend_add_x2(uint32_t s, uint32_t d) {
+	const uint32_t top = 0x84108410;
+	uint32_t sum = (s & ~top) + (d & ~top);
+	uint32_t over = ((s & d) | ((s | d) & sum)) & top;
+	sum ^= (s ^ d) & top;
+	uint32_t rb = over & 0x80108010, g = over & 0x04000400;
+	return sum | ((rb << 1) - (rb >> 4)) | ((g << 1) - (g >> 5));
+}
+
+static inline u16 lcd_blend_multiply_px(u16 src, u16 dst) {
+	uint32_t r = ((src >> 11) + 1) * (dst >> 11) >> 5;
+	uint32_t g = (((src >> 5) & 0x3f) + 1) * ((dst >> 5) & 0x3f) >> 6;
+	uint32_t b = ((src & 0x1f) + 1) * (dst & 0x1f) >> 5;
+	return (r << 11) | (g << 5) | b;
+}
+
+// blends src, or color when src is NULL, into dst
+static void lcd_blend_span(u16* dst, const u16* src, u16 color, int count) {
+	int i = 0;
+	switch (lcd_blend_mode) {
+		case LCD_BLEND_ALPHA:
+			for (; i < count; i++) dst[i] = lcd_blend_alpha_px(src ? src[i] : color, dst[i], lcd_blend_alpha);
+			break;
+
+		case LCD_BLEND_ADD:
+			for (; i + 1 < count; i += 2) {
+				uint32_t s = src ? src[i] | (src[i + 1] << 16) : color * 0x10001u;
+				uint32_t d = lcd_blend_add_x2(s, dst[i] | (dst[i + 1] << 16));
+				dst[i] = d;
+				dst[i + 1] = d >> 16;
+			}
+			if (i < count) dst[i] = lcd_blend_add_x2(src ? src[i] : color, dst[i]);
+			break;
+
+		case LCD_BLEND_MULTIPLY:
+			for (; i < count; i++) dst[i] = lcd_blend_multiply_px(src ? src[i] : color, dst[i]);
+			break;
+	}
+}
+
+// read, blend and write back one row at a time, rects are already clipped
+static void lcd_blend_rect(const u16* pixels, u16 color, int x, int y, int width, int height, int stride) {
+	for (int j = 0; j < height; j++) {
+		lcd_read_ptr(lcd_blend_buf, x, y + j, width);
+		lcd_blend_span(lcd_blend_buf, pixels ? pixels + j * stride : NULL, color, width);
+		lcd_draw_ptr(lcd_blend_buf, x, y + j, width, 1, width);
+	}
+}
+
+static inline bool lcd_blending() {
+	return lcd_blend_mode != LCD_BLEND_NONE && lcd_read_ptr;
+}
+
+void lcd_set_blend_local(u8 mode, u8 alpha) {
+	lcd_blend_mode = mode;
+	lcd_blend_alpha = (alpha + 4) >> 3;
+}
+
+// translates a rect by the origin and clips it, returns false if nothing is left.
+// skip_x/skip_y are how many columns/rows were cut off the top left
+static inline bool lcd_clip_rect(int* x, int* y, int* width, int* height, int* skip_x, int* skip_y) {
+	int x1 = *x + lcd_clip.ox, y1 = *y + lcd_clip.oy;
+	int x2 = x1 + *width, y2 = y1 + *height;
+	int cy2 = lcd_clip.y2 < lcd_current_height ? lcd_clip.y2 : lcd_current_height;
+
+	*skip_x = x1 < lcd_clip.x1 ? lcd_clip.x1 - x1 : 0;
+	*skip_y = y1 < lcd_clip.y1 ? lcd_clip.y1 - y1 : 0;
+	x1 += *skip_x;
+	y1 += *skip_y;
+	if (x2 > lcd_clip.x2) x2 = lcd_clip.x2;
+	if (y2 > cy2) y2 = cy2;
+	if (x2 <= x1 || y2 <= y1) return false;
+
+	*x = x1;
+	*y = y1;
+	*width = x2 - x1;
+	*height = y2 - y1;
+	return true;
+}
+
+void lcd_clip_bounds(int* x1, int* y1, int* x2, int* y2) {
+	int cy2 = lcd_clip.y2 < lcd_current_height ? lcd_clip.y2 : lcd_current_height;
+	*x1 = lcd_clip.x1 - lcd_clip.ox;
+	*y1 = lcd_clip.y1 - lcd_clip.oy;
+	*x2 = lcd_clip.x2 - lcd_clip.ox;
+	*y2 = cy2 - lcd_clip.oy;
+}
+
+bool lcd_move_local(int x, int y, int width, int height, int dx, int dy) {
+	int skip_x, skip_y;
+	// the back buffer of LCD_BUFFERMODE_DOUBLE holds an older frame
+	if (!lcd_read_ptr || framebuffer_mode == LCD_BUFFERMODE_DOUBLE) return false;
+	if (!lcd_clip_rect(&x, &y, &width, &height, &skip_x, &skip_y)) return true;
+
+	// the part of the rect that pixels from inside it land on
+	int x1 = dx > 0 ? x + dx : x, x2 = dx > 0 ? x + width : x + width + dx;
+	int y1 = dy > 0 ? y + dy : y, y2 = dy > 0 ? y + height : y + height + dy;
+	if (x2 <= x1 || y2 <= y1) return true;
+
+	// rows are copied away from the side they move to so none is read after
+	// being written, a whole row is read before any of it is written
+	for (int j = 0; j < y2 - y1; j++) {
+		int row = dy > 0 ? y2 - 1 - j : y1 + j;
+		lcd_read_ptr(lcd_blend_buf, x1 - dx, row - dy, x2 - x1);
+		lcd_draw_ptr(lcd_blend_buf, x1, row, x2 - x1, 1, x2 - x1);
+	}
+	return true;
 }
 
 void lcd_draw_local(u16* pixels, int x, int y, int width, int height) {
-	lcd_draw_ptr(pixels, x, y, width, height);
+	int stride = width, skip_x, skip_y;
+	if (!lcd_clip_rect(&x, &y, &width, &height, &skip_x, &skip_y)) return;
+	if (lcd_blending()) lcd_blend_rect(pixels + skip_x + skip_y * stride, 0, x, y, width, height, stride);
+	else lcd_draw_ptr(pixels + skip_x + skip_y * stride, x, y, width, height, stride);
 }
 
 void lcd_fill_local(u16 color, int x, int y, int width, int height) {
-	lcd_fill_ptr(color, x, y, width, height);
+	int skip_x, skip_y;
+	if (!lcd_clip_rect(&x, &y, &width, &height, &skip_x, &skip_y)) return;
+	if (lcd_blending()) lcd_blend_rect(NULL, color, x, y, width, height, 0);
+	else lcd_fill_ptr(color, x, y, width, height);
 }
 
 void lcd_point_local(u16 color, int x, int y) {
-	lcd_point_ptr(color, x, y);
+	x += lcd_clip.ox;
+	y += lcd_clip.oy;
+	if (x < lcd_clip.x1 || y < lcd_clip.y1 || x >= lcd_clip.x2 || y >= lcd_clip.y2 || y >= lcd_current_height) return;
+	if (lcd_blending()) lcd_blend_rect(NULL, color, x, y, 1, 1, 0);
+	else lcd_point_ptr(color, x, y);
+}
+
+void lcd_set_clip_local(int x, int y, int width, int height) {
+	if (width < 0 || height < 0) {
+		lcd_clip.x1 = 0;
+		lcd_clip.y1 = 0;
+		lcd_clip.x2 = LCD_WIDTH;
+		lcd_clip.y2 = MEM_HEIGHT;
+		return;
+	}
+	x += lcd_clip.ox;
+	y += lcd_clip.oy;
+	lcd_clip.x1 = x < 0 ? 0 : (x > LCD_WIDTH ? LCD_WIDTH : x);
+	lcd_clip.y1 = y < 0 ? 0 : (y > MEM_HEIGHT ? MEM_HEIGHT : y);
+	lcd_clip.x2 = x + width > LCD_WIDTH ? LCD_WIDTH : (x + width < lcd_clip.x1 ? lcd_clip.x1 : x + width);
+	lcd_clip.y2 = y + height > MEM_HEIGHT ? MEM_HEIGHT : (y + height < lcd_clip.y1 ? lcd_clip.y1 : y + height);
+}
+
+void lcd_set_origin_local(int x, int y) {
+	lcd_clip.ox = x;
+	lcd_clip.oy = y;
+}
+
+void lcd_get_origin(int* x, int* y) {
+	*x = lcd_clip.ox;
+	*y = lcd_clip.oy;
+}
+
+// pushes past LCD_CLIP_DEPTH only count, so pops stay balanced but leave
+// the clip as it is until the stack is back within its depth
+void lcd_push_clip_local() {
+	if (lcd_clip_depth < LCD_CLIP_DEPTH) lcd_clip_stack[lcd_clip_depth] = lcd_clip;
+	lcd_clip_depth++;
+}
+
+void lcd_pop_clip_local() {
+	if (lcd_clip_depth == 0) return;
+	lcd_clip_depth--;
+	if (lcd_clip_depth < LCD_CLIP_DEPTH) lcd_clip = lcd_clip_stack[lcd_clip_depth];
+}
+
+void lcd_reset_clip_local() {
+	lcd_clip_depth = 0;
+	lcd_set_origin_local(0, 0);
+	lcd_set_clip_local(0, 0, -1, -1);
 }
 
 void lcd_clear_local() {
 	lcd_clear_ptr();
 }
 
-bool lcd_buffer_enable_local(int mode) {
-	if (mode != LCD_BUFFERMODE_RAM) {
-		if (framebuffer) {
-			free(framebuffer);
-			framebuffer = NULL;
-		}
+static void lcd_hw_scroll(int lines) {
+	lines %= MEM_HEIGHT;
+	uint8_t cmd[] = {0x37, (lines >> 8), (lines & 0xFF)};
+	lcd_write_cmd(cmd, 3);
+}
+
+static size_t lcd_framebuffer_size(int mode) {
+	if (mode == LCD_BUFFERMODE_RAM || mode == LCD_BUFFERMODE_INDEXED8) return LCD_WIDTH * LCD_HEIGHT;
+	if (mode == LCD_BUFFERMODE_INDEXED4) return LCD_WIDTH * LCD_HEIGHT / 2;
+	return 0;
+}
+
+bool lcd_buffer_enable_local(int mode, bool dirty) {
+	if (mode < LCD_BUFFERMODE_DIRECT || mode > LCD_BUFFERMODE_INDEXED4) return false;
+
+	// get the new buffer before touching anything, a failed switch leaves
+	// the current mode as it was
+	size_t size = lcd_framebuffer_size(mode);
+	uint8_t* buffer = NULL;
+	if (size) {
+		buffer = framebuffer && size == lcd_framebuffer_size(framebuffer_mode) ? framebuffer : malloc(size);
+		if (!buffer) return false;
 	}
 
+	lcd_wait_dma();
+	if (framebuffer != buffer) free(framebuffer);
+	framebuffer = buffer;
+	lcd_dirty_tracking = dirty;
+	lcd_mark_all_dirty();
+	lcd_psram_back = 0;
+	lcd_psram_front = 0;
+	lcd_buffer_scroll = 0;
+	framebuffer_mode = mode;
+
 	if (mode == LCD_BUFFERMODE_DIRECT) {
 		lcd_draw_ptr = &lcd_direct_draw;
 		lcd_fill_ptr = &lcd_direct_fill;
 		lcd_point_ptr = &lcd_direct_point;
 		lcd_clear_ptr = &lcd_direct_clear;
-		framebuffer_mode = mode;
+		lcd_read_ptr = NULL;
 		lcd_current_height = MEM_HEIGHT;
 		return true;
-	} else if (mode == LCD_BUFFERMODE_PSRAM) {
+	}
+
+	if (mode == LCD_BUFFERMODE_PSRAM || mode == LCD_BUFFERMODE_DOUBLE) {
 		lcd_draw_ptr = &lcd_psram_draw;
 		lcd_fill_ptr = &lcd_psram_fill;
 		lcd_point_ptr = &lcd_psram_point;
 		lcd_clear_ptr = &lcd_psram_clear;
-		framebuffer_mode = mode;
-		lcd_current_height = LCD_HEIGHT;
-		return true;
+		lcd_read_ptr = &lcd_psram_read;
+		if (mode == LCD_BUFFERMODE_DOUBLE) lcd_psram_back = LCD_FRAME_BYTES;
 	} else if (mode == LCD_BUFFERMODE_RAM) {
-		if (!framebuffer) {
-			framebuffer = malloc(LCD_WIDTH * LCD_HEIGHT);
-			if (framebuffer) {
-				lcd_draw_ptr = &lcd_ram_draw;
-				lcd_fill_ptr = &lcd_ram_fill;
-				lcd_point_ptr = &lcd_ram_point;
-				lcd_clear_ptr = &lcd_ram_clear;
-				framebuffer_mode = mode;
-				lcd_current_height = LCD_HEIGHT;
-				return true;
-			}
-		}
+		lcd_draw_ptr = &lcd_ram_draw;
+		lcd_fill_ptr = &lcd_ram_fill;
+		lcd_point_ptr = &lcd_ram_point;
+		lcd_clear_ptr = &lcd_ram_clear;
+		lcd_read_ptr = &lcd_ram_read;
+	} else if (mode == LCD_BUFFERMODE_INDEXED8) {
+		lcd_draw_ptr = &lcd_idx8_draw;
+		lcd_fill_ptr = &lcd_idx8_fill;
+		lcd_point_ptr = &lcd_idx8_point;
+		lcd_clear_ptr = &lcd_ram_clear;
+		lcd_read_ptr = NULL;
+	} else {
+		lcd_draw_ptr = &lcd_idx4_draw;
+		lcd_fill_ptr = &lcd_idx4_fill;
+		lcd_point_ptr = &lcd_idx4_point;
+		lcd_clear_ptr = &lcd_idx4_clear;
+		lcd_read_ptr = NULL;
 	}
-
-	return false;
+	lcd_hw_scroll(0);
+	lcd_current_height = LCD_HEIGHT;
+	return true;
 }
 
 void lcd_scroll_local(int lines) {
-	lines %= MEM_HEIGHT;
-	uint8_t cmd[] = {0x37, (lines >> 8), (lines & 0xFF)};
-	lcd_write_cmd(cmd, 3);
+	if (framebuffer_mode == LCD_BUFFERMODE_DIRECT) {
+		lcd_hw_scroll(lines);
+		return;
+	}
+
+	// the framebuffer is a ring of rows like the panel memory, so nothing
+	// needs to be copied, the next blit just starts from a different row
+	lines %= LCD_HEIGHT;
+	if (lines < 0) lines += LCD_HEIGHT;
+	if (lines != lcd_buffer_scroll) {
+		lcd_buffer_scroll = lines;
+		lcd_mark_all_dirty();
+	}
 }
 
 void lcd_setup_scrolling(int top_fixed_lines, int bottom_fixed_lines) {
@@ -325,12 +910,14 @@ font_t font = {
 	.glyphs = NULL,
 	.glyph_width = 0,
 	.glyph_height = 0,
-	.glyph_colorbuf = NULL
+	.glyph_colorbuf = NULL,
+	.text_buf = NULL
 };
 
 int lcd_load_font(const char* filename) {
 	if (font.glyphs) { free(font.glyphs); font.glyphs = NULL; }
 	if (font.glyph_colorbuf) { free(font.glyph_colorbuf); font.glyph_colorbuf = NULL; }
+	if (font.text_buf) { free(font.text_buf); font.text_buf = NULL; }
 	if (font.font_file) { free(font.font_file); font.font_file = NULL; }
 
 	if (!filename || filename[0] == '\0') {
@@ -368,35 +955,77 @@ int lcd_load_font(const char* filename) {
 
 	font.bytewidth = font.glyph_width/8 + (font.glyph_width % 8 != 0);
 	font.glyph_colorbuf = malloc(font.glyph_height * font.glyph_width * sizeof(u16));
+	// a run can be partially visible on both ends
+	font.text_buf = malloc((LCD_WIDTH / font.glyph_width + 2) * font.glyph_width * font.glyph_height * sizeof(u16));
 	font.term_width = LCD_WIDTH / font.glyph_width;
 	font.term_height = LCD_HEIGHT / font.glyph_height;
 	return FR_OK;
 }
 
-void lcd_draw_char_local(int x, int y, u16 fg, u16 bg, char c) {
+// 4 pixels for every possible nibble of glyph bits, rebuilt when the colors change
+static u16 lcd_glyph_lut[16][4];
+static u16 lcd_glyph_fg, lcd_glyph_bg;
+static bool lcd_glyph_lut_valid = false;
+
+static void lcd_glyph_lut_update(u16 fg, u16 bg) {
+	if (lcd_glyph_lut_valid && fg == lcd_glyph_fg && bg == lcd_glyph_bg) return;
+	for (int n = 0; n < 16; n++) {
+		for (int i = 0; i < 4; i++) {
+			lcd_glyph_lut[n][i] = (n & (8 >> i)) ? fg : bg;
+		}
+	}
+	lcd_glyph_fg = fg;
+	lcd_glyph_bg = bg;
+	lcd_glyph_lut_valid = true;
+}
+
+// expands a glyph into a buffer that is stride pixels wide, a nibble at a time
+static void lcd_expand_glyph(u16* out, int stride, char c) {
 	if (c > font.glyph_count + font.firstcode) c = 0;
-	int offset = ((u8)(c - font.firstcode)) * font.bytewidth * font.glyph_height;
+	const u8* bits = font.glyphs + ((u8)(c - font.firstcode)) * font.bytewidth * font.glyph_height;
 	for (int j = 0; j < font.glyph_height; j++) {
-		for (int i = 0; i < font.glyph_width; i++) {
-			int mask = (1 << (7 - i%8));
-			font.glyph_colorbuf[i + j * font.glyph_width] = (font.glyphs[offset + i / 8] & mask) ? fg : bg;
+		u16* row = out;
+		int remain = font.glyph_width;
+		for (int b = 0; b < font.bytewidth; b++) {
+			for (int shift = 4; shift >= 0 && remain > 0; shift -= 4) {
+				int n = remain < 4 ? remain : 4;
+				memcpy(row, lcd_glyph_lut[(bits[b] >> shift) & 15], n * sizeof(u16));
+				row += n;
+				remain -= n;
+			}
 		}
-		offset+=font.bytewidth;
+		bits += font.bytewidth;
+		out += stride;
 	}
+}
 
+void lcd_draw_char_local(int x, int y, u16 fg, u16 bg, char c) {
+	lcd_glyph_lut_update(fg, bg);
+	lcd_expand_glyph(font.glyph_colorbuf, font.glyph_width, c);
 	lcd_draw(font.glyph_colorbuf, x, y, font.glyph_width, font.glyph_height);
 }
 
+// builds the scanlines of the whole visible run and sends them as one region
 void lcd_draw_text_local(int x, int y, u16 fg, u16 bg, const char* text, size_t len, u8 align) {
-	//if (y <= -font.glyph_height || y >= HEIGHT) return;
 	if (align == LCD_ALIGN_CENTER) x -= len * font.glyph_width / 2;
 	else if (align == LCD_ALIGN_RIGHT) x -= len * font.glyph_width;
-	for (int i = 0; i < len; i++) {
-		lcd_draw_char(x, y, fg, bg, *text);
-		x += font.glyph_width;
-		if (x > LCD_WIDTH) return;
-		text ++;
+
+	// drop glyphs that are entirely clipped, lcd_draw clips the rest
+	int cx1, cy1, cx2, cy2;
+	lcd_clip_bounds(&cx1, &cy1, &cx2, &cy2);
+	if (y >= cy2 || y + font.glyph_height <= cy1) return;
+	int first = x < cx1 ? (cx1 - x) / font.glyph_width : 0;
+	int last = (cx2 - x + font.glyph_width - 1) / font.glyph_width;
+	if (last > (int)len) last = len;
+	if (first >= last) return;
+
+	int count = last - first;
+	int stride = count * font.glyph_width;
+	lcd_glyph_lut_update(fg, bg);
+	for (int i = 0; i < count; i++) {
+		lcd_expand_glyph(font.text_buf + i * font.glyph_width, stride, text[first + i]);
 	}
+	lcd_draw(font.text_buf, x + first * font.glyph_width, y, stride, font.glyph_height);
 }
 
 void lcd_printf(int x, int y, u16 fg, u16 bg, const char* format, ...) {
@@ -451,6 +1080,7 @@ void lcd_reset_pio() {
 	if (cpu_khz > 200000) {
 		clkdiv = 1.5f;
 	}
+	lcd_wait_dma();
 	st7789_lcd_program_init(LCD_PIO, lcd_sm, lcd_offset, LCD_TX, LCD_SCK, clkdiv);
 	psram_spi = psram_spi_init_clkdiv(pio0, 0, clkdiv, true);
 }
@@ -473,6 +1103,12 @@ void lcd_init() {
 
 	// Init PIO
 	lcd_offset = pio_add_program(LCD_PIO, &st7789_lcd_program);
+	lcd_dma_chan = dma_claim_unused_channel(true);
+	// DMA_IRQ_1 is shared with sound, it must be able to preempt the FIFO IRQ
+	// as that one waits for presents to finish
+	irq_add_shared_handler(DMA_IRQ_1, lcd_present_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+	irq_set_priority(DMA_IRQ_1, PICO_DEFAULT_IRQ_PRIORITY - 10);
+	irq_set_enabled(DMA_IRQ_1, true);
 	lcd_reset_pio();
 
 	lcd_set_dc_cs(0, 1);
@@ -488,7 +1124,9 @@ void lcd_init() {
 	lcd_initcmd(st7789_init_seq);
 	lcd_set_dc_cs(0, 1);
 
-	lcd_buffer_enable(0);
+	// indexed modes start out with the RGB332 colors of the RAM framebuffer
+	lcd_set_palette_local(0, 256, lcd_to16);
+	lcd_buffer_enable(0, false);
 
 	lcd_load_font(NULL);
 
@@ -502,27 +1140,27 @@ int lcd_fifo_receiver(uint32_t message) {
 
 	switch (message) {
 		case FIFO_LCD_POINT:
-			fg = multicore_fifo_pop_blocking_inline();
-			x = multicore_fifo_pop_blocking_inline();
-			y = multicore_fifo_pop_blocking_inline();
+			fg = multicore_cmd_pop();
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
 			lcd_point_local((u16)fg, (int)x, (int)y);
 			return 1;
 
 		case FIFO_LCD_DRAW:
-			fg = multicore_fifo_pop_blocking_inline();
-			x = multicore_fifo_pop_blocking_inline();
-			y = multicore_fifo_pop_blocking_inline();
-			width = multicore_fifo_pop_blocking_inline();
-			height = multicore_fifo_pop_blocking_inline();
+			fg = multicore_cmd_pop();
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			width = multicore_cmd_pop();
+			height = multicore_cmd_pop();
 			lcd_draw_local((u16*)fg, (int)x, (int)y, (int)width, (int)height);
 			return 1;
 
 		case FIFO_LCD_FILL:
-			fg = multicore_fifo_pop_blocking_inline();
-			x = multicore_fifo_pop_blocking_inline();
-			y = multicore_fifo_pop_blocking_inline();
-			width = multicore_fifo_pop_blocking_inline();
-			height = multicore_fifo_pop_blocking_inline();
+			fg = multicore_cmd_pop();
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			width = multicore_cmd_pop();
+			height = multicore_cmd_pop();
 			lcd_fill_local((u16)fg, (int)x, (int)y, (int)width, (int)height);
 			return 1;
 
@@ -531,36 +1169,82 @@ int lcd_fifo_receiver(uint32_t message) {
 			return 1;
 
 		case FIFO_LCD_BUFEN:
-			x = multicore_fifo_pop_blocking_inline();
-			multicore_fifo_push_blocking_inline((uint32_t)lcd_buffer_enable_local((int)x));
+			x = multicore_cmd_pop();
+			c = multicore_cmd_pop();
+			multicore_fifo_push_blocking_inline((uint32_t)lcd_buffer_enable_local((int)x, (bool)c));
 			return 1;
 
 		case FIFO_LCD_BUFBLIT:
 			lcd_buffer_blit_local();
 			return 1;
 
+		case FIFO_LCD_FENCE:
+			x = multicore_cmd_pop();
+			__dmb();
+			multicore_fence_done = x;
+			return 1;
+
+		case FIFO_LCD_CLIP:
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			width = multicore_cmd_pop();
+			height = multicore_cmd_pop();
+			lcd_set_clip_local((int)x, (int)y, (int)width, (int)height);
+			return 1;
+
+		case FIFO_LCD_ORIGIN:
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			lcd_set_origin_local((int)x, (int)y);
+			return 1;
+
+		case FIFO_LCD_PUSHCLIP:
+			lcd_push_clip_local();
+			return 1;
+
+		case FIFO_LCD_POPCLIP:
+			lcd_pop_clip_local();
+			return 1;
+
+		case FIFO_LCD_RESETCLIP:
+			lcd_reset_clip_local();
+			return 1;
+
+		case FIFO_LCD_BLEND:
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			lcd_set_blend_local((u8)x, (u8)y);
+			return 1;
+
+		case FIFO_LCD_PALETTE:
+			x = multicore_cmd_pop();
+			width = multicore_cmd_pop();
+			for (int i = 0; i < width; i++) lcd_tmpbuf[i] = (u16)multicore_cmd_pop();
+			lcd_set_palette_local((int)x, (int)width, lcd_tmpbuf);
+			return 1;
+
 		case FIFO_LCD_CHAR:
-			x = multicore_fifo_pop_blocking_inline();
-			y = multicore_fifo_pop_blocking_inline();
-			fg = multicore_fifo_pop_blocking_inline();
-			bg = multicore_fifo_pop_blocking_inline();
-			c = multicore_fifo_pop_blocking_inline();
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			fg = multicore_cmd_pop();
+			bg = multicore_cmd_pop();
+			c = multicore_cmd_pop();
 			lcd_draw_char_local((int)x, (int)y, (u16)fg, (u16)bg, (char)c);
 			return 1;
 
 		case FIFO_LCD_TEXT:
-			x = multicore_fifo_pop_blocking_inline();
-			y = multicore_fifo_pop_blocking_inline();
-			fg = multicore_fifo_pop_blocking_inline();
-			bg = multicore_fifo_pop_blocking_inline();
-			c = multicore_fifo_pop_blocking_inline();
+			x = multicore_cmd_pop();
+			y = multicore_cmd_pop();
+			fg = multicore_cmd_pop();
+			bg = multicore_cmd_pop();
+			c = multicore_cmd_pop();
 			width = multicore_fifo_pop_string(&text);
 			lcd_draw_text_local((int)x, (int)y, (u16)fg, (u16)bg, text, width, (u8)c);
-			free(text);
+			multicore_cmd_free(text);
 			return 1;
 
 		case FIFO_LCD_SCROLL:
-			height = multicore_fifo_pop_blocking_inline();
+			height = multicore_cmd_pop();
 			lcd_scroll_local((int)height);
 			return 1;
 
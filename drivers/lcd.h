@@ -12,6 +12,14 @@
 #define LCD_BUFFERMODE_DIRECT 0
 #define LCD_BUFFERMODE_PSRAM  1
 #define LCD_BUFFERMODE_RAM    2
+#define LCD_BUFFERMODE_DOUBLE 3
+#define LCD_BUFFERMODE_INDEXED8 4
+#define LCD_BUFFERMODE_INDEXED4 5
+
+#define LCD_BLEND_NONE     0
+#define LCD_BLEND_ALPHA    1
+#define LCD_BLEND_ADD      2
+#define LCD_BLEND_MULTIPLY 3
 
 #define LCD_ALIGN_LEFT   0
 #define LCD_ALIGN_CENTER 1
@@ -25,14 +33,44 @@
 
 extern int lcd_current_height;
 
+typedef struct {
+	uint32_t blit_bytes;   // pixel bytes sent by the last blit
+	uint32_t blit_saved;   // pixel bytes skipped by the last blit as they weren't dirty
+	uint32_t blit_regions; // regions the last blit was split into
+	uint32_t blit_us;      // time the last blit took
+	uint32_t frames;       // presents since boot in double buffered mode
+	uint32_t present_us;   // time the last present took to reach the screen
+	uint32_t present_stall_us; // time the last blit waited on the previous present
+	uint32_t present_stalls;   // presents that had to wait on the previous one
+	uint32_t psram_transactions; // PSRAM commands issued since boot
+} lcd_stats_t;
+
+extern lcd_stats_t lcd_stats;
+// microsecond clock the stats are timed with, host tests can swap in their own
+extern uint64_t (*lcd_clock_us)(void);
+
 int lcd_fifo_receiver(uint32_t message);
 
 void lcd_point_local(u16 color, int x, int y);
 void lcd_draw_local(u16* pixels, int x, int y, int width, int height);
 void lcd_fill_local(u16 color, int x, int y, int width, int height);
 void lcd_clear_local();
-bool lcd_buffer_enable_local(int mode);
+bool lcd_buffer_enable_local(int mode, bool dirty);
 void lcd_buffer_blit_local();
+void lcd_set_palette_local(int start, int count, const u16* colors);
+void lcd_set_clip_local(int x, int y, int width, int height);
+void lcd_set_origin_local(int x, int y);
+void lcd_push_clip_local();
+void lcd_pop_clip_local();
+void lcd_reset_clip_local();
+void lcd_set_blend_local(u8 mode, u8 alpha);
+// clip rect relative to the origin, x2/y2 exclusive. Core 0 only
+void lcd_clip_bounds(int* x1, int* y1, int* x2, int* y2);
+void lcd_get_origin(int* x, int* y);
+// moves the pixels of a rect by dx, dy within the rect and the clip, what's
+// uncovered keeps its old pixels. False when the buffer mode can't read back.
+// Core 0 only
+bool lcd_move_local(int x, int y, int width, int height, int dx, int dy);
 void lcd_draw_char_local(int x, int y, u16 fg, u16 bg, char c);
 void lcd_draw_text_local(int x, int y, u16 fg, u16 bg, const char* text, size_t len, u8 align);
 void lcd_scroll_local(int lines);
@@ -49,6 +87,7 @@ typedef struct {
 	uint8_t term_width;
 	uint8_t term_height;
 	u16* glyph_colorbuf;
+	u16* text_buf;
 	char firstcode;
 	char* font_file;
 } font_t;
@@ -62,53 +101,56 @@ void lcd_off();
 void lcd_blank();
 void lcd_unblank();
 void lcd_setup_scrolling(int top_fixed_lines, int bottom_fixed_lines);
+void lcd_wait_dma();
 
 static inline void lcd_point(u16 color, int x, int y) {
 	if (get_core_num() == 0) lcd_point_local(color, x, y);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_POINT);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
+		multicore_cmd_push(FIFO_LCD_POINT);
+		multicore_cmd_push((uint32_t)color);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
 	}
 }
 
 static inline void lcd_draw(u16* pixels, int x, int y, int width, int height) {
 	if (get_core_num() == 0) lcd_draw_local(pixels, x, y, width, height);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_DRAW);
-		multicore_fifo_push_blocking_inline((uint32_t)pixels);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)width);
-		multicore_fifo_push_blocking_inline((uint32_t)height);
+		multicore_cmd_push(FIFO_LCD_DRAW);
+		multicore_cmd_push((uint32_t)pixels);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)width);
+		multicore_cmd_push((uint32_t)height);
 	}
 }
 
 static inline void lcd_fill(u16 color, int x, int y, int width, int height) {
 	if (get_core_num() == 0) lcd_fill_local(color, x, y, width, height);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_FILL);
-		multicore_fifo_push_blocking_inline((uint32_t)color);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)width);
-		multicore_fifo_push_blocking_inline((uint32_t)height);
+		multicore_cmd_push(FIFO_LCD_FILL);
+		multicore_cmd_push((uint32_t)color);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)width);
+		multicore_cmd_push((uint32_t)height);
 	}
 }
 
 static inline void lcd_clear() {
 	if (get_core_num() == 0) lcd_clear_local();
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_CLEAR);
+		multicore_cmd_push(FIFO_LCD_CLEAR);
 	}
 }
 
-static inline bool lcd_buffer_enable(int mode) {
-	if (get_core_num() == 0) return lcd_buffer_enable_local(mode);
+static inline bool lcd_buffer_enable(int mode, bool dirty) {
+	if (get_core_num() == 0) return lcd_buffer_enable_local(mode, dirty);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_BUFEN);
-		multicore_fifo_push_blocking_inline((uint32_t)mode);
+		// waits on a reply, so never recorded into a display list
+		multicore_ring_push(FIFO_LCD_BUFEN);
+		multicore_ring_push((uint32_t)mode);
+		multicore_ring_push((uint32_t)dirty);
 		return (bool)multicore_fifo_pop_blocking_inline();
 	}
 }
@@ -116,31 +158,97 @@ static inline bool lcd_buffer_enable(int mode) {
 static inline void lcd_buffer_blit() {
 	if (get_core_num() == 0) lcd_buffer_blit_local();
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_BUFBLIT);
+		multicore_cmd_push(FIFO_LCD_BUFBLIT);
+	}
+}
+
+// waits until core 0 has finished everything sent to it so far
+static inline void lcd_sync() {
+	if (get_core_num() == 0) return;
+	multicore_fence_wait(multicore_fence());
+}
+
+static inline void lcd_set_palette(int start, int count, const u16* colors) {
+	if (get_core_num() == 0) lcd_set_palette_local(start, count, colors);
+	else {
+		multicore_cmd_push(FIFO_LCD_PALETTE);
+		multicore_cmd_push((uint32_t)start);
+		multicore_cmd_push((uint32_t)count);
+		for (int i = 0; i < count; i++) multicore_cmd_push((uint32_t)colors[i]);
+	}
+}
+
+static inline void lcd_set_clip(int x, int y, int width, int height) {
+	if (get_core_num() == 0) lcd_set_clip_local(x, y, width, height);
+	else {
+		multicore_cmd_push(FIFO_LCD_CLIP);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)width);
+		multicore_cmd_push((uint32_t)height);
+	}
+}
+
+static inline void lcd_set_blend(u8 mode, u8 alpha) {
+	if (get_core_num() == 0) lcd_set_blend_local(mode, alpha);
+	else {
+		multicore_cmd_push(FIFO_LCD_BLEND);
+		multicore_cmd_push((uint32_t)mode);
+		multicore_cmd_push((uint32_t)alpha);
+	}
+}
+
+static inline void lcd_set_origin(int x, int y) {
+	if (get_core_num() == 0) lcd_set_origin_local(x, y);
+	else {
+		multicore_cmd_push(FIFO_LCD_ORIGIN);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+	}
+}
+
+static inline void lcd_push_clip() {
+	if (get_core_num() == 0) lcd_push_clip_local();
+	else {
+		multicore_cmd_push(FIFO_LCD_PUSHCLIP);
+	}
+}
+
+static inline void lcd_pop_clip() {
+	if (get_core_num() == 0) lcd_pop_clip_local();
+	else {
+		multicore_cmd_push(FIFO_LCD_POPCLIP);
+	}
+}
+
+static inline void lcd_reset_clip() {
+	if (get_core_num() == 0) lcd_reset_clip_local();
+	else {
+		multicore_cmd_push(FIFO_LCD_RESETCLIP);
 	}
 }
 
 static inline void lcd_draw_char(int x, int y, u16 fg, u16 bg, char c) {
 	if (get_core_num() == 0) lcd_draw_char_local(x, y, fg, bg, c);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_CHAR);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)fg);
-		multicore_fifo_push_blocking_inline((uint32_t)bg);
-		multicore_fifo_push_blocking_inline((uint32_t)c);
+		multicore_cmd_push(FIFO_LCD_CHAR);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)fg);
+		multicore_cmd_push((uint32_t)bg);
+		multicore_cmd_push((uint32_t)c);
 	}
 }
 
 static inline void lcd_draw_text(int x, int y, u16 fg, u16 bg, const char* text, size_t len, u8 align) {
 	if (get_core_num() == 0) lcd_draw_text_local(x, y, fg, bg, text, len, align);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_TEXT);
-		multicore_fifo_push_blocking_inline((uint32_t)x);
-		multicore_fifo_push_blocking_inline((uint32_t)y);
-		multicore_fifo_push_blocking_inline((uint32_t)fg);
-		multicore_fifo_push_blocking_inline((uint32_t)bg);
-		multicore_fifo_push_blocking_inline((uint32_t)align);
+		multicore_cmd_push(FIFO_LCD_TEXT);
+		multicore_cmd_push((uint32_t)x);
+		multicore_cmd_push((uint32_t)y);
+		multicore_cmd_push((uint32_t)fg);
+		multicore_cmd_push((uint32_t)bg);
+		multicore_cmd_push((uint32_t)align);
 		multicore_fifo_push_string(text, len);
 	}
 }
@@ -148,7 +256,7 @@ static inline void lcd_draw_text(int x, int y, u16 fg, u16 bg, const char* text,
 static inline void lcd_scroll(int lines) {
 	if (get_core_num() == 0) lcd_scroll_local(lines);
 	else {
-		multicore_fifo_push_blocking_inline(FIFO_LCD_SCROLL);
-		multicore_fifo_push_blocking_inline((uint32_t)lines);
+		multicore_cmd_push(FIFO_LCD_SCROLL);
+		multicore_cmd_push((uint32_t)lines);
 	}
 }
\ No newline at end of file
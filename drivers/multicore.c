@@ -5,31 +5,206 @@
 #include "lcd.h"
 #include "draw.h"
 
+multicore_ring_t multicore_ring = { .idle = true };
+multicore_list_t* multicore_recording = NULL;
+const uint32_t* multicore_replay_pos = NULL;
+multicore_stats_t multicore_stats;
+volatile uint32_t multicore_fence_done;
+static uint32_t multicore_fence_next;
+
+typedef struct {
+	uint32_t start;
+	uint32_t end;
+} multicore_arena_header_t;
+
+// positions only ever grow and wrap around the arena
+static uint32_t multicore_arena[MULTICORE_ARENA_SIZE / sizeof(uint32_t)];
+static volatile uint32_t multicore_arena_head; // written by core 1 only
+static volatile uint32_t multicore_arena_tail; // written by core 0 only
+
+static void multicore_dispatch(uint32_t packet) {
+	if (lcd_fifo_receiver(packet)) return;
+	draw_fifo_receiver(packet);
+}
+
 void handle_multicore_fifo() {
-	// take first FIFO packet and pass to different handlers
-	while (multicore_fifo_rvalid()) {
-		uint32_t packet = multicore_fifo_pop_blocking_inline();
-		
-		if (lcd_fifo_receiver(packet)) break;
-		if (draw_fifo_receiver(packet)) break;
+	// the FIFO only rings the doorbell, core 0's main loop runs the commands
+	while (multicore_fifo_rvalid()) multicore_fifo_pop_blocking_inline();
+	multicore_fifo_clear_irq();
+	__sev();
+}
+
+bool multicore_service(int budget) {
+	int done = 0;
+
+	// check again after going idle so a command pushed in between isn't left
+	// waiting without a doorbell
+	while (true) {
+		while (multicore_cmd_pending()) {
+			if (done == budget) return true;
+			multicore_dispatch(multicore_cmd_pop());
+			done++;
+		}
+
+		multicore_ring.idle = true;
+		__dmb();
+		if (!multicore_cmd_pending()) return done > 0;
+		multicore_ring.idle = false;
 	}
+}
 
-	multicore_fifo_clear_irq();
+void multicore_ring_wait(uint32_t head) {
+	uint32_t start = time_us_32();
+	while (head - multicore_ring.tail >= MULTICORE_RING_SIZE) tight_loop_contents();
+	uint32_t elapsed = time_us_32() - start;
+	multicore_stats.ring_stalls++;
+	multicore_stats.ring_stall_us += elapsed;
+	multicore_stats.wait_us += elapsed;
+}
+
+uint32_t multicore_fence() {
+	uint32_t fence = ++multicore_fence_next;
+	multicore_ring_push(FIFO_LCD_FENCE);
+	multicore_ring_push(fence);
+	return fence;
+}
+
+void multicore_fence_wait(uint32_t fence) {
+	if (multicore_fence_passed(fence)) return;
+	uint32_t start = time_us_32();
+	while (!multicore_fence_passed(fence)) tight_loop_contents();
+	uint32_t elapsed = time_us_32() - start;
+	multicore_stats.flush_us += elapsed;
+	multicore_stats.wait_us += elapsed;
+}
+
+static bool multicore_grow(void** buf, size_t* capacity, size_t count, size_t size) {
+	if (count < *capacity) return true;
+	size_t grown = *capacity ? *capacity * 2 : 64;
+	void* tmp = realloc(*buf, grown * size);
+	if (!tmp) return false;
+	*buf = tmp;
+	*capacity = grown;
+	return true;
+}
+
+void multicore_list_push(multicore_list_t* list, uint32_t word) {
+	if (list->failed) return;
+	if (!multicore_grow((void**)&list->words, &list->capacity, list->count, sizeof(uint32_t))) {
+		list->failed = true;
+		return;
+	}
+	list->words[list->count++] = word;
+}
+
+void multicore_list_replay(multicore_list_t* list) {
+	// lists can replay other lists
+	const uint32_t* outer = multicore_replay_pos;
+	const uint32_t* end = list->words + list->count;
+	multicore_replay_pos = list->words;
+	while (multicore_replay_pos < end) multicore_dispatch(*multicore_replay_pos++);
+	multicore_replay_pos = outer;
+}
+
+void multicore_list_free(multicore_list_t* list) {
+	for (size_t i = 0; i < list->owned_count; i++) free(list->owned[i]);
+	free(list->owned);
+	free(list->words);
+	list->owned = NULL;
+	list->words = NULL;
+	list->count = list->capacity = 0;
+	list->owned_count = list->owned_capacity = 0;
+}
+
+static inline bool multicore_in_arena(void* data) {
+	return (uint8_t*)data > (uint8_t*)multicore_arena && (uint8_t*)data < (uint8_t*)multicore_arena + MULTICORE_ARENA_SIZE;
+}
+
+static void* multicore_heap_alloc(size_t size) {
+	void* data = malloc(size);
+	if (!data) return NULL;
+	multicore_stats.heap_allocs++;
+	if (!multicore_recording) return data;
+
+	// lists own their data for as long as they live
+	multicore_list_t* list = multicore_recording;
+	if (!multicore_grow((void**)&list->owned, &list->owned_capacity, list->owned_count, sizeof(void*))) {
+		free(data);
+		return NULL;
+	}
+	list->owned[list->owned_count++] = data;
+	return data;
+}
+
+void* multicore_cmd_alloc(size_t size) {
+	uint32_t need = (sizeof(multicore_arena_header_t) + size + 3) & ~3;
+	// with blocks up to half the arena, a block plus the end skipped before
+	// it always fits into an empty arena
+	if (multicore_recording || need > MULTICORE_ARENA_SIZE / 2) return multicore_heap_alloc(size);
+
+	// a block never wraps, skip to the start when it doesn't fit at the end
+	uint32_t start = multicore_arena_head;
+	uint32_t offset = start % MULTICORE_ARENA_SIZE;
+	uint32_t pad = offset + need > MULTICORE_ARENA_SIZE ? MULTICORE_ARENA_SIZE - offset : 0;
+	uint32_t end = start + pad + need;
+	if (end - multicore_arena_tail > MULTICORE_ARENA_SIZE) {
+		// everything before this was sent, so core 0 gets to it
+		uint32_t wait_start = time_us_32();
+		multicore_stats.arena_waits++;
+		while (end - multicore_arena_tail > MULTICORE_ARENA_SIZE) tight_loop_contents();
+		multicore_stats.wait_us += time_us_32() - wait_start;
+	}
+
+	multicore_arena_header_t* header = (multicore_arena_header_t*)((uint8_t*)multicore_arena + (start + pad) % MULTICORE_ARENA_SIZE);
+	header->start = start;
+	header->end = end;
+	multicore_arena_head = end;
+	multicore_stats.arena_allocs++;
+	multicore_stats.arena_bytes += need;
+	return header + 1;
+}
+
+void multicore_cmd_discard(void* data) {
+	if (multicore_in_arena(data)) {
+		multicore_arena_head = ((multicore_arena_header_t*)data - 1)->start;
+		return;
+	}
+
+	multicore_list_t* list = multicore_recording;
+	if (list && list->owned_count > 0 && list->owned[list->owned_count - 1] == data) list->owned_count--;
+	free(data);
+}
+
+void multicore_cmd_free(void* data) {
+	// list data stays with the list
+	if (multicore_replay_pos) return;
+	if (multicore_in_arena(data)) {
+		__dmb();
+		multicore_arena_tail = ((multicore_arena_header_t*)data - 1)->end;
+		return;
+	}
+	free(data);
 }
 
 void multicore_fifo_push_string(const char* source, size_t len) {
-	char* dest = strndup(source, len);
+	len = strnlen(source, len);
+	char* dest = multicore_cmd_alloc(len + 1);
+	if (dest) {
+		memcpy(dest, source, len);
+		dest[len] = 0;
+	}
 	if (!dest) {
-		multicore_fifo_push_blocking_inline(0);
-		multicore_fifo_push_blocking_inline((uint32_t)NULL);
+		multicore_cmd_push(0);
+		multicore_cmd_push((uint32_t)NULL);
+		return;
 	}
-	multicore_fifo_push_blocking_inline(len);
-	multicore_fifo_push_blocking_inline((uint32_t)dest);
+	multicore_cmd_push(len);
+	multicore_cmd_push((uint32_t)dest);
 }
 
 size_t multicore_fifo_pop_string(char** string) {
-	size_t len = multicore_fifo_pop_blocking_inline();
-	*string = (char*)multicore_fifo_pop_blocking_inline();
+	size_t len = multicore_cmd_pop();
+	*string = (char*)multicore_cmd_pop();
 	return len;
 }
 
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "pico/multicore.h"
+#include "hardware/sync.h"
 
 enum FIFO_CODES {
 	FIFO_LCD = 256,
@@ -17,6 +18,14 @@ enum FIFO_CODES {
 	FIFO_LCD_CHAR,
 	FIFO_LCD_TEXT,
 	FIFO_LCD_SCROLL,
+	FIFO_LCD_PALETTE,
+	FIFO_LCD_CLIP,
+	FIFO_LCD_ORIGIN,
+	FIFO_LCD_PUSHCLIP,
+	FIFO_LCD_POPCLIP,
+	FIFO_LCD_RESETCLIP,
+	FIFO_LCD_BLEND,
+	FIFO_LCD_FENCE,
 
 	FIFO_DRAW,
 	FIFO_DRAW_POINT,
@@ -29,9 +38,133 @@ enum FIFO_CODES {
 	FIFO_DRAW_POLY,
 	FIFO_DRAW_POLYFILL,
 	FIFO_DRAW_TRI,
+	FIFO_DRAW_TRIFILL,
+	FIFO_DRAW_TRITEX,
 	FIFO_DRAW_SPRITE,
+	FIFO_DRAW_SPRITEXFORM,
+	FIFO_DRAW_TILEMAP,
+	FIFO_DRAW_PIXELBUFFER,
+	FIFO_DRAW_BATCH,
+	FIFO_DRAW_LIST,
 };
 
+// commands from core 1 are written word by word into a ring in shared
+// memory, an opcode followed by its arguments. The hardware FIFO only
+// carries a doorbell to wake core 0 after it drained the ring and went idle,
+// replies from core 0 still come back through the FIFO. Core 0 runs the
+// commands from its main loop, see workqueue.h
+#define MULTICORE_RING_SIZE 1024
+#define MULTICORE_DOORBELL 0
+
+typedef struct {
+	// written by core 1 only
+	volatile uint32_t head;
+	// written by core 0 only
+	volatile uint32_t tail;
+	// core 0 found the ring empty and needs a doorbell
+	volatile bool idle;
+	uint32_t words[MULTICORE_RING_SIZE];
+} multicore_ring_t;
+
+// display lists record the same words instead of sending them, heap data
+// the commands point to is kept with the list instead of freed by core 0
+typedef struct {
+	uint32_t* words;
+	size_t count;
+	size_t capacity;
+	void** owned;
+	size_t owned_count;
+	size_t owned_capacity;
+	// ran out of memory while recording, the words can't be replayed
+	bool failed;
+} multicore_list_t;
+
+typedef struct {
+	uint32_t arena_allocs;  // transfers served from the arena
+	uint32_t arena_bytes;   // bytes handed out from the arena
+	uint32_t arena_waits;   // transfers that waited for core 0 to free space
+	uint32_t heap_allocs;   // transfers that had to use the heap
+	uint32_t ring_peak;     // most words ever waiting in the command ring
+	uint32_t ring_stalls;   // pushes that waited for room in the ring
+	uint32_t ring_stall_us; // time spent waiting for room in the ring
+	uint32_t flush_us;      // time spent waiting on fences
+	uint64_t wait_us;       // time core 1 spent waiting on core 0 for any of the above
+} multicore_stats_t;
+
+extern multicore_stats_t multicore_stats;
+
+extern multicore_ring_t multicore_ring;
+// last fence core 0 got to, fences are numbered in the order they're sent
+extern volatile uint32_t multicore_fence_done;
+// core 1 records commands here instead of sending them, NULL when not recording
+extern multicore_list_t* multicore_recording;
+// where core 0 reads commands from while replaying a list, NULL otherwise
+extern const uint32_t* multicore_replay_pos;
+
+void multicore_ring_wait(uint32_t head);
+// core 0 runs up to budget queued commands, returns whether it ran any
+bool multicore_service(int budget);
+void multicore_list_push(multicore_list_t* list, uint32_t word);
+void multicore_list_replay(multicore_list_t* list);
+void multicore_list_free(multicore_list_t* list);
+
+static inline bool multicore_cmd_pending() {
+	return multicore_ring.head != multicore_ring.tail;
+}
+
+// bypasses recording, for fences and commands that wait on a reply
+static inline void multicore_ring_push(uint32_t word) {
+	uint32_t head = multicore_ring.head;
+	if (head - multicore_ring.tail >= MULTICORE_RING_SIZE) multicore_ring_wait(head);
+	multicore_ring.words[head & (MULTICORE_RING_SIZE - 1)] = word;
+	__dmb();
+	multicore_ring.head = head + 1;
+	uint32_t depth = head + 1 - multicore_ring.tail;
+	if (depth > multicore_stats.ring_peak) multicore_stats.ring_peak = depth;
+	__dmb();
+	if (multicore_ring.idle) {
+		multicore_ring.idle = false;
+		multicore_fifo_push_blocking_inline(MULTICORE_DOORBELL);
+	}
+}
+
+static inline void multicore_cmd_push(uint32_t word) {
+	if (multicore_recording) multicore_list_push(multicore_recording, word);
+	else multicore_ring_push(word);
+}
+
+static inline uint32_t multicore_cmd_pop() {
+	if (multicore_replay_pos) return *multicore_replay_pos++;
+	uint32_t tail = multicore_ring.tail;
+	// the rest of a command can still be on its way
+	while (multicore_ring.head == tail) tight_loop_contents();
+	__dmb();
+	uint32_t word = multicore_ring.words[tail & (MULTICORE_RING_SIZE - 1)];
+	__dmb();
+	multicore_ring.tail = tail + 1;
+	return word;
+}
+
+// data handed to core 0 along with a command comes from a circular arena,
+// core 0 runs commands in order so it frees by moving the arena's tail past
+// each one. Lists and data too big for the arena use the heap
+#define MULTICORE_ARENA_SIZE 16384
+
+void* multicore_cmd_alloc(size_t size);
+// frees data that was never sent
+void multicore_cmd_discard(void* data);
+// core 0 is done with the data of a command
+void multicore_cmd_free(void* data);
+
+// fences pass once core 0 finished every command sent before them, they
+// skip display list recording. Core 1 only
+uint32_t multicore_fence();
+void multicore_fence_wait(uint32_t fence);
+
+static inline bool multicore_fence_passed(uint32_t fence) {
+	return (int32_t)(multicore_fence_done - fence) >= 0;
+}
+
 void multicore_fifo_push_string(const char* string, size_t len);
 size_t multicore_fifo_pop_string(char** string);
 
@@ -111,6 +111,13 @@ static void sound_initialbuffer(uint16_t* buffer) {
 	}
 }
 
+static void sound_dma_handler(void);
+
+static void sound_dma_irq(void) {
+	// DMA_IRQ_1 is shared with the lcd
+	if (dma_channel_get_irq1_status(sound_dma_chan)) sound_dma_handler();
+}
+
 static void sound_dma_handler(void) {
 	dma_hw->ints0 = 1u << sound_dma_chan;
 	dma_channel_set_read_addr(sound_dma_chan, sound_buffer[sound_buffer_select], true);
@@ -153,7 +160,7 @@ void sound_init() {
 	}
 
 	dma_channel_set_irq1_enabled(sound_dma_chan, true);
-	irq_set_exclusive_handler(DMA_IRQ_1, sound_dma_handler);
+	irq_add_shared_handler(DMA_IRQ_1, sound_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
 	irq_set_priority(DMA_IRQ_1, PICO_DEFAULT_IRQ_PRIORITY - 10);
 	irq_set_enabled(DMA_IRQ_1, true);
 
@@ -8,11 +8,13 @@
 
 #include "lcd.h"
 #include "keyboard.h"
+#include "workqueue.h"
 
 stdio_driver_t stdio_picocalc;
 static void (*chars_available_callback)(void *) = NULL;
 static void *chars_available_param = NULL;
 static repeating_timer_t cursor_timer;
+static volatile bool cursor_blink_queued;
 
 static void set_chars_available_callback(void (*fn)(void *), void *param) {
 	chars_available_callback = fn;
@@ -95,48 +97,82 @@ static int ansi_len_to_lcd_y(int len) {
 	return (ansi.y + (len + ansi.x) / font.term_width) * font.glyph_height;
 }
 
+// terminal output always goes to the screen, also while Lua on core 1 is
+// recording a display list. Core 0 never records
+static inline multicore_list_t* term_pause_recording() {
+	if (get_core_num() == 0) return NULL;
+	multicore_list_t* list = multicore_recording;
+	multicore_recording = NULL;
+	return list;
+}
+
+static inline void term_resume_recording(multicore_list_t* list) {
+	if (get_core_num() != 0) multicore_recording = list;
+}
+
+static void term_fill(u16 color, int x, int y, int width, int height) {
+	multicore_list_t* recording = term_pause_recording();
+	lcd_fill(color, x, y, width, height);
+	term_resume_recording(recording);
+}
+
 void term_scroll(int lines) {
 	if (lines != ansi.scroll) {
 		ansi.scroll = lines;
 		term_erase_line(lines + font.term_height);
+		multicore_list_t* recording = term_pause_recording();
 		lcd_scroll(lines * font.glyph_height);
+		term_resume_recording(recording);
 	}
 }
 
 void term_clear() {
 	ansi.x = ansi.y = ansi.len = 0;
+	multicore_list_t* recording = term_pause_recording();
 	lcd_clear();
 	lcd_scroll(0);
+	term_resume_recording(recording);
 	ansi.scroll = 0;
 }
 
 static void term_draw_char(int x, int y, u16 fg, u16 bg, char c) {
+	multicore_list_t* recording = term_pause_recording();
 	y %= lcd_current_height;
 	lcd_draw_char(x, y, fg, bg, c);
 	if (y > lcd_current_height - font.glyph_height)
 		lcd_draw_char(x, y - lcd_current_height, fg, bg, c);
+	term_resume_recording(recording);
+}
+
+static void term_draw_text(int x, int y, u16 fg, u16 bg, const char* text, int len) {
+	multicore_list_t* recording = term_pause_recording();
+	y %= lcd_current_height;
+	lcd_draw_text(x, y, fg, bg, text, len, LCD_ALIGN_LEFT);
+	if (y > lcd_current_height - font.glyph_height)
+		lcd_draw_text(x, y - lcd_current_height, fg, bg, text, len, LCD_ALIGN_LEFT);
+	term_resume_recording(recording);
 }
 
 static void term_erase_char(int x, int y, u16 bg) {
 	y %= lcd_current_height;
-	lcd_fill(bg, x, y, font.glyph_width, font.glyph_height);
+	term_fill(bg, x, y, font.glyph_width, font.glyph_height);
 	if (y > lcd_current_height - font.glyph_height)
-		lcd_fill(bg, x, y - lcd_current_height, font.glyph_width, font.glyph_height);
+		term_fill(bg, x, y - lcd_current_height, font.glyph_width, font.glyph_height);
 }
 
 void term_erase_line(int y) {
 	y = (y * font.glyph_height) % lcd_current_height;
-	lcd_fill(ansi.bg, 0, y, LCD_WIDTH, font.glyph_height);
+	term_fill(ansi.bg, 0, y, LCD_WIDTH, font.glyph_height);
 	if (y > lcd_current_height - font.glyph_height)
-		lcd_fill(ansi.bg, 0, y - lcd_current_height, LCD_WIDTH, font.glyph_height);
+		term_fill(ansi.bg, 0, y - lcd_current_height, LCD_WIDTH, font.glyph_height);
 }
 
 void term_erase_from_cursor() {
 	int x = ansi.x * font.glyph_width;
 	int y = (ansi.y * font.glyph_height) % lcd_current_height;
-	lcd_fill(ansi.bg, x, y, LCD_WIDTH - x, font.glyph_height);
+	term_fill(ansi.bg, x, y, LCD_WIDTH - x, font.glyph_height);
 	if (y > lcd_current_height - font.glyph_height)
-		lcd_fill(ansi.bg, x, y - lcd_current_height, LCD_WIDTH - x, font.glyph_height);
+		term_fill(ansi.bg, x, y - lcd_current_height, LCD_WIDTH - x, font.glyph_height);
 }
 
 static void draw_cursor() {
@@ -144,25 +180,34 @@ static void draw_cursor() {
 		ansi.cx = ansi_len_to_lcd_x(ansi.len);
 		ansi.cy = ansi_len_to_lcd_y(ansi.len);
 		// this used to be an underline but without a buffer of what it draws over, it causes too many artifacts
-		lcd_fill(ansi.fg, ansi.cx, ansi.cy, 1, font.glyph_height - 1);
+		term_fill(ansi.fg, ansi.cx, ansi.cy, 1, font.glyph_height - 1);
 		ansi.cursor_visible = true;
 	}
 }
 
 static void erase_cursor() {
 	if (ansi.cursor_enabled && ansi.cursor_visible) {
-		lcd_fill(ansi.bg, ansi.cx, ansi.cy, 1, font.glyph_height - 1);
+		term_fill(ansi.bg, ansi.cx, ansi.cy, 1, font.glyph_height - 1);
 		ansi.cursor_visible = false;
 	}
 }
 
-static bool on_cursor_timer(repeating_timer_t *rt) {
+static void cursor_blink_work(void* arg) {
+	cursor_blink_queued = false;
 	if (!ansi.cursor_manual && ansi.cursor_visible) {
 		erase_cursor();
 	} else {
 		ansi.cursor_manual = false;
 		draw_cursor();
 	}
+}
+
+// the alarm fires in an interrupt on core 0, which could be halfway through
+// a draw, so the blink is left to its main loop
+static bool on_cursor_timer(repeating_timer_t *rt) {
+	if (!cursor_blink_queued) {
+		cursor_blink_queued = workqueue_push(cursor_blink_work, NULL, WORK_PRIORITY_LOW);
+	}
 	return true;
 }
 
@@ -276,8 +321,29 @@ static void out_char(char c) {
 	}
 }
 
+// draws consecutive printable characters on the current line in one go
+static int out_run(const char* buf, int length) {
+	// backspace and cursor movement can leave x before the line
+	if (ansi.x < 0) ansi.x = 0;
+	should_scroll();
+	int count = 0;
+	int space = font.term_width - ansi.x;
+	while (count < length && count < space && buf[count] >= 32 && buf[count] < 127) count++;
+
+	if (ansi.c_inverse) term_draw_text(ansi.x * font.glyph_width, ansi.y * font.glyph_height, ansi.bg, ansi.fg, buf, count);
+	else term_draw_text(ansi.x * font.glyph_width, ansi.y * font.glyph_height, ansi.fg, ansi.bg, buf, count);
+	ansi.x += count;
+	return count;
+}
+
 void stdio_picocalc_out_chars(const char *buf, int length) {
 	while (length > 0) {
+		if (ansi.state == AnsiNone && *buf >= 32 && *buf < 127) {
+			int count = out_run(buf, length);
+			buf += count;
+			length -= count;
+			continue;
+		}
 		if (ansi.state == AnsiNone) {
 			if (*buf == 27 || *buf == '\x1b') ansi.state = AnsiEscape;
 			else if (*buf == '\t') {
@@ -0,0 +1,99 @@
+#include "workqueue.h"
+
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+#include "multicore.h"
+
+typedef struct {
+	work_fn_t fn;
+	void* arg;
+} work_item_t;
+
+typedef struct {
+	work_item_t items[WORKQUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+} work_ring_t;
+
+workqueue_stats_t workqueue_stats;
+
+static work_ring_t workqueue_rings[WORK_PRIORITIES];
+static critical_section_t workqueue_lock;
+
+void workqueue_init() {
+	critical_section_init(&workqueue_lock);
+}
+
+bool workqueue_push(work_fn_t fn, void* arg, uint8_t priority) {
+	if (priority >= WORK_PRIORITIES) priority = WORK_PRIORITY_LOW;
+
+	critical_section_enter_blocking(&workqueue_lock);
+	work_ring_t* ring = &workqueue_rings[priority];
+	bool queued = ring->count < WORKQUEUE_SIZE;
+	if (queued) {
+		ring->items[(ring->head + ring->count) % WORKQUEUE_SIZE] = (work_item_t){ fn, arg };
+		ring->count++;
+	} else {
+		workqueue_stats.dropped++;
+	}
+	critical_section_exit(&workqueue_lock);
+
+	// wakes core 0 if it's sleeping
+	if (queued) __sev();
+	return queued;
+}
+
+void workqueue_get_stats(workqueue_stats_t* stats) {
+	critical_section_enter_blocking(&workqueue_lock);
+	*stats = workqueue_stats;
+	critical_section_exit(&workqueue_lock);
+}
+
+static bool workqueue_pop(work_item_t* item) {
+	bool found = false;
+
+	critical_section_enter_blocking(&workqueue_lock);
+	for (int i = 0; i < WORK_PRIORITIES; i++) {
+		work_ring_t* ring = &workqueue_rings[i];
+		if (ring->count == 0) continue;
+		*item = ring->items[ring->head];
+		ring->head = (ring->head + 1) % WORKQUEUE_SIZE;
+		ring->count--;
+		found = true;
+		break;
+	}
+	critical_section_exit(&workqueue_lock);
+
+	return found;
+}
+
+bool workqueue_step() {
+	// core 1 waits on drawing, so it goes before any queued work
+	bool busy = multicore_service(WORKQUEUE_DRAW_BUDGET);
+
+	work_item_t item;
+	if (workqueue_pop(&item)) {
+		item.fn(item.arg);
+		workqueue_stats.items++;
+		busy = true;
+	}
+	return busy;
+}
+
+void workqueue_run() {
+	while (true) {
+		uint32_t start = time_us_32();
+		bool busy = workqueue_step();
+
+		// the doorbell interrupt and workqueue_push both send an event
+		if (!busy) __wfe();
+
+		// the 64 bit counters are updated under the lock so core 1 never
+		// reads one half way through
+		uint32_t elapsed = time_us_32() - start;
+		critical_section_enter_blocking(&workqueue_lock);
+		if (busy) workqueue_stats.busy_us += elapsed;
+		else workqueue_stats.idle_us += elapsed;
+		critical_section_exit(&workqueue_lock);
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// core 0 serves drawing commands from core 1 first, then runs queued work
+// items, higher priorities first and in order within a priority
+enum WORK_PRIORITY {
+	WORK_PRIORITY_HIGH,
+	WORK_PRIORITY_NORMAL,
+	WORK_PRIORITY_LOW,
+	WORK_PRIORITIES
+};
+
+// items waiting per priority
+#define WORKQUEUE_SIZE 16
+// drawing commands run before queued work gets a turn
+#define WORKQUEUE_DRAW_BUDGET 64
+
+typedef void (*work_fn_t)(void* arg);
+
+typedef struct {
+	uint64_t busy_us;  // time core 0 spent drawing or running work
+	uint64_t idle_us;  // time core 0 slept waiting for something to do
+	uint32_t items;    // work items run since boot
+	uint32_t dropped;  // work items that didn't fit in the queue
+} workqueue_stats_t;
+
+extern workqueue_stats_t workqueue_stats;
+
+void workqueue_init();
+// a consistent copy of workqueue_stats, any core
+void workqueue_get_stats(workqueue_stats_t* stats);
+// any core, also from interrupts
+bool workqueue_push(work_fn_t fn, void* arg, uint8_t priority);
+// one pass of the main loop: a share of the drawing commands, then one work
+// item. Returns whether there was anything to do
+bool workqueue_step();
+// core 0 main loop, never returns
+void workqueue_run();
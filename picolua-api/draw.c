@@ -1,5 +1,8 @@
 #include <stdlib.h>
 #include <malloc.h>
+#include <math.h>
+
+#include "pico/time.h"
 
 #include <lua.h>
 #include <lualib.h>
@@ -11,13 +14,50 @@
 #include "modules.h"
 
 #define spritesheet "Spritesheet"
+#define tilemap "Tilemap"
+#define pixelbuffer "Pixelbuffer"
+#define displaylist "DisplayList"
+// registry field holding the list being recorded
+#define recordinglist "draw.recording"
 
 static inline Spritesheet* l_checksprite(lua_State *L, int n) {
 	return (Spritesheet*)luaL_checkudata(L, n, spritesheet);
 }
 
+static inline Tilemap* l_checktilemap(lua_State *L, int n) {
+	return (Tilemap*)luaL_checkudata(L, n, tilemap);
+}
+
+static inline Pixelbuffer* l_checkpixelbuffer(lua_State *L, int n) {
+	Pixelbuffer* buffer = (Pixelbuffer*)luaL_checkudata(L, n, pixelbuffer);
+	if (!buffer->pixels) luaL_error(L, "pixel buffer is closed");
+	return buffer;
+}
+
+static inline multicore_list_t* l_checklist(lua_State *L, int n) {
+	return (multicore_list_t*)luaL_checkudata(L, n, displaylist);
+}
+
+// a list holds on to the sprites, maps and lists its commands point to
+static void l_draw_list_keep(lua_State* L, int n) {
+	if (!multicore_recording) return;
+	lua_getfield(L, LUA_REGISTRYINDEX, recordinglist);
+	lua_getiuservalue(L, -1, 1);
+	lua_pushvalue(L, n);
+	lua_pushboolean(L, true);
+	lua_rawset(L, -3);
+	lua_pop(L, 2);
+}
+
 Spritesheet* l_newsprite(lua_State *L) {
 	Spritesheet* sprite = lua_newuserdata(L, sizeof(Spritesheet));
+	sprite->bitmap = NULL;
+	sprite->run_index = NULL;
+	sprite->runs = NULL;
+	sprite->version = 1;
+	sprite->runs_version = 0;
+	sprite->compiled = false;
+	sprite->row_pixels = NULL;
 	luaL_getmetatable(L, spritesheet);
 	lua_setmetatable(L, -2);
 	return sprite;
@@ -40,20 +80,31 @@ static int l_draw_clear(lua_State* L) {
 	return 0;
 }
 
+// frame pacing for draw.present, times are in microseconds
+static uint64_t present_frame_start = 0;
+static struct {
+	uint32_t draw_us;
+	uint32_t slack_us;
+	uint32_t frame_us;
+} present_stats;
+
 static int l_draw_buffer_enable(lua_State* L) {
 	int mode = 0;
 	if (lua_type(L, 1) == LUA_TBOOLEAN) {
 		if (lua_toboolean(L, 1)) mode = 1;
 	} else {
 		mode = luaL_checkinteger(L, 1);
+		luaL_argcheck(L, mode >= LCD_BUFFERMODE_DIRECT && mode <= LCD_BUFFERMODE_INDEXED4, 1, "invalid buffer mode");
 	}
+	bool dirty = luaL_opt(L, lua_toboolean, 2, true);
 
-	if (mode == LCD_BUFFERMODE_RAM) {
+	if (mode == LCD_BUFFERMODE_RAM || mode == LCD_BUFFERMODE_INDEXED8 || mode == LCD_BUFFERMODE_INDEXED4) {
 		lua_getglobal(L, "collectgarbage");
 		lua_pcall(L, 0, 1, 0);
 	}
 
-	lua_pushboolean(L, lcd_buffer_enable(mode));
+	present_frame_start = 0;
+	lua_pushboolean(L, lcd_buffer_enable(mode, dirty));
 	return 1;
 }
 
@@ -62,6 +113,125 @@ static int l_draw_buffer_blit(lua_State* L) {
 	return 0;
 }
 
+static int l_draw_present(lua_State* L) {
+	int fps = luaL_optinteger(L, 1, 0);
+	uint64_t now = time_us_64();
+	if (present_frame_start == 0) present_frame_start = now;
+	present_stats.draw_us = now - present_frame_start;
+
+	lcd_buffer_blit();
+
+	now = time_us_64();
+	present_stats.slack_us = 0;
+	if (fps > 0) {
+		uint64_t deadline = present_frame_start + 1000000 / fps;
+		if (now < deadline) {
+			present_stats.slack_us = deadline - now;
+			sleep_until(from_us_since_boot(deadline));
+			now = deadline;
+		}
+	}
+	// a late frame starts the next one from now instead of trying to catch up
+	present_stats.frame_us = now - present_frame_start;
+	present_frame_start = now;
+	return 0;
+}
+
+static int l_draw_set_palette(lua_State* L) {
+	int start = luaL_checkinteger(L, 1);
+	u16 colors[256];
+	int count = 1;
+
+	luaL_argcheck(L, start >= 0 && start < 256, 1, "palette index out of range");
+	if (lua_istable(L, 2)) {
+		count = lua_rawlen(L, 2);
+		if (count > 256 - start) count = 256 - start;
+		for (int i = 0; i < count; i++) {
+			lua_rawgeti(L, 2, i + 1);
+			colors[i] = luaL_checkinteger(L, -1);
+			lua_pop(L, 1);
+		}
+	} else {
+		colors[0] = luaL_checkinteger(L, 2);
+	}
+
+	lcd_set_palette(start, count, colors);
+	return 0;
+}
+
+static int l_draw_set_clip(lua_State* L) {
+	if (lua_isnoneornil(L, 1)) {
+		lcd_set_clip(0, 0, -1, -1);
+		return 0;
+	}
+	int x = luaL_checkinteger(L, 1);
+	int y = luaL_checkinteger(L, 2);
+	int width = luaL_checkinteger(L, 3);
+	int height = luaL_checkinteger(L, 4);
+	if (width < 0) width = 0;
+	if (height < 0) height = 0;
+	lcd_set_clip(x, y, width, height);
+	return 0;
+}
+
+static int l_draw_set_origin(lua_State* L) {
+	int x = luaL_optinteger(L, 1, 0);
+	int y = luaL_optinteger(L, 2, 0);
+	lcd_set_origin(x, y);
+	return 0;
+}
+
+static int l_draw_push_clip(lua_State* L) {
+	lcd_push_clip();
+	return 0;
+}
+
+static int l_draw_pop_clip(lua_State* L) {
+	lcd_pop_clip();
+	return 0;
+}
+
+static int l_draw_set_blend(lua_State* L) {
+	int mode = luaL_optinteger(L, 1, LCD_BLEND_NONE);
+	int alpha = luaL_optinteger(L, 2, 255);
+	luaL_argcheck(L, mode >= 0 && mode <= LCD_BLEND_MULTIPLY, 1, "invalid blend mode");
+	lcd_set_blend((u8)mode, alpha < 0 ? 0 : (alpha > 255 ? 255 : alpha));
+	return 0;
+}
+
+static int l_draw_flush(lua_State* L) {
+	if (lua_isnoneornil(L, 1)) lcd_sync();
+	else multicore_fence_wait(luaL_checkinteger(L, 1));
+	return 0;
+}
+
+static int l_draw_fence(lua_State* L) {
+	lua_pushinteger(L, multicore_fence());
+	return 1;
+}
+
+static int l_draw_is_done(lua_State* L) {
+	lua_pushboolean(L, multicore_fence_passed(luaL_checkinteger(L, 1)));
+	return 1;
+}
+
+static int l_draw_get_stats(lua_State* L) {
+	lua_newtable(L);
+	lua_pushintegerconstant(L, "blitBytes", lcd_stats.blit_bytes);
+	lua_pushintegerconstant(L, "blitSaved", lcd_stats.blit_saved);
+	lua_pushintegerconstant(L, "blitRegions", lcd_stats.blit_regions);
+	lua_pushintegerconstant(L, "blitTime", lcd_stats.blit_us);
+	lua_pushintegerconstant(L, "drawTime", present_stats.draw_us);
+	lua_pushintegerconstant(L, "slackTime", present_stats.slack_us);
+	lua_pushintegerconstant(L, "frameTime", present_stats.frame_us);
+	lua_pushintegerconstant(L, "frames", lcd_stats.frames);
+	lua_pushintegerconstant(L, "presentTime", lcd_stats.present_us);
+	lua_pushintegerconstant(L, "stallTime", lcd_stats.present_stall_us);
+	lua_pushintegerconstant(L, "stalls", lcd_stats.present_stalls);
+	lua_pushintegerconstant(L, "psramTransactions", lcd_stats.psram_transactions);
+	return 1;
+}
+
 static int l_draw_color_from_rgb(lua_State* L) {
 	u8 r = luaL_checkinteger(L, 1);
 	u8 g = luaL_checkinteger(L, 2);
@@ -184,20 +354,21 @@ static int l_draw_polygon(lua_State* L) {
 	int num_coords = luaL_len(L, 1);
 	if (num_coords % 2 != 0) return luaL_error(L, "Points table must contain an even number of values (x, y pairs)");
 	int n = num_coords;
-	float *points = (float *) malloc(num_coords * sizeof(float));
+	// nothing can fail between allocating and sending the points
+	Color color = luaL_checkinteger(L, 2);
+	float *points = (float *) multicore_cmd_alloc(num_coords * sizeof(float));
 	if (!points) return luaL_error(L, "Memory allocation failed");
 
 	for (int i = 0; i < num_coords; ++i) {
 		lua_rawgeti(L, 1, i + 1);
 		if (!lua_isnumber(L, -1)) {
-			free(points);
+			multicore_cmd_discard(points);
 			return luaL_error(L, "Non-numeric value in points table at index %d", i + 1);
 		}
 		points[i] = lua_tonumber(L, -1);
 		lua_pop(L, 1); 
 	}
 
-	Color color = luaL_checkinteger(L, 2);
 	draw_polygon(n, points, color);
 	// we trust draw_polygon to eventually free the array
 	// because it will be needed on the second core
@@ -209,40 +380,119 @@ static int l_draw_fill_polygon(lua_State* L) {
 	if (!lua_istable(L, 1)) return luaL_error(L, "Expected table for argument #1 (points)");
 	int num_coords = luaL_len(L, 1);
 	if (num_coords % 2 != 0) return luaL_error(L, "Points table must contain an even number of values (x, y pairs)");
-	int n = num_coords / 2;
-	float *points = (float *) malloc(num_coords * sizeof(float));
+	int n = num_coords;
+	Color color = luaL_checkinteger(L, 2);
+	u8 rule = luaL_optinteger(L, 3, DRAW_FILL_EVENODD);
+	float *points = (float *) multicore_cmd_alloc(num_coords * sizeof(float));
 	if (!points) return luaL_error(L, "Memory allocation failed");
 
 	for (int i = 0; i < num_coords; ++i) {
 		lua_rawgeti(L, 1, i + 1);
 		if (!lua_isnumber(L, -1)) {
-			free(points);
+			multicore_cmd_discard(points);
 			return luaL_error(L, "Non-numeric value in points table at index %d", i + 1);
 		}
 		points[i] = lua_tonumber(L, -1);
 		lua_pop(L, 1); 
 	}
 
-	Color color = luaL_checkinteger(L, 2);
-	draw_fill_polygon(n, points, color);
+	draw_fill_polygon(n, points, color, rule);
 	//free(points);
 	return 0;
 }
 
+// batches come as a flat table or a string of little-endian 16-bit
+// values, each primitive's color last unless one is given for all of them
+static int l_draw_batch(lua_State* L, u8 kind) {
+	bool shared = !lua_isnoneornil(L, 2);
+	i32 color = shared ? (Color)luaL_checkinteger(L, 2) : -1;
+	int stride = draw_batch_stride(kind) + (shared ? 0 : 1);
+
+	size_t len;
+	const char* str = NULL;
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		str = lua_tolstring(L, 1, &len);
+		len /= sizeof(i16);
+	} else {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		len = luaL_len(L, 1);
+	}
+	if (len % stride != 0) return luaL_error(L, "batch must have %d values per primitive", stride);
+	if (len == 0) return 0;
+
+	i16* data = multicore_cmd_alloc(len * sizeof(i16));
+	if (!data) return luaL_error(L, "Memory allocation failed");
+
+	if (str) memcpy(data, str, len * sizeof(i16));
+	else {
+		for (size_t i = 0; i < len; i++) {
+			lua_rawgeti(L, 1, i + 1);
+			int isnum;
+			lua_Number v = lua_tonumberx(L, -1, &isnum);
+			lua_pop(L, 1);
+			if (!isnum) {
+				multicore_cmd_discard(data);
+				return luaL_error(L, "Non-numeric value in batch at index %d", (int)i + 1);
+			}
+			data[i] = (i16)(i32)v;
+		}
+	}
+
+	// the array is freed once core 0 is done with it
+	draw_batch(kind, len / stride, data, color);
+	return 0;
+}
+
+static int l_draw_points(lua_State* L) {
+	return l_draw_batch(L, DRAW_BATCH_POINTS);
+}
+
+static int l_draw_lines(lua_State* L) {
+	return l_draw_batch(L, DRAW_BATCH_LINES);
+}
+
+static int l_draw_rects(lua_State* L) {
+	return l_draw_batch(L, DRAW_BATCH_RECTS);
+}
+
+static int l_draw_rects_fill(lua_State* L) {
+	return l_draw_batch(L, DRAW_BATCH_RECTSFILL);
+}
+
+static int l_draw_circles(lua_State* L) {
+	return l_draw_batch(L, DRAW_BATCH_CIRCLES);
+}
+
+static int l_draw_circles_fill(lua_State* L) {
+	return l_draw_batch(L, DRAW_BATCH_CIRCLESFILL);
+}
+
 static int l_draw_triangle_shaded(lua_State* L) {
 	Color c1 = luaL_checkinteger(L, 1);
-	float x1 = luaL_checknumber(L, 2);
-	float y1 = luaL_checknumber(L, 3);
+	i32 x1 = DRAW_FIX(luaL_checknumber(L, 2));
+	i32 y1 = DRAW_FIX(luaL_checknumber(L, 3));
 	Color c2 = luaL_checkinteger(L, 4);
-	float x2 = luaL_checknumber(L, 5);
-	float y2 = luaL_checknumber(L, 6);
+	i32 x2 = DRAW_FIX(luaL_checknumber(L, 5));
+	i32 y2 = DRAW_FIX(luaL_checknumber(L, 6));
 	Color c3 = luaL_checkinteger(L, 7);
-	float x3 = luaL_checknumber(L, 8);
-	float y3 = luaL_checknumber(L, 9);
+	i32 x3 = DRAW_FIX(luaL_checknumber(L, 8));
+	i32 y3 = DRAW_FIX(luaL_checknumber(L, 9));
 	draw_triangle_shaded(c1, x1, y1, c2, x2, y2, c3, x3, y3);
 	return 0;
 }
 
+static int l_draw_triangle_fill(lua_State* L) {
+	i32 x1 = DRAW_FIX(luaL_checknumber(L, 1));
+	i32 y1 = DRAW_FIX(luaL_checknumber(L, 2));
+	i32 x2 = DRAW_FIX(luaL_checknumber(L, 3));
+	i32 y2 = DRAW_FIX(luaL_checknumber(L, 4));
+	i32 x3 = DRAW_FIX(luaL_checknumber(L, 5));
+	i32 y3 = DRAW_FIX(luaL_checknumber(L, 6));
+	Color color = luaL_checkinteger(L, 7);
+	draw_triangle(x1, y1, x2, y2, x3, y3, color);
+	return 0;
+}
+
 /* BMP loading */
 
 typedef struct __attribute__((__packed__)) {
@@ -279,6 +529,7 @@ static int l_draw_load_spritesheet_bmp(lua_State* L) {
 	int spr_width = luaL_optinteger(L, 2, 0);
 	int spr_height = luaL_optinteger(L, 3, 0);
 	Color spr_mask = luaL_optinteger(L, 4, RGB(255, 0, 255));
+	bool compile = lua_toboolean(L, 5);
 	FIL file;
 	FILEHEADER fh;
 	INFOHEADER ih;
@@ -339,34 +590,20 @@ static int l_draw_load_spritesheet_bmp(lua_State* L) {
 
 	f_close(&file);
 
+	// compiling replaces the bitmap and runs that queued blits still read
+	if (compile) lcd_sync();
+	if (compile && !draw_sprite_compile(sprite)) return luaL_error(L, "failed to allocate space for compiled sprites");
+
 	return 1;
 }
 
 static int l_draw_load_spritesheet(lua_State* L) {
 	const char* filename = luaL_checkstring(L, 1);
-	FIL file;
-
-	FRESULT res = f_open(&file, filename, FA_READ);
-	if (res != FR_OK) return luaL_error(L, fs_error_strings[res]);
-	
 	Spritesheet* sprite = l_newsprite(L);
-	
-	res = f_read(&file, &sprite->width, sizeof(sprite->width), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-	res = f_read(&file, &sprite->height, sizeof(sprite->height), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-	res = f_read(&file, &sprite->count, sizeof(sprite->count), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-	res = f_read(&file, &sprite->mask, sizeof(sprite->mask), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-
-	int bitmap_size = sprite->width * sprite->height * sprite->count * sizeof(Color);
-	sprite->bitmap = (Color*)malloc(bitmap_size);
-	res = f_read(&file, sprite->bitmap, bitmap_size, NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-
-	f_close(&file);
 
+	int res = draw_sprite_load(sprite, filename);
+	if (res == DRAW_SPRITE_NO_MEMORY) return luaL_error(L, "failed to allocate space for sprites");
+	if (res != FR_OK) return luaL_error(L, fs_error_strings[res]);
 	return 1;
 }
 
@@ -394,26 +631,14 @@ static int l_draw_new_spritesheet(lua_State* L) {
 static int l_draw_sprite_save(lua_State* L) {
 	Spritesheet* sprite = l_checksprite(L, 1);
 	const char* filename = luaL_checkstring(L, 2);
-	FIL file;
-
-	FRESULT res = f_open(&file, filename, FA_WRITE | FA_CREATE_ALWAYS);
-	if (res != FR_OK) return luaL_error(L, fs_error_strings[res]);
-	
-	res = f_write(&file, &sprite->width, sizeof(sprite->width), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-	res = f_write(&file, &sprite->height, sizeof(sprite->height), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-	res = f_write(&file, &sprite->count, sizeof(sprite->count), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-	res = f_write(&file, &sprite->mask, sizeof(sprite->mask), NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
+	bool compile = lua_toboolean(L, 3);
 
-	int bitmap_size = sprite->width * sprite->height * sprite->count * sizeof(Color);
-	res = f_write(&file, sprite->bitmap, bitmap_size, NULL);
-	if (res != FR_OK) { f_close(&file); return luaL_error(L, fs_error_strings[res]); }
-
-	f_close(&file);
+	// compiling replaces the bitmap and runs that queued blits still read
+	if (compile) lcd_sync();
+	if (compile && !draw_sprite_compile(sprite)) return luaL_error(L, "failed to allocate space for compiled sprites");
 
+	int res = draw_sprite_save(sprite, filename);
+	if (res != FR_OK) return luaL_error(L, fs_error_strings[res]);
 	return 0;
 }
 
@@ -437,7 +662,9 @@ static int l_draw_sprite_setmask(lua_State* L) {
 	Spritesheet* sprite = l_checksprite(L, 1);
 	Color color = luaL_checkinteger(L, 2);
 
+	if (sprite->compiled) return luaL_error(L, "can't change the mask of compiled sprites");
 	sprite->mask = color;
+	sprite->version++;
 	return 0;
 }
 
@@ -451,7 +678,7 @@ static int l_draw_sprite_getpixel(lua_State* L) {
 	y = y % sprite->height;
 	spriteid % sprite->count;
 
-	lua_pushinteger(L, sprite->bitmap[(x + y * sprite->width) + (spriteid * sprite->width * sprite->height)]);
+	lua_pushinteger(L, draw_sprite_get_pixel(sprite, x, y, spriteid));
 	return 1;
 }
 
@@ -462,23 +689,68 @@ static int l_draw_sprite_setpixel(lua_State* L) {
 	Color color = luaL_checkinteger(L, 4);
 	u8 spriteid = luaL_optinteger(L, 5, 0);
 
+	if (sprite->compiled) return luaL_error(L, "can't change pixels of compiled sprites");
+
 	x = x % sprite->width;
 	y = y % sprite->height;
 	spriteid % sprite->count;
 
 	sprite->bitmap[(x + y * sprite->width) + (spriteid * sprite->width * sprite->height)] = color;
+	sprite->version++;
 	return 0;
 }
 
 static int l_draw_free_spritesheet(lua_State* L) {
 	Spritesheet* sprite = l_checksprite(L, 1);
 
+	// queued blits could still point at the sheet
+	lcd_sync();
 	if(sprite->bitmap) free(sprite->bitmap);
 	sprite->bitmap = NULL;
+	free(sprite->run_index);
+	free(sprite->runs);
+	free(sprite->row_pixels);
+	sprite->run_index = NULL;
+	sprite->runs = NULL;
+	sprite->row_pixels = NULL;
 
 	return 0;
 }
 
+static int l_draw_sprite_compile(lua_State* L) {
+	Spritesheet* sprite = l_checksprite(L, 1);
+
+	// compiling replaces the bitmap and runs that queued blits still read
+	lcd_sync();
+	lua_pushboolean(L, draw_sprite_compile(sprite));
+	return 1;
+}
+
+static int l_draw_sprite_triangle(lua_State* L) {
+	Spritesheet* sprite = l_checksprite(L, 1);
+	u8 spriteid = luaL_checkinteger(L, 2);
+	i32 coords[12];
+
+	for (int i = 0; i < 12; i++) coords[i] = DRAW_FIX(luaL_checknumber(L, i + 3));
+	l_draw_list_keep(L, 1);
+	draw_triangle_textured(sprite, spriteid, coords);
+	return 0;
+}
+
+static int l_draw_sprite_blit_transformed(lua_State* L) {
+	Spritesheet* sprite = l_checksprite(L, 1);
+	i32 x = DRAW_FIX(luaL_checknumber(L, 2));
+	i32 y = DRAW_FIX(luaL_checknumber(L, 3));
+	u8 spriteid = luaL_optinteger(L, 4, 0);
+	float angle = luaL_optnumber(L, 5, 0);
+	float sx = luaL_optnumber(L, 6, 1);
+	float sy = luaL_optnumber(L, 7, sx);
+
+	l_draw_list_keep(L, 1);
+	draw_sprite_transformed(x, y, sprite, spriteid, DRAW_FIX(cosf(angle)), DRAW_FIX(sinf(angle)), DRAW_FIX(sx), DRAW_FIX(sy));
+	return 0;
+}
+
 static int l_draw_sprite_blit(lua_State* L) {
 	Spritesheet* sprite = l_checksprite(L, 1);
 	i16 x = luaL_checkinteger(L, 2);
@@ -486,11 +758,337 @@ static int l_draw_sprite_blit(lua_State* L) {
 	u8 spriteid = luaL_optinteger(L, 4, 0);
 	u8 flip = luaL_optinteger(L, 5, 0);
 
+	l_draw_list_keep(L, 1);
 	draw_sprite(x, y, sprite, spriteid, flip);
 
 	return 0;
 }
 
+static int l_draw_new_tilemap(lua_State* L) {
+	l_checksprite(L, 1);
+	int width = luaL_checkinteger(L, 2);
+	int height = luaL_checkinteger(L, 3);
+	int underlay = luaL_optinteger(L, 4, -1);
+	luaL_argcheck(L, width > 0 && width <= 0xffff, 2, "invalid width");
+	luaL_argcheck(L, height > 0 && height <= 0xffff, 3, "invalid height");
+
+	Tilemap* map = lua_newuserdata(L, sizeof(Tilemap));
+	map->width = width;
+	map->height = height;
+	map->sheet = l_checksprite(L, 1);
+	map->underlay = underlay < 0 ? -1 : underlay;
+	map->tiles = NULL;
+	map->dirty = NULL;
+	map->version = 1;
+	map->drawn_version = 0;
+	luaL_getmetatable(L, tilemap);
+	lua_setmetatable(L, -2);
+
+	// the map holds on to its sheet
+	lua_pushvalue(L, 1);
+	lua_setiuservalue(L, -2, 1);
+
+	size_t cells = (size_t)width * height;
+	map->tiles = malloc(cells * 2);
+	if (!map->tiles) return luaL_error(L, "not enough memory for a %dx%d tilemap", width, height);
+	map->dirty = map->tiles + cells;
+	memset(map->tiles, DRAW_TILE_EMPTY, cells);
+	memset(map->dirty, 0, cells);
+
+	return 1;
+}
+
+static int l_draw_tilemap_getsize(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+
+	lua_pushinteger(L, map->width);
+	lua_pushinteger(L, map->height);
+	return 2;
+}
+
+static int l_draw_tilemap_get(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+
+	if (x < 0 || y < 0 || x >= map->width || y >= map->height) return 0;
+	u8 tile = map->tiles[x + y * map->width];
+	if (tile == DRAW_TILE_EMPTY) return 0;
+	lua_pushinteger(L, tile);
+	return 1;
+}
+
+static inline void l_tilemap_set(Tilemap* map, int x, int y, u8 tile) {
+	int c = x + y * map->width;
+	if (map->tiles[c] == tile) return;
+	map->tiles[c] = tile;
+	map->dirty[c] = 1;
+}
+
+static int l_draw_tilemap_set(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+	u8 tile = luaL_optinteger(L, 4, DRAW_TILE_EMPTY);
+
+	if (x < 0 || y < 0 || x >= map->width || y >= map->height) return 0;
+	l_tilemap_set(map, x, y, tile);
+	return 0;
+}
+
+static int l_draw_tilemap_fill(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+	u8 tile = luaL_optinteger(L, 2, DRAW_TILE_EMPTY);
+	int x1 = luaL_optinteger(L, 3, 0);
+	int y1 = luaL_optinteger(L, 4, 0);
+	int x2 = x1 + luaL_optinteger(L, 5, map->width);
+	int y2 = y1 + luaL_optinteger(L, 6, map->height);
+
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 > map->width) x2 = map->width;
+	if (y2 > map->height) y2 = map->height;
+	for (int y = y1; y < y2; y++) {
+		for (int x = x1; x < x2; x++) l_tilemap_set(map, x, y, tile);
+	}
+	return 0;
+}
+
+static int l_draw_tilemap_invalidate(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+
+	if (lua_isnoneornil(L, 2)) {
+		map->version++;
+		return 0;
+	}
+
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+	if (x < 0 || y < 0 || x >= map->width || y >= map->height) return 0;
+	map->dirty[x + y * map->width] = 1;
+	return 0;
+}
+
+static int l_draw_tilemap_draw(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+	int scroll_x = luaL_optinteger(L, 4, 0);
+	int scroll_y = luaL_optinteger(L, 5, 0);
+	int width = luaL_optinteger(L, 6, map->width * map->sheet->width);
+	int height = luaL_optinteger(L, 7, map->height * map->sheet->height);
+	Color erase = luaL_optinteger(L, 8, RGB(0,0,0));
+
+	if (!map->tiles) return 0;
+	l_draw_list_keep(L, 1);
+	draw_tilemap(x, y, map, scroll_x, scroll_y, width, height, erase);
+	return 0;
+}
+
+static int l_draw_free_tilemap(lua_State* L) {
+	Tilemap* map = l_checktilemap(L, 1);
+
+	// a queued draw could still point at the cells
+	lcd_sync();
+	free(map->tiles);
+	map->tiles = NULL;
+	map->dirty = NULL;
+
+	return 0;
+}
+
+static int l_draw_new_pixelbuffer(lua_State* L) {
+	int width = luaL_checkinteger(L, 1);
+	int height = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, width > 0 && width <= 0xffff, 1, "invalid width");
+	luaL_argcheck(L, height > 0 && height <= 0xffff, 2, "invalid height");
+
+	Pixelbuffer* buffer = lua_newuserdata(L, sizeof(Pixelbuffer));
+	buffer->width = width;
+	buffer->height = height;
+	buffer->pixels = NULL;
+	luaL_getmetatable(L, pixelbuffer);
+	lua_setmetatable(L, -2);
+
+	buffer->pixels = calloc((size_t)width * height, sizeof(Color));
+	if (!buffer->pixels) return luaL_error(L, "not enough memory for a %dx%d buffer", width, height);
+
+	return 1;
+}
+
+static int l_draw_pixelbuffer_getsize(lua_State* L) {
+	Pixelbuffer* buffer = l_checkpixelbuffer(L, 1);
+
+	lua_pushinteger(L, buffer->width);
+	lua_pushinteger(L, buffer->height);
+	return 2;
+}
+
+static int l_draw_pixelbuffer_get(lua_State* L) {
+	Pixelbuffer* buffer = l_checkpixelbuffer(L, 1);
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+
+	if (x < 0 || y < 0 || x >= buffer->width || y >= buffer->height) return 0;
+	lua_pushinteger(L, buffer->pixels[x + y * buffer->width]);
+	return 1;
+}
+
+static int l_draw_pixelbuffer_set(lua_State* L) {
+	Pixelbuffer* buffer = l_checkpixelbuffer(L, 1);
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+	Color color = luaL_checkinteger(L, 4);
+
+	if (x < 0 || y < 0 || x >= buffer->width || y >= buffer->height) return 0;
+	buffer->pixels[x + y * buffer->width] = color;
+	return 0;
+}
+
+// a row is a table of colors or a string of little endian 16 bit colors,
+// pixels past the end of the row are dropped
+static int l_draw_pixelbuffer_setrow(lua_State* L) {
+	Pixelbuffer* buffer = l_checkpixelbuffer(L, 1);
+	int y = luaL_checkinteger(L, 2);
+	int x = luaL_optinteger(L, 4, 0);
+
+	size_t len;
+	const char* str = NULL;
+	if (lua_type(L, 3) == LUA_TSTRING) {
+		str = lua_tolstring(L, 3, &len);
+		len /= sizeof(Color);
+	} else {
+		luaL_checktype(L, 3, LUA_TTABLE);
+		len = luaL_len(L, 3);
+	}
+
+	if (y < 0 || y >= buffer->height || x >= buffer->width) return 0;
+	size_t skip = x < 0 ? -x : 0;
+	if (skip >= len) return 0;
+	x += skip;
+	len -= skip;
+	if (len > (size_t)(buffer->width - x)) len = buffer->width - x;
+
+	Color* row = buffer->pixels + x + y * buffer->width;
+	if (str) memcpy(row, str + skip * sizeof(Color), len * sizeof(Color));
+	else {
+		for (size_t i = 0; i < len; i++) {
+			lua_geti(L, 3, skip + i + 1);
+			row[i] = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+	return 0;
+}
+
+static int l_draw_pixelbuffer_fill(lua_State* L) {
+	Pixelbuffer* buffer = l_checkpixelbuffer(L, 1);
+	Color color = luaL_optinteger(L, 2, 0);
+	int x1 = luaL_optinteger(L, 3, 0);
+	int y1 = luaL_optinteger(L, 4, 0);
+	int x2 = x1 + luaL_optinteger(L, 5, buffer->width);
+	int y2 = y1 + luaL_optinteger(L, 6, buffer->height);
+
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 > buffer->width) x2 = buffer->width;
+	if (y2 > buffer->height) y2 = buffer->height;
+	for (int y = y1; y < y2; y++) {
+		Color* row = buffer->pixels + y * buffer->width;
+		for (int x = x1; x < x2; x++) row[x] = color;
+	}
+	return 0;
+}
+
+static int l_draw_pixelbuffer_blit(lua_State* L) {
+	Pixelbuffer* buffer = l_checkpixelbuffer(L, 1);
+	int x = luaL_checkinteger(L, 2);
+	int y = luaL_checkinteger(L, 3);
+
+	if (!buffer->pixels) return 0;
+	l_draw_list_keep(L, 1);
+	draw_pixelbuffer(x, y, buffer);
+	// core 0 reads the pixels later, don't let Lua change them before that
+	lcd_sync();
+	return 0;
+}
+
+static int l_draw_free_pixelbuffer(lua_State* L) {
+	Pixelbuffer* buffer = (Pixelbuffer*)luaL_checkudata(L, 1, pixelbuffer);
+
+	// a queued blit could still be reading the pixels
+	lcd_sync();
+	free(buffer->pixels);
+	buffer->pixels = NULL;
+
+	return 0;
+}
+
+// everything drawn until endList goes into the list instead of the screen
+static int l_draw_begin_list(lua_State* L) {
+	if (multicore_recording) return luaL_error(L, "already recording a display list");
+
+	multicore_list_t* list = lua_newuserdata(L, sizeof(multicore_list_t));
+	memset(list, 0, sizeof(multicore_list_t));
+	luaL_getmetatable(L, displaylist);
+	lua_setmetatable(L, -2);
+
+	lua_newtable(L);
+	lua_setiuservalue(L, -2, 1);
+
+	lua_pushvalue(L, -1);
+	lua_setfield(L, LUA_REGISTRYINDEX, recordinglist);
+	multicore_recording = list;
+	return 1;
+}
+
+static int l_draw_end_list(lua_State* L) {
+	if (!multicore_recording) return luaL_error(L, "not recording a display list");
+
+	multicore_list_t* list = multicore_recording;
+	multicore_recording = NULL;
+	lua_getfield(L, LUA_REGISTRYINDEX, recordinglist);
+	lua_pushnil(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, recordinglist);
+	if (list->failed) return luaL_error(L, "not enough memory for the display list");
+	return 1;
+}
+
+static int l_draw_list_submit(lua_State* L) {
+	multicore_list_t* list = l_checklist(L, 1);
+	int x = luaL_optinteger(L, 2, 0);
+	int y = luaL_optinteger(L, 3, 0);
+
+	if (list == multicore_recording) return luaL_error(L, "can't submit a display list while recording it");
+	if (list->failed) return luaL_error(L, "display list is incomplete");
+	l_draw_list_keep(L, 1);
+	draw_list(list, x, y);
+	return 0;
+}
+
+static int l_draw_list_getsize(lua_State* L) {
+	multicore_list_t* list = l_checklist(L, 1);
+
+	lua_pushinteger(L, list->count * sizeof(uint32_t));
+	return 1;
+}
+
+static int l_draw_free_list(lua_State* L) {
+	multicore_list_t* list = l_checklist(L, 1);
+
+	if (list == multicore_recording) {
+		multicore_recording = NULL;
+		lua_pushnil(L);
+		lua_setfield(L, LUA_REGISTRYINDEX, recordinglist);
+	}
+	// core 0 could still be replaying it
+	lcd_sync();
+	multicore_list_free(list);
+	list->failed = true;
+
+	return 0;
+}
+
 int luaopen_draw(lua_State *L) {
 	static const luaL_Reg drawlib_f [] = {
 		{"text", l_draw_text},
@@ -504,27 +1102,87 @@ int luaopen_draw(lua_State *L) {
 		{"polygon", l_draw_polygon},
 		{"polygonFill", l_draw_fill_polygon},
 		{"triangle", l_draw_triangle_shaded},
+		{"triangleFill", l_draw_triangle_fill},
+		{"points", l_draw_points},
+		{"lines", l_draw_lines},
+		{"rects", l_draw_rects},
+		{"rectsFill", l_draw_rects_fill},
+		{"circles", l_draw_circles},
+		{"circlesFill", l_draw_circles_fill},
 		{"enableBuffer", l_draw_buffer_enable},
 		{"blitBuffer", l_draw_buffer_blit},
+		{"present", l_draw_present},
+		{"getStats", l_draw_get_stats},
+		{"flush", l_draw_flush},
+		{"fence", l_draw_fence},
+		{"isDone", l_draw_is_done},
+		{"setPalette", l_draw_set_palette},
+		{"setClip", l_draw_set_clip},
+		{"setOrigin", l_draw_set_origin},
+		{"pushClip", l_draw_push_clip},
+		{"popClip", l_draw_pop_clip},
+		{"setBlend", l_draw_set_blend},
 		{"newSprites", l_draw_new_spritesheet},
 		{"loadSprites", l_draw_load_spritesheet},
 		{"loadBMPSprites", l_draw_load_spritesheet_bmp},
+		{"newTilemap", l_draw_new_tilemap},
+		{"newBuffer", l_draw_new_pixelbuffer},
+		{"beginList", l_draw_begin_list},
+		{"endList", l_draw_end_list},
 		{NULL, NULL}
 	};
 	
 	static const luaL_Reg drawlib_spritemeta[] = {
 		{"__index", NULL},
 		{"blit", l_draw_sprite_blit},
+		{"blitTransformed", l_draw_sprite_blit_transformed},
+		{"triangle", l_draw_sprite_triangle},
 		{"getSize", l_draw_sprite_getsize},
 		{"getPixel", l_draw_sprite_getpixel},
 		{"setPixel", l_draw_sprite_setpixel},
 		{"getMask", l_draw_sprite_getmask},
 		{"setMask", l_draw_sprite_setmask},
 		{"save", l_draw_sprite_save},
+		{"compile", l_draw_sprite_compile},
 		{"__gc", l_draw_free_spritesheet},
 		{"__close", l_draw_free_spritesheet},
 		{NULL, NULL}
 	};
+
+	static const luaL_Reg drawlib_tilemeta[] = {
+		{"__index", NULL},
+		{"draw", l_draw_tilemap_draw},
+		{"get", l_draw_tilemap_get},
+		{"set", l_draw_tilemap_set},
+		{"fill", l_draw_tilemap_fill},
+		{"invalidate", l_draw_tilemap_invalidate},
+		{"getSize", l_draw_tilemap_getsize},
+		{"__gc", l_draw_free_tilemap},
+		{"__close", l_draw_free_tilemap},
+		{NULL, NULL}
+	};
+
+	static const luaL_Reg drawlib_buffermeta[] = {
+		{"__index", NULL},
+		{"blit", l_draw_pixelbuffer_blit},
+		{"get", l_draw_pixelbuffer_get},
+		{"set", l_draw_pixelbuffer_set},
+		{"setRow", l_draw_pixelbuffer_setrow},
+		{"fill", l_draw_pixelbuffer_fill},
+		{"getSize", l_draw_pixelbuffer_getsize},
+		{"__gc", l_draw_free_pixelbuffer},
+		{"__close", l_draw_free_pixelbuffer},
+		{NULL, NULL}
+	};
+
+	static const luaL_Reg drawlib_listmeta[] = {
+		{"__index", NULL},
+		{"submit", l_draw_list_submit},
+		{"getSize", l_draw_list_getsize},
+		{"__gc", l_draw_free_list},
+		{"__close", l_draw_free_list},
+		{NULL, NULL}
+	};
 	
 	luaL_newlib(L, drawlib_f);
 
@@ -534,12 +1192,36 @@ int luaopen_draw(lua_State *L) {
 	lua_setfield(L, -2, "__index");
 	lua_setfield(L, -2, spritesheet);
 
+	luaL_newmetatable(L, tilemap);
+	luaL_setfuncs(L, drawlib_tilemeta, 0);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_setfield(L, -2, tilemap);
+
+	luaL_newmetatable(L, pixelbuffer);
+	luaL_setfuncs(L, drawlib_buffermeta, 0);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_setfield(L, -2, pixelbuffer);
+
+	luaL_newmetatable(L, displaylist);
+	luaL_setfuncs(L, drawlib_listmeta, 0);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_setfield(L, -2, displaylist);
+
 	lua_pushintegerconstant(L, "flip_horizontal", DRAW_MIRROR_H);
 	lua_pushintegerconstant(L, "flip_vertical", DRAW_MIRROR_V);
 	lua_pushintegerconstant(L, "flip_both", DRAW_MIRROR_H | DRAW_MIRROR_V);
 	lua_pushintegerconstant(L, "align_left", LCD_ALIGN_LEFT);
 	lua_pushintegerconstant(L, "align_center", LCD_ALIGN_CENTER);
 	lua_pushintegerconstant(L, "align_right", LCD_ALIGN_RIGHT);
+	lua_pushintegerconstant(L, "fill_evenodd", DRAW_FILL_EVENODD);
+	lua_pushintegerconstant(L, "fill_nonzero", DRAW_FILL_NONZERO);
+	lua_pushintegerconstant(L, "blend_none", LCD_BLEND_NONE);
+	lua_pushintegerconstant(L, "blend_alpha", LCD_BLEND_ALPHA);
+	lua_pushintegerconstant(L, "blend_add", LCD_BLEND_ADD);
+	lua_pushintegerconstant(L, "blend_multiply", LCD_BLEND_MULTIPLY);
 	
 	return 1;
 }
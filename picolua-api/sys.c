@@ -17,6 +17,8 @@
 #include "../drivers/fs.h"
 #include "../drivers/sound.h"
 #include "../drivers/lcd.h"
+#include "../drivers/multicore.h"
+#include "../drivers/workqueue.h"
 #include "../corelua.h"
 
 static int callback_reference = 0;
@@ -55,6 +57,50 @@ static int l_get_free_memory(lua_State* L) {
 	return 1;
 }
 
+static int l_get_stats(lua_State* L) {
+	lua_newtable(L);
+	lua_pushintegerconstant(L, "arenaAllocs", multicore_stats.arena_allocs);
+	lua_pushintegerconstant(L, "arenaBytes", multicore_stats.arena_bytes);
+	lua_pushintegerconstant(L, "arenaWaits", multicore_stats.arena_waits);
+	lua_pushintegerconstant(L, "heapAllocs", multicore_stats.heap_allocs);
+	lua_pushintegerconstant(L, "queueDepth", multicore_ring.head - multicore_ring.tail);
+	lua_pushintegerconstant(L, "queuePeak", multicore_stats.ring_peak);
+	lua_pushintegerconstant(L, "queueStalls", multicore_stats.ring_stalls);
+	lua_pushintegerconstant(L, "queueStallTime", multicore_stats.ring_stall_us);
+	lua_pushintegerconstant(L, "flushTime", multicore_stats.flush_us);
+	return 1;
+}
+
+// loads are over the time since the previous call. core1Load is the share
+// of that time core 1 wasn't waiting on core 0, not how busy its CPU was
+static int l_core_stats(lua_State* L) {
+	static uint64_t last_time, last_busy, last_idle, last_wait;
+	workqueue_stats_t stats;
+	workqueue_get_stats(&stats);
+	uint64_t now = time_us_64();
+	// core 1 is the only one counting its waits
+	uint64_t busy = stats.busy_us, idle = stats.idle_us, wait = multicore_stats.wait_us;
+
+	uint64_t core0 = (busy - last_busy) + (idle - last_idle);
+	uint64_t elapsed = now - last_time;
+	lua_newtable(L);
+	lua_pushintegerconstant(L, "core0Busy", busy);
+	lua_pushintegerconstant(L, "core0Idle", idle);
+	lua_pushintegerconstant(L, "core1Wait", wait);
+	lua_pushnumber(L, core0 ? (lua_Number)(busy - last_busy) / core0 : 0);
+	lua_setfield(L, -2, "core0Load");
+	lua_pushnumber(L, elapsed && wait - last_wait < elapsed ? 1 - (lua_Number)(wait - last_wait) / elapsed : 0);
+	lua_setfield(L, -2, "core1Load");
+	lua_pushintegerconstant(L, "workItems", stats.items);
+	lua_pushintegerconstant(L, "workDropped", stats.dropped);
+
+	last_time = now;
+	last_busy = busy;
+	last_idle = idle;
+	last_wait = wait;
+	return 1;
+}
+
 static int l_reset(lua_State *L) {
 	watchdog_reboot(0, 0, 0);
 	return 0;
@@ -223,6 +269,8 @@ int luaopen_sys(lua_State *L) {
 	static const luaL_Reg syslib_f [] = {
 		{"totalMemory", l_get_total_memory},
 		{"freeMemory", l_get_free_memory},
+		{"getStats", l_get_stats},
+		{"coreStats", l_core_stats},
 		{"reset", l_reset},
 		{"bootsel", l_bootsel},
 		{"setOutput", l_set_output},
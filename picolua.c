@@ -15,11 +15,13 @@
 #include "drivers/fs.h"
 #include "drivers/sound.h"
 #include "drivers/multicore.h"
+#include "drivers/workqueue.h"
 #include "picolua-api/sys.h"
 
 #include "corelua.h"
 
 int main() {
+	workqueue_init();
 	lcd_init();
 	keyboard_init();
 	stdio_picocalc_init(); 
@@ -29,19 +31,6 @@ int main() {
 
 	multicore_launch_core1(lua_main);
 
-	while (true) {
-		if (atomic_load(&fs_needs_remount) == true) {
-			if (fs_mount()) {
-				printf("\x1b[92mOK!\x1b[m\n");
-			} else {
-				printf("Failed to mount!\x1b[m\n");
-			}
-			atomic_store(&fs_needs_remount, false);
-		}
-		#if PICO_RP2040
-		//sleep_ms(10);
-		#elif PICO_RP2350
-		//busy_wait_ms(10);
-		#endif
-	}
+	// core 0 draws for core 1 and runs background work from here on
+	workqueue_run();
 }
@@ -36,7 +36,6 @@ local rocks = {}
 local score = 0
 local lives = 3
 
-local last_frame = 0
 local game_over = false
 
 local function sign(number)
@@ -210,12 +209,20 @@ function player:draw()
 	end
 end
 
+-- the life icons never change, record them once
+local icon_life = draw.beginList()
+draw_rotated(poly_ship, 0, 20, 0, 1, fg)
+draw.endList()
+local icon_lost = draw.beginList()
+draw_rotated(poly_ship, 0, 20, 0, 1, bg)
+draw.endList()
+
 local function hud_draw()
 	draw.text(15,15,"       ",fg,bg)
 	draw.text(15,15,score,fg,bg) 
 	for i = 0, 3 do
-		local color = i < lives and fg or bg
-		draw_rotated(poly_ship, width - 20 - 20*i, 20, 0, 1, color)
+		local icon = i < lives and icon_life or icon_lost
+		icon:submit(width - 20 - 20*i, 0)
 	end
 end
 
@@ -227,29 +234,24 @@ level_init()
 while true do
 	if keys.getState(keys.esc) or game_over then break end
 	
-	local now = os.clock()
-	if now >= last_frame + 0.05 then
-		last_frame = now
-		
-		-- erase
-		player:erase()
-		for _,v in pairs(shots) do v:erase() end
-		for _,v in pairs(rocks) do v:erase() end
-		
-		-- move player
-		player:update()
-		for k,v in pairs(shots) do v:update(k) end
-		for k,v in pairs(rocks) do v:update(k) end
-		
-		--draw.clear()
-		hud_draw()
-		player:draw()
-		for _,v in pairs(shots) do v:draw() end
-		for _,v in pairs(rocks) do v:draw() end
-		--draw.blitBuffer()
-		
-		collectgarbage()
-	end
+	-- erase
+	player:erase()
+	for _,v in pairs(shots) do v:erase() end
+	for _,v in pairs(rocks) do v:erase() end
+	
+	-- move player
+	player:update()
+	for k,v in pairs(shots) do v:update(k) end
+	for k,v in pairs(rocks) do v:update(k) end
+	
+	--draw.clear()
+	hud_draw()
+	player:draw()
+	for _,v in pairs(shots) do v:draw() end
+	for _,v in pairs(rocks) do v:draw() end
+	
+	collectgarbage()
+	draw.present(20)
 end
 
 draw.enableBuffer(false)
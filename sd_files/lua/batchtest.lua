@@ -0,0 +1,68 @@
+-- batch drawing speed test
+
+local count = 2000
+
+local points = {}
+for i = 1, count do
+	points[#points+1] = math.random(0,319)
+	points[#points+1] = math.random(0,319)
+	points[#points+1] = colors.fromHSV(math.random(0,255),255,255)
+end
+-- two signed coordinates and an unsigned color per point
+local packed = string.pack("<" .. string.rep("hhH", count), table.unpack(points))
+
+local rects = {}
+for i = 1, count do
+	rects[#rects+1] = math.random(0,309)
+	rects[#rects+1] = math.random(0,309)
+	rects[#rects+1] = math.random(2,10)
+	rects[#rects+1] = math.random(2,10)
+	rects[#rects+1] = colors.fromHSV(math.random(0,255),255,255)
+end
+
+local function pointsOneByOne()
+	for i = 1, #points, 3 do
+		draw.point(points[i], points[i+1], points[i+2])
+	end
+end
+
+local function pointsTable()
+	draw.points(points)
+end
+
+local function pointsString()
+	draw.points(packed)
+end
+
+local function rectsOneByOne()
+	for i = 1, #rects, 5 do
+		draw.rectFill(rects[i], rects[i+1], rects[i+2], rects[i+3], rects[i+4])
+	end
+end
+
+local function rectsTable()
+	draw.rectsFill(rects)
+end
+
+local tests = {
+	{"points, one by one", pointsOneByOne},
+	{"points, table", pointsTable},
+	{"points, string", pointsString},
+	{"rects, one by one", rectsOneByOne},
+	{"rects, table", rectsTable}
+}
+
+local results = {}
+draw.enableBuffer(2)
+for _, test in ipairs(tests) do
+	draw.clear()
+	local start = os.clock()
+	test[2]()
+	draw.blitBuffer()
+	results[#results+1] = test[1] .. ": " .. string.format("%.1f", (os.clock()-start) / count * 1000000) .. "us each"
+end
+draw.enableBuffer(false)
+
+for _, line in ipairs(results) do
+	print(line)
+end
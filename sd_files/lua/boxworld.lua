@@ -253,6 +253,15 @@ function title.draw()
 	draw.text(160, 190, "  < " .. game.level .. " >  ",fg,bg,draw.align_center)
 end
 
+-- sprite ids of the level characters
+game.tiles = {
+	["1"] = 0, -- wall
+	["2"] = 1, -- floor
+	["3"] = 4, -- floor with goal
+	["4"] = 2, -- box
+	["5"] = 3 -- box on goal
+}
+
 function game.entry()
 	-- load level
 	game.leveltable = {}
@@ -274,6 +283,15 @@ function game.entry()
 	end
 	game.draw_offset = {140 - longest/2*sprite_size, 140 - #game.leveltable/2*sprite_size}
 	game.moves = {}
+	-- floor goes under the goal tiles
+	game.map = draw.newTilemap(sprites, longest, #game.leveltable, 1)
+	for j = 1, #game.leveltable do
+		local row = game.leveltable[j]
+		for i = 1, #row do
+			game.map:set(i - 1, j - 1, game.tiles[row[i]])
+		end
+	end
+	game.drawn_pos = nil
 	collectgarbage()
 
 	draw.enableBuffer(1)
@@ -281,26 +299,20 @@ function game.entry()
 	screen.redraw = true
 end
 
+-- keeps the map in step with the level, so it only redraws what moved
+function game.set_cell(pos, what)
+	game.leveltable[pos[2]][pos[1]] = what
+	game.map:set(pos[1] - 1, pos[2] - 1, game.tiles[what])
+end
+
 function game.draw()
-	for j = 1, #game.leveltable do
-		local row = game.leveltable[j]
-		for i = 1, #row do
-			local pos = {game.draw_offset[1] + i * sprite_size, game.draw_offset[2] + j * sprite_size}
-			if row[i] == "1" then -- wall
-				sprites:blit(pos[1], pos[2], 0)
-			elseif row[i] == "2" then -- floor
-				sprites:blit(pos[1], pos[2], 1)
-			elseif row[i] == "3" then -- floor with goal
-				sprites:blit(pos[1], pos[2], 1)
-				sprites:blit(pos[1], pos[2], 4)
-			elseif row[i] == "4" then -- box
-				sprites:blit(pos[1], pos[2], 2)
-			elseif row[i] == "5" then -- box on goal
-				sprites:blit(pos[1], pos[2], 3)
-			end
-		end
-	end
-	
+	-- the map only redraws the cells that changed and the ones the player
+	-- was and is standing on
+	if game.drawn_pos then game.map:invalidate(game.drawn_pos[1] - 1, game.drawn_pos[2] - 1) end
+	game.map:invalidate(game.player_pos[1] - 1, game.player_pos[2] - 1)
+	game.drawn_pos = game.player_pos
+	game.map:draw(game.draw_offset[1] + sprite_size, game.draw_offset[2] + sprite_size)
+
 	local pos = {
 		game.draw_offset[1] + game.player_pos[1] * sprite_size,
 		game.draw_offset[2] + game.player_pos[2] * sprite_size
@@ -367,8 +379,8 @@ function game.process_push(code)
 			local box_leaves = whats_ahead == '4' and '2' or '3'
 			local box_becomes = whats_ahead2 == '2' and '4' or '5'
 			game.player_pos = ahead
-			game.leveltable[ahead[2]][ahead[1]] = box_leaves
-			game.leveltable[ahead2[2]][ahead2[1]] = box_becomes
+			game.set_cell(ahead, box_leaves)
+			game.set_cell(ahead2, box_becomes)
 			table.insert(game.moves, game.player_direction)
 			game.check_win()
 		end
@@ -401,8 +413,8 @@ function game.process_undo()
 		local what_box_became = game.leveltable[pushed[2]][pushed[1]]
 		local box_leaves = what_box_became == '4' and '2' or '3'
 		local box_becomes = game.leveltable[game.player_pos[2]][game.player_pos[1]] == '2' and '4' or '5'
-		game.leveltable[pushed[2]][pushed[1]] = box_leaves
-		game.leveltable[game.player_pos[2]][game.player_pos[1]] = box_becomes
+		game.set_cell(pushed, box_leaves)
+		game.set_cell(game.player_pos, box_becomes)
 	end
 	game.player_pos = return_to
 
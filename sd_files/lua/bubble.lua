@@ -26,10 +26,14 @@ local function fcos(i)
 	return sint[((math.floor((math.pi/2-i)*res))%#sint)+1]
 end
 
+-- x, y, color of every point, drawn in one call
+local points = {}
+
 draw.enableBuffer(2)
 while true do
 	if keys.getState(keys.esc) then break end
 	draw.clear()
+	local k = 0
 	for i = 0, n-1 do
 		for c = 0, nc-1, step do
 			u = fsin(i+y)+fsin(r*i+x)
@@ -38,13 +42,15 @@ while true do
 			y = v
 			px = u * rad + w2
 			py = y * rad + w2
-			draw.point(px, py,
-			--draw.rectFill(px, py, 2, 2,
-				colors.fromRGB(math.floor(63+i/n*192),
-					math.floor(63+c/nc*192),168))
+			points[k+1] = px
+			points[k+2] = py
+			points[k+3] = colors.fromRGB(math.floor(63+i/n*192),
+				math.floor(63+c/nc*192),168)
+			k = k + 3
 		end
 	end
+	draw.points(points)
 	t=t+0.02
-	draw.blitBuffer()
+	draw.present(30)
 end
 draw.enableBuffer(false)
@@ -0,0 +1,74 @@
+-- pixel buffer speed test
+
+local wid, hei = 320, 320
+
+local palette = {}
+for i = 0, 255 do
+	palette[i] = colors.fromHSV(i,255,255)
+end
+
+local function shade(x, y)
+	return palette[(x ~ y) & 255]
+end
+
+local function pointsOneByOne()
+	for y = 0, hei - 1 do
+		for x = 0, wid - 1 do
+			draw.point(x, y, shade(x, y))
+		end
+	end
+end
+
+local buffer = draw.newBuffer(wid, hei)
+
+local function bufferSet()
+	for y = 0, hei - 1 do
+		for x = 0, wid - 1 do
+			buffer:set(x, y, shade(x, y))
+		end
+	end
+	buffer:blit(0, 0)
+end
+
+local row = {}
+local function bufferRowTable()
+	for y = 0, hei - 1 do
+		for x = 0, wid - 1 do
+			row[x+1] = shade(x, y)
+		end
+		buffer:setRow(y, row)
+	end
+	buffer:blit(0, 0)
+end
+
+-- one unsigned color per pixel
+local format = "<" .. string.rep("H", wid)
+local function bufferRowString()
+	for y = 0, hei - 1 do
+		for x = 0, wid - 1 do
+			row[x+1] = shade(x, y)
+		end
+		buffer:setRow(y, string.pack(format, table.unpack(row)))
+	end
+	buffer:blit(0, 0)
+end
+
+local tests = {
+	{"points, one by one", pointsOneByOne},
+	{"buffer, set", bufferSet},
+	{"buffer, row tables", bufferRowTable},
+	{"buffer, row strings", bufferRowString}
+}
+
+local results = {}
+for _, test in ipairs(tests) do
+	draw.clear()
+	local start = os.clock()
+	test[2]()
+	results[#results+1] = test[1] .. ": " .. string.format("%.2f", (os.clock()-start) * 1000) .. "ms per frame"
+end
+
+draw.clear()
+for _, line in ipairs(results) do
+	print(line)
+end
@@ -42,10 +42,13 @@ local function is_control_key()
 	return false
 end
 
+local line = draw.newBuffer(wid, 1)
+
 local function drawScanlineMandelbrot(max)
 	local zr, zi, cnt, clr
 	local st = chunk
 	local proc = {}
+	local row = {}
 	local stepR = (maxX - minX) / wid
 	local stepI = (maxY - minY) / hei
 	while st >= 1 do
@@ -60,9 +63,13 @@ local function drawScanlineMandelbrot(max)
 					cnt = math.floor(cnt/max*255)
 					clr = colors.fromHSV((-cnt-32)%256,255,127+math.floor(cnt/2))
 				end
-				draw.line(x, y, x, y+st-1, clr)
+				row[x+1] = clr
 				if is_control_key() then return end
 			end
+			line:setRow(0, row)
+			for ly = y, math.min(y+st, hei) - 1 do
+				line:blit(0, ly)
+			end
 			::next::
 		end
 		proc[st%chunk] = true
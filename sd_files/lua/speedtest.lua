@@ -17,9 +17,29 @@ local function randomSprite()
 	sprites:blit(x,y,id)
 end
 
+local function randomRotatedSprite()
+	local x = math.random(-19, 339)
+	local y = math.random(-19, 339)
+	local id = math.random(0,13)
+	local angle = math.random() * math.pi * 2
+	local scale = 0.5 + math.random() * 1.5
+	sprites:blitTransformed(x,y,id,angle,scale)
+end
+
+local textColors = {colors.white, colors.yellow, colors.cyan, colors.green}
+
+local function randomText()
+	local x = math.random(0, 279)
+	local y = math.random(0, 309)
+	local fg = textColors[math.random(1, #textColors)]
+	draw.text(x, y, "Hello!", fg, colors.black)
+end
+
 local start, dur0, dur1, dur2
 local testDraw = randomCircle
 --local testDraw = randomSprite
+--local testDraw = randomRotatedSprite
+--local testDraw = randomText
 
 draw.clear()
 start = os.clock()
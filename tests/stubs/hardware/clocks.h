@@ -0,0 +1,7 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#define CLOCKS_FC0_SRC_VALUE_CLK_SYS 1
+
+static inline uint32_t frequency_count_khz(uint src) { (void)src; return 125000; }
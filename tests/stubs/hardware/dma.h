@@ -0,0 +1,34 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+// transfers into a PIO TX FIFO go to the fake panel and finish as soon as
+// they're started, see panel.c. Only byte transfers are supported
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+	uint ring_bits;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+	(void)channel;
+	return (dma_channel_config){0};
+}
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) { (void)c; (void)size; }
+static inline void channel_config_set_read_increment(dma_channel_config* c, bool incr) { (void)c; (void)incr; }
+static inline void channel_config_set_write_increment(dma_channel_config* c, bool incr) { (void)c; (void)incr; }
+static inline void channel_config_set_dreq(dma_channel_config* c, uint dreq) { (void)c; (void)dreq; }
+
+static inline void channel_config_set_ring(dma_channel_config* c, bool write, uint size_bits) {
+	(void)write;
+	c->ring_bits = size_bits;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr, const volatile void* read_addr, uint count, bool trigger);
+void dma_channel_wait_for_finish_blocking(uint channel);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#define GPIO_IN false
+#define GPIO_OUT true
+
+static inline void gpio_init(uint pin) { (void)pin; }
+static inline void gpio_set_dir(uint pin, bool out) { (void)pin; (void)out; }
+
+// the fake panel watches its CS and DC pins, see panel.c
+void gpio_put_masked(uint32_t mask, uint32_t value);
+
+static inline void gpio_put(uint pin, bool value) {
+	gpio_put_masked(1u << pin, (uint32_t)value << pin);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#define DMA_IRQ_0 11
+#define DMA_IRQ_1 12
+#define PICO_DEFAULT_IRQ_PRIORITY 0x80
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+// handlers run from host_irq_pump() once their interrupt was raised
+void irq_set_exclusive_handler(uint num, void (*handler)(void));
+void irq_add_shared_handler(uint num, void (*handler)(void), uint8_t order);
+void irq_set_enabled(uint num, bool enabled);
+static inline void irq_set_priority(uint num, uint8_t priority) { (void)num; (void)priority; }
+
+void host_irq_raise(uint num);
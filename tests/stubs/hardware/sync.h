@@ -0,0 +1,7 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+static inline void __dmb(void) { __sync_synchronize(); }
+static inline void __sev(void) {}
+static inline void __wfe(void) { sched_yield(); }
@@ -0,0 +1,84 @@
+#include <semaphore.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/irq.h"
+
+__thread uint host_core_num;
+
+// words core 1 sent to core 0, the tests only ever send doorbells
+static sem_t host_fifo;
+static bool host_fifo_ready;
+
+static void host_fifo_init(void) {
+	if (host_fifo_ready) return;
+	sem_init(&host_fifo, 0, 0);
+	host_fifo_ready = true;
+}
+
+void multicore_fifo_push_blocking_inline(uint32_t data) {
+	(void)data;
+	host_fifo_init();
+	sem_post(&host_fifo);
+}
+
+uint32_t multicore_fifo_pop_blocking_inline(void) {
+	host_fifo_init();
+	sem_wait(&host_fifo);
+	return 0;
+}
+
+bool multicore_fifo_rvalid(void) {
+	int value;
+	host_fifo_init();
+	sem_getvalue(&host_fifo, &value);
+	return value > 0;
+}
+
+void multicore_fifo_drain(void) {
+	host_fifo_init();
+	while (sem_trywait(&host_fifo) == 0);
+}
+
+// interrupts raised by the fake hardware run the next time the code busy
+// waits, the way an IRQ would cut into a wait loop on the Pico
+#define HOST_IRQ_COUNT 32
+
+static void (*host_irq_handlers[HOST_IRQ_COUNT])(void);
+static bool host_irq_enabled[HOST_IRQ_COUNT];
+static volatile uint32_t host_irq_pending;
+static bool host_irq_running;
+
+void irq_set_exclusive_handler(uint num, void (*handler)(void)) {
+	host_irq_handlers[num] = handler;
+}
+
+void irq_add_shared_handler(uint num, void (*handler)(void), uint8_t order) {
+	(void)order;
+	host_irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+	host_irq_enabled[num] = enabled;
+}
+
+void host_irq_raise(uint num) {
+	host_irq_pending |= 1u << num;
+}
+
+void host_irq_pump(void) {
+	// handlers don't nest, one raised from a handler runs after it returns
+	if (!host_irq_pending || host_irq_running) return;
+	host_irq_running = true;
+	bool ran;
+	do {
+		ran = false;
+		for (uint num = 0; num < HOST_IRQ_COUNT; num++) {
+			if (!(host_irq_pending & (1u << num)) || !host_irq_enabled[num] || !host_irq_handlers[num]) continue;
+			host_irq_pending &= ~(1u << num);
+			host_irq_handlers[num]();
+			ran = true;
+		}
+	} while (ran);
+	host_irq_running = false;
+}
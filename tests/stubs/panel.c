@@ -0,0 +1,182 @@
+#include <stdio.h>
+
+#include "panel.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "st7789_lcd.pio.h"
+#include "psram_spi.h"
+
+// pins from lcd.c
+#define PANEL_CS 13
+#define PANEL_DC 14
+
+// the same limits lcd.c works around
+#define PSRAM_WRITE_MAX 27
+#define PSRAM_READ_MAX 31
+
+host_panel_t host_panel = {.cs = true};
+host_psram_t host_psram;
+host_dma_t host_dma;
+
+static pio_hw_t host_pio[2];
+pio_hw_t* pio0 = &host_pio[0];
+pio_hw_t* pio1 = &host_pio[1];
+
+void host_panel_reset_counters(void) {
+	host_panel.commands = 0;
+	host_panel.regions = 0;
+	host_panel.pixel_bytes = 0;
+	host_panel.log_count = 0;
+	host_psram.transactions = 0;
+	host_psram.bytes = 0;
+	host_psram.oversized = 0;
+	host_dma.transfers = 0;
+	host_dma.bytes = 0;
+}
+
+uint16_t host_panel_pixel(int x, int y) {
+	return host_panel.mem[(y + host_panel.scroll) % HOST_PANEL_HEIGHT][x];
+}
+
+void gpio_put_masked(uint32_t mask, uint32_t value) {
+	if (mask & (1u << PANEL_CS)) host_panel.cs = value & (1u << PANEL_CS);
+	if (mask & (1u << PANEL_DC)) host_panel.dc = value & (1u << PANEL_DC);
+}
+
+static void panel_command(uint8_t cmd) {
+	host_panel.cmd = cmd;
+	host_panel.nargs = 0;
+	host_panel.commands++;
+	if (cmd == 0x2c) {
+		host_panel.regions++;
+		host_panel.x = host_panel.x1;
+		host_panel.y = host_panel.y1;
+		host_panel.high = -1;
+	}
+}
+
+static void panel_pixel_byte(uint8_t byte) {
+	host_panel.pixel_bytes++;
+	// pixels are big endian
+	if (host_panel.high < 0) {
+		host_panel.high = byte;
+		return;
+	}
+	uint16_t pixel = host_panel.high << 8 | byte;
+	host_panel.high = -1;
+	if (host_panel.y > host_panel.y2) {
+		fprintf(stderr, "panel: pixel written past the end of the region\n");
+		return;
+	}
+	if (host_panel.x < HOST_PANEL_WIDTH && host_panel.y < HOST_PANEL_HEIGHT) host_panel.mem[host_panel.y][host_panel.x] = pixel;
+	if (++host_panel.x > host_panel.x2) {
+		host_panel.x = host_panel.x1;
+		host_panel.y++;
+	}
+}
+
+static void panel_arg(uint8_t byte) {
+	if (host_panel.cmd == 0x2c) {
+		panel_pixel_byte(byte);
+		return;
+	}
+	if (host_panel.nargs < 8) host_panel.args[host_panel.nargs++] = byte;
+	uint8_t* a = host_panel.args;
+	if (host_panel.nargs == 4 && host_panel.cmd == 0x2a) {
+		host_panel.x1 = a[0] << 8 | a[1];
+		host_panel.x2 = a[2] << 8 | a[3];
+	} else if (host_panel.nargs == 4 && host_panel.cmd == 0x2b) {
+		host_panel.y1 = a[0] << 8 | a[1];
+		host_panel.y2 = a[2] << 8 | a[3];
+	} else if (host_panel.nargs == 2 && host_panel.cmd == 0x37) {
+		host_panel.scroll = (a[0] << 8 | a[1]) % HOST_PANEL_HEIGHT;
+	}
+}
+
+// RAMWR keeps going across CS toggles like on the real panel, lcd.c raises
+// CS after the command and lowers it again for the pixels
+static void panel_byte(uint8_t byte) {
+	if (host_panel.cs) return;
+	if (host_panel.log_count < HOST_PANEL_LOG_SIZE) host_panel.log[host_panel.log_count] = byte | host_panel.dc << 8;
+	host_panel.log_count++;
+	if (host_panel.dc) panel_arg(byte);
+	else panel_command(byte);
+}
+
+void st7789_lcd_put(PIO pio, uint sm, uint8_t x) {
+	(void)sm;
+	if (pio == pio1) panel_byte(x);
+}
+
+#define HOST_DMA_CHANNELS 12
+
+static int host_dma_claimed;
+static bool host_dma_irq1_enabled[HOST_DMA_CHANNELS];
+static bool host_dma_irq1_status[HOST_DMA_CHANNELS];
+
+int dma_claim_unused_channel(bool required) {
+	(void)required;
+	return host_dma_claimed < HOST_DMA_CHANNELS ? host_dma_claimed++ : -1;
+}
+
+// the whole transfer happens right away, its interrupt runs the next time
+// the caller busy waits
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr, const volatile void* read_addr, uint count, bool trigger) {
+	if (!trigger) return;
+	const volatile uint8_t* src = read_addr;
+	uint32_t ring = config->ring_bits ? 1u << config->ring_bits : 0;
+	bool panel = write_addr >= (volatile void*)pio1->txf && write_addr < (volatile void*)(pio1->txf + 4);
+	for (uint i = 0; i < count; i++) {
+		if (panel) panel_byte(src[ring ? i % ring : i]);
+	}
+	host_dma.transfers++;
+	host_dma.bytes += count;
+	host_dma_irq1_status[channel] = true;
+	if (host_dma_irq1_enabled[channel]) host_irq_raise(DMA_IRQ_1);
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel) {
+	(void)channel;
+	host_irq_pump();
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled) {
+	host_dma_irq1_enabled[channel] = enabled;
+	if (enabled && host_dma_irq1_status[channel]) host_irq_raise(DMA_IRQ_1);
+}
+
+bool dma_channel_get_irq1_status(uint channel) {
+	return host_dma_irq1_enabled[channel] && host_dma_irq1_status[channel];
+}
+
+void dma_channel_acknowledge_irq1(uint channel) {
+	host_dma_irq1_status[channel] = false;
+}
+
+static bool psram_check(uint32_t addr, size_t count, size_t max) {
+	host_psram.transactions++;
+	host_psram.bytes += count;
+	if (count > max) host_psram.oversized++;
+	if (addr + count > HOST_PSRAM_SIZE) {
+		fprintf(stderr, "psram: access past the end at %u\n", addr);
+		return false;
+	}
+	return true;
+}
+
+void psram_write(psram_spi_inst_t* spi, uint32_t addr, const uint8_t* src, size_t count) {
+	(void)spi;
+	if (psram_check(addr, count, PSRAM_WRITE_MAX)) memcpy(host_psram.mem + addr, src, count);
+}
+
+void psram_read(psram_spi_inst_t* spi, uint32_t addr, uint8_t* dst, size_t count) {
+	(void)spi;
+	if (psram_check(addr, count, PSRAM_READ_MAX)) memcpy(dst, host_psram.mem + addr, count);
+}
+
+void psram_write16(psram_spi_inst_t* spi, uint32_t addr, uint16_t val) {
+	uint8_t bytes[] = {val & 0xff, val >> 8};
+	psram_write(spi, addr, bytes, 2);
+}
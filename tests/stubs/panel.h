@@ -0,0 +1,55 @@
+#pragma once
+
+// fake ST7789 panel, DMA and PSRAM for running lcd.c on the host. The panel
+// decodes the bytes lcd.c sends and keeps its own copy of the panel memory
+
+#include "pico/stdlib.h"
+
+#define HOST_PANEL_WIDTH 320
+#define HOST_PANEL_HEIGHT 480
+#define HOST_PANEL_LOG_SIZE 4096
+#define HOST_PSRAM_SIZE (1024 * 1024)
+
+typedef struct {
+	uint16_t mem[HOST_PANEL_HEIGHT][HOST_PANEL_WIDTH];
+	// first memory row shown at the top of the screen
+	int scroll;
+	uint32_t commands;
+	// RAMWR commands, every region lcd.c opens
+	uint32_t regions;
+	uint32_t pixel_bytes;
+	// the first bytes sent since the last reset, data bytes have bit 8 set
+	uint16_t log[HOST_PANEL_LOG_SIZE];
+	uint32_t log_count;
+
+	// decoder state
+	bool dc, cs;
+	uint8_t cmd;
+	uint8_t args[8];
+	int nargs;
+	int x1, y1, x2, y2;
+	int x, y;
+	int high;
+} host_panel_t;
+
+typedef struct {
+	uint8_t mem[HOST_PSRAM_SIZE];
+	uint32_t transactions;
+	uint32_t bytes;
+	// transactions longer than rp2040-psram allows
+	uint32_t oversized;
+} host_psram_t;
+
+typedef struct {
+	uint32_t transfers;
+	uint32_t bytes;
+} host_dma_t;
+
+extern host_panel_t host_panel;
+extern host_psram_t host_psram;
+extern host_dma_t host_dma;
+
+// zeroes the counters and the log, the panel memory stays
+void host_panel_reset_counters(void);
+// the pixel on screen at x, y with scrolling applied
+uint16_t host_panel_pixel(int x, int y);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#define SIO_FIFO_IRQ_NUM(n) (15 + (n))
+
+// the FIFO only carries doorbells, see host.c
+void multicore_fifo_push_blocking_inline(uint32_t data);
+uint32_t multicore_fifo_pop_blocking_inline(void);
+bool multicore_fifo_rvalid(void);
+void multicore_fifo_drain(void);
+static inline void multicore_fifo_clear_irq(void) {}
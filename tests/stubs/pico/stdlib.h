@@ -0,0 +1,39 @@
+#pragma once
+
+// just enough of the SDK to build drivers on the host, core 0 and core 1
+// are played by threads
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+// which core the calling thread plays, tests set it to 1 to send or record
+// commands instead of drawing
+extern __thread uint host_core_num;
+
+static inline uint get_core_num(void) { return host_core_num; }
+
+// runs interrupts raised by the fake hardware, see host.c. Busy waits are
+// where they get a chance to run on the host
+void host_irq_pump(void);
+
+static inline void tight_loop_contents(void) {
+	host_irq_pump();
+	sched_yield();
+}
+
+static inline uint64_t time_us_64(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+
+#include "pico/time.h"
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "pico/stdlib.h"
+
+typedef struct {
+	pthread_mutex_t mutex;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t* crit) {
+	pthread_mutex_init(&crit->mutex, NULL);
+}
+
+static inline void critical_section_enter_blocking(critical_section_t* crit) {
+	pthread_mutex_lock(&crit->mutex);
+}
+
+static inline void critical_section_exit(critical_section_t* crit) {
+	pthread_mutex_unlock(&crit->mutex);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef uint64_t absolute_time_t;
+
+static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+	return (int64_t)(to - from);
+}
+
+// nothing on the host has to be waited for
+static inline void sleep_ms(uint32_t ms) { (void)ms; }
+static inline void busy_wait_us(uint64_t us) { (void)us; }
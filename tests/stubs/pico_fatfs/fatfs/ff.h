@@ -0,0 +1,62 @@
+#pragma once
+
+// FatFs on top of stdio, enough for the drivers' file code. lcd.c and fs.h
+// include it as "../pico_fatfs/fatfs/ff.h", tests/stubs/pico_fatfs is on the
+// include path so that resolves here
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef uint64_t FSIZE_t;
+
+typedef enum {
+	FR_OK = 0,
+	FR_DISK_ERR,
+	FR_INT_ERR,
+	FR_NOT_READY,
+	FR_NO_FILE,
+	FR_NO_PATH,
+	FR_INVALID_NAME,
+	FR_DENIED,
+} FRESULT;
+
+typedef struct {
+	FILE* fp;
+} FIL;
+
+#define FA_READ 0x01
+#define FA_WRITE 0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_ALWAYS 0x08
+
+static inline FRESULT f_open(FIL* fil, const char* path, BYTE mode) {
+	const char* how = (mode & FA_CREATE_ALWAYS) ? ((mode & FA_READ) ? "w+b" : "wb") : ((mode & FA_WRITE) ? "r+b" : "rb");
+	fil->fp = fopen(path, how);
+	return fil->fp ? FR_OK : FR_NO_FILE;
+}
+
+static inline FRESULT f_close(FIL* fil) {
+	if (!fil->fp) return FR_INT_ERR;
+	fclose(fil->fp);
+	fil->fp = NULL;
+	return FR_OK;
+}
+
+static inline FRESULT f_read(FIL* fil, void* buf, UINT btr, UINT* br) {
+	size_t n = fread(buf, 1, btr, fil->fp);
+	if (br) *br = n;
+	return ferror(fil->fp) ? FR_DISK_ERR : FR_OK;
+}
+
+static inline FRESULT f_write(FIL* fil, const void* buf, UINT btw, UINT* bw) {
+	size_t n = fwrite(buf, 1, btw, fil->fp);
+	if (bw) *bw = n;
+	return n == btw ? FR_OK : FR_DISK_ERR;
+}
+
+static inline FRESULT f_lseek(FIL* fil, FSIZE_t ofs) {
+	return fseek(fil->fp, (long)ofs, SEEK_SET) ? FR_DISK_ERR : FR_OK;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// the fake PSRAM of panel.c, same limits per transaction as rp2040-psram
+
+#include "hardware/pio.h"
+
+typedef struct {
+	PIO pio;
+	uint sm;
+} psram_spi_inst_t;
+
+static inline psram_spi_inst_t psram_spi_init_clkdiv(PIO pio, int sm, float clkdiv, bool fudge) {
+	(void)clkdiv; (void)fudge;
+	return (psram_spi_inst_t){pio, (uint)sm};
+}
+
+void psram_write(psram_spi_inst_t* spi, uint32_t addr, const uint8_t* src, size_t count);
+void psram_read(psram_spi_inst_t* spi, uint32_t addr, uint8_t* dst, size_t count);
+void psram_write16(psram_spi_inst_t* spi, uint32_t addr, uint16_t val);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+// bail out of the current test on the first failure, later checks would
+// only trip over the same problem
+#define REQUIRE(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+		return; \
+	} \
+} while (0)
+
+// deterministic so a failure can be replayed
+static unsigned int test_seed = 12345;
+
+static inline unsigned int test_rand(void) {
+	test_seed = test_seed * 1103515245 + 12345;
+	return (test_seed >> 16) & 0x7fff;
+}
+
+// commands carry pointers in 32 bit words, anything a command points to has
+// to live below 4GB on the host
+static inline void* test_alloc32(size_t size) {
+	size_t* p = mmap(NULL, size + sizeof(size_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+	*p = size + sizeof(size_t);
+	return p + 1;
+}
+
+static inline void test_free32(void* ptr) {
+	size_t* p = (size_t*)ptr - 1;
+	munmap(p, *p);
+}
+
+static inline int test_report(const char* name) {
+	if (test_failures) fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+	else printf("%s: ok\n", name);
+	return test_failures ? 1 : 0;
+}
@@ -0,0 +1,903 @@
+// draws into a fake screen to check the sprite and tilemap code, draw.c is
+// included to get at its static helpers
+#include <math.h>
+#include <pthread.h>
+
+#include "../drivers/draw.c"
+
+#include "test.h"
+
+static Color screen[LCD_HEIGHT][LCD_WIDTH];
+
+// clip rect in screen coordinates and the origin, like lcd.c keeps them
+typedef struct {
+	int x1, y1, x2, y2, ox, oy;
+} clip_t;
+static clip_t clip = {0, 0, LCD_WIDTH, LCD_HEIGHT, 0, 0};
+static clip_t clip_stack[16];
+static int clip_depth;
+// pixels sent outside the clip rect, draw.c should never send any
+static int strays;
+static int fills;
+// how often each pixel was written
+static u8 hits[LCD_HEIGHT][LCD_WIDTH];
+
+static void put(int x, int y, Color color) {
+	x += clip.ox;
+	y += clip.oy;
+	if (x < clip.x1 || y < clip.y1 || x >= clip.x2 || y >= clip.y2) strays++;
+	else {
+		screen[y][x] = color;
+		hits[y][x]++;
+	}
+}
+
+static void set_clip(int x1, int y1, int x2, int y2) {
+	clip = (clip_t){x1, y1, x2, y2, 0, 0};
+}
+
+static void reset_clip() {
+	set_clip(0, 0, LCD_WIDTH, LCD_HEIGHT);
+	strays = 0;
+	fills = 0;
+}
+
+void lcd_draw_local(u16* pixels, int x, int y, int width, int height) {
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) put(x + i, y + j, pixels[i + j * width]);
+	}
+}
+
+void lcd_fill_local(u16 color, int x, int y, int width, int height) {
+	fills++;
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) put(x + i, y + j, color);
+	}
+}
+
+void lcd_point_local(u16 color, int x, int y) { lcd_fill_local(color, x, y, 1, 1); }
+void lcd_clear_local() { memset(screen, 0, sizeof(screen)); }
+
+void lcd_clip_bounds(int* x1, int* y1, int* x2, int* y2) {
+	*x1 = clip.x1 - clip.ox;
+	*y1 = clip.y1 - clip.oy;
+	*x2 = clip.x2 - clip.ox;
+	*y2 = clip.y2 - clip.oy;
+}
+
+void lcd_get_origin(int* x, int* y) {
+	*x = clip.ox;
+	*y = clip.oy;
+}
+
+void lcd_set_origin_local(int x, int y) {
+	clip.ox = x;
+	clip.oy = y;
+}
+
+void lcd_set_clip_local(int x, int y, int width, int height) {
+	clip.x1 = clip.ox + x;
+	clip.y1 = clip.oy + y;
+	clip.x2 = clip.x1 + width;
+	clip.y2 = clip.y1 + height;
+}
+
+void lcd_push_clip_local() { clip_stack[clip_depth++] = clip; }
+void lcd_pop_clip_local() { clip = clip_stack[--clip_depth]; }
+void lcd_scroll_local(int lines) {}
+
+// whether lcd_move_local can read the screen back, like a buffered mode
+static bool movable = true;
+
+bool lcd_move_local(int x, int y, int width, int height, int dx, int dy) {
+	static Color old[LCD_HEIGHT][LCD_WIDTH];
+	if (!movable) return false;
+	memcpy(old, screen, sizeof(screen));
+	x += clip.ox;
+	y += clip.oy;
+	int x1 = x > clip.x1 ? x : clip.x1, y1 = y > clip.y1 ? y : clip.y1;
+	int x2 = x + width < clip.x2 ? x + width : clip.x2, y2 = y + height < clip.y2 ? y + height : clip.y2;
+	for (int j = y1; j < y2; j++) {
+		for (int i = x1; i < x2; i++) {
+			if (i - dx >= x1 && i - dx < x2 && j - dy >= y1 && j - dy < y2) screen[j][i] = old[j - dy][i - dx];
+		}
+	}
+	return true;
+}
+
+int lcd_fifo_receiver(uint32_t message) {
+	if (message != FIFO_LCD_FENCE) return 0;
+	multicore_fence_done = multicore_cmd_pop();
+	return 1;
+}
+
+static volatile bool core0_stop;
+
+// runs what tests send as core 1
+static void* core0(void* arg) {
+	while (!core0_stop) {
+		if (!multicore_service(64)) multicore_fifo_pop_blocking_inline();
+	}
+	return NULL;
+}
+
+#define MASK 0xf81f
+
+// about a third of the pixels are masked, some rows are fully masked or opaque
+static Spritesheet* new_sheet(int width, int height, int count) {
+	Spritesheet* sheet = test_alloc32(sizeof(Spritesheet));
+	sheet->width = width;
+	sheet->height = height;
+	sheet->count = count;
+	sheet->mask = MASK;
+	sheet->bitmap = malloc(width * height * count * sizeof(Color));
+	for (int r = 0; r < height * count; r++) {
+		int kind = test_rand() % 8;
+		for (int x = 0; x < width; x++) {
+			Color c = 1 + test_rand() % 0xf000;
+			if (kind == 0 || (kind > 1 && test_rand() % 3 == 0)) c = MASK;
+			sheet->bitmap[x + r * width] = c;
+		}
+	}
+	return sheet;
+}
+
+static void free_sheet(Spritesheet* sheet) {
+	free(sheet->bitmap);
+	free(sheet->run_index);
+	free(sheet->runs);
+	free(sheet->row_pixels);
+	test_free32(sheet);
+}
+
+// runs have to cover exactly the opaque pixels, left to right, and be as
+// long as they can
+static void check_runs(Spritesheet* sheet, Color* bitmap, u32* run_index, u16* runs) {
+	int rows = sheet->count * sheet->height;
+	CHECK(run_index[0] == 0);
+	for (int r = 0; r < rows; r++) {
+		REQUIRE(run_index[r] <= run_index[r + 1]);
+		Color* row = bitmap + r * sheet->width;
+		int x = 0;
+		for (u32 k = run_index[r]; k < run_index[r + 1]; k++) {
+			int start = runs[k * 2], len = runs[k * 2 + 1];
+			REQUIRE(len > 0 && start >= x && start + len <= sheet->width);
+			// the run before this one ended on a masked pixel
+			CHECK(k == run_index[r] || start > x);
+			for (; x < start; x++) CHECK(row[x] == sheet->mask);
+			for (; x < start + len; x++) CHECK(row[x] != sheet->mask);
+		}
+		for (; x < sheet->width; x++) CHECK(row[x] == sheet->mask);
+	}
+}
+
+static void test_build_runs(int width, int height, int count) {
+	Spritesheet* sheet = new_sheet(width, height, count);
+	u32* run_index;
+	u16* runs;
+	REQUIRE(draw_sprite_build_runs(sheet, &run_index, &runs));
+	check_runs(sheet, sheet->bitmap, run_index, runs);
+	free(run_index);
+	free(runs);
+	free_sheet(sheet);
+}
+
+// blits rebuild the runs after Lua changes the bitmap and bumps the version
+static void test_runs_version() {
+	Spritesheet* sheet = new_sheet(16, 16, 2);
+	REQUIRE(draw_sprite_runs(sheet));
+	check_runs(sheet, sheet->bitmap, sheet->run_index, sheet->runs);
+
+	for (int i = 0; i < 16 * 16 * 2; i += 7) sheet->bitmap[i] = sheet->bitmap[i] == MASK ? 1 : MASK;
+	sheet->version++;
+	REQUIRE(draw_sprite_runs(sheet));
+	CHECK(sheet->runs_version == sheet->version);
+	check_runs(sheet, sheet->bitmap, sheet->run_index, sheet->runs);
+	free_sheet(sheet);
+}
+
+// a compiled sheet only keeps the opaque pixels but reads back the same
+static void test_compile(int width, int height, int count) {
+	Spritesheet* sheet = new_sheet(width, height, count);
+	size_t size = width * height * count * sizeof(Color);
+	Color* original = malloc(size);
+	memcpy(original, sheet->bitmap, size);
+
+	REQUIRE(draw_sprite_runs(sheet));
+	REQUIRE(draw_sprite_compile(sheet));
+	CHECK(sheet->compiled);
+	check_runs(sheet, original, sheet->run_index, sheet->runs);
+	for (int s = 0; s < count; s++) {
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				CHECK(draw_sprite_get_pixel(sheet, x, y, s) == original[x + (y + s * height) * width]);
+			}
+		}
+	}
+	free(original);
+	free_sheet(sheet);
+}
+
+#define TILE 4
+#define TILE_RED 0xf800
+#define TILE_BLUE 0x001f
+#define TILE_GREEN 0x07e0
+
+// tile 0 is solid red, 1 is blue with a see-through left half, 2 is green
+static Spritesheet* new_tiles() {
+	Spritesheet* sheet = test_alloc32(sizeof(Spritesheet));
+	sheet->width = sheet->height = TILE;
+	sheet->count = 3;
+	sheet->mask = MASK;
+	sheet->bitmap = malloc(TILE * TILE * 3 * sizeof(Color));
+	for (int y = 0; y < TILE; y++) {
+		for (int x = 0; x < TILE; x++) {
+			sheet->bitmap[x + y * TILE] = TILE_RED;
+			sheet->bitmap[x + (y + TILE) * TILE] = x < TILE / 2 ? MASK : TILE_BLUE;
+			sheet->bitmap[x + (y + 2 * TILE) * TILE] = TILE_GREEN;
+		}
+	}
+	return sheet;
+}
+
+static Tilemap* new_map(Spritesheet* sheet, int width, int height, int underlay) {
+	Tilemap* map = test_alloc32(sizeof(Tilemap));
+	map->width = width;
+	map->height = height;
+	map->sheet = sheet;
+	map->underlay = underlay;
+	map->version = 1;
+	map->tiles = malloc(width * height * 2);
+	map->dirty = map->tiles + width * height;
+	memset(map->tiles, DRAW_TILE_EMPTY, width * height);
+	memset(map->dirty, 0, width * height);
+	return map;
+}
+
+// the whole map at 0, 0
+static void draw_map(Tilemap* map) {
+	draw_tilemap_local(0, 0, map, 0, 0, map->width * TILE, map->height * TILE, 0);
+}
+
+static void set_tile(Tilemap* map, int x, int y, u8 tile) {
+	map->tiles[x + y * map->width] = tile;
+	map->dirty[x + y * map->width] = 1;
+}
+
+// whether the left and right halves of a cell of a map drawn at 0, 0 match
+static bool cell_is(int cx, int cy, Color left, Color right) {
+	for (int y = 0; y < TILE; y++) {
+		for (int x = 0; x < TILE; x++) {
+			Color want = x < TILE / 2 ? left : right;
+			if (screen[cy * TILE + y][cx * TILE + x] != want) return false;
+		}
+	}
+	return true;
+}
+
+// cells that change between draws can't keep any of the old tile
+static void test_tilemap_redraw() {
+	Spritesheet* sheet = new_tiles();
+	Tilemap* map = new_map(sheet, 3, 1, -1);
+	lcd_fill_local(TILE_GREEN, 0, 0, LCD_WIDTH, LCD_HEIGHT);
+
+	set_tile(map, 0, 0, 0);
+	set_tile(map, 1, 0, 0);
+	draw_map(map);
+	CHECK(cell_is(0, 0, TILE_RED, TILE_RED));
+	CHECK(cell_is(1, 0, TILE_RED, TILE_RED));
+	// empty cells are left alone by a full draw
+	CHECK(cell_is(2, 0, TILE_GREEN, TILE_GREEN));
+
+	set_tile(map, 0, 0, DRAW_TILE_EMPTY);
+	set_tile(map, 1, 0, 1);
+	draw_map(map);
+	CHECK(cell_is(0, 0, 0, 0));
+	CHECK(cell_is(1, 0, 0, TILE_BLUE));
+	CHECK(cell_is(2, 0, TILE_GREEN, TILE_GREEN));
+
+	// nothing changed, nothing is drawn
+	lcd_fill_local(TILE_RED, 0, 0, TILE, TILE);
+	draw_map(map);
+	CHECK(cell_is(0, 0, TILE_RED, TILE_RED));
+
+	free(map->tiles);
+	test_free32(map);
+
+	// the underlay shows through the see-through half instead
+	map = new_map(sheet, 2, 1, 2);
+	set_tile(map, 0, 0, 0);
+	set_tile(map, 1, 0, 0);
+	draw_map(map);
+	set_tile(map, 0, 0, 1);
+	set_tile(map, 1, 0, DRAW_TILE_EMPTY);
+	draw_map(map);
+	CHECK(cell_is(0, 0, TILE_GREEN, TILE_BLUE));
+	CHECK(cell_is(1, 0, 0, 0));
+
+	free(map->tiles);
+	test_free32(map);
+	free_sheet(sheet);
+}
+
+#define ERASE 0x1234
+
+// pixel of the map at x, y as drawn over a screen of the erase colour
+static Color map_pixel(Tilemap* map, int x, int y) {
+	if (x < 0 || y < 0 || x >= map->width * TILE || y >= map->height * TILE) return ERASE;
+	u8 tile = map->tiles[x / TILE + y / TILE * map->width];
+	if (tile == DRAW_TILE_EMPTY) return ERASE;
+	Color c = map->sheet->bitmap[x % TILE + (y % TILE + tile * TILE) * TILE];
+	if (c != MASK) return c;
+	if (map->underlay < 0 || map->underlay == tile) return ERASE;
+	return map->sheet->bitmap[x % TILE + (y % TILE + map->underlay * TILE) * TILE];
+}
+
+// a map scrolled around a viewport, past its edges and with cells changing
+// in between, matches the map drawn from scratch, and small scroll steps
+// only draw what they uncover
+static void test_tilemap_scroll(int underlay, bool can_move) {
+	enum { VX = 10, VY = 8, VW = 50, VH = 35 };
+	Spritesheet* sheet = new_tiles();
+	Tilemap* map = new_map(sheet, 30, 20, underlay);
+	for (int i = 0; i < 30 * 20; i++) set_tile(map, i % 30, i / 30, test_rand() % 5 == 4 ? DRAW_TILE_EMPTY : test_rand() % 3);
+	movable = can_move;
+	reset_clip();
+	lcd_fill_local(ERASE, 0, 0, LCD_WIDTH, LCD_HEIGHT);
+
+	int sx = 0, sy = 0, wrong = 0, most = 0;
+	for (int step = 0; step < 300; step++) {
+		if (step % 3 == 0) set_tile(map, test_rand() % 30, test_rand() % 20, test_rand() % 4 == 3 ? DRAW_TILE_EMPTY : test_rand() % 3);
+		if (step % 50 == 49) {
+			// jumps further than the viewport and back
+			sx += test_rand() % 2 ? 60 : -60;
+		} else {
+			sx += test_rand() % 7 - 3;
+			sy += test_rand() % 5 - 2;
+		}
+		if (sx < -20) sx = -20;
+		if (sx > 100) sx = 100;
+		if (sy < -20) sy = -20;
+		if (sy > 60) sy = 60;
+
+		memset(hits, 0, sizeof(hits));
+		draw_tilemap_local(VX, VY, map, sx, sy, VW, VH, ERASE);
+		int drawn = 0;
+		for (int y = 0; y < LCD_HEIGHT; y++) {
+			for (int x = 0; x < LCD_WIDTH; x++) {
+				bool inside = x >= VX && y >= VY && x < VX + VW && y < VY + VH;
+				if (screen[y][x] != (inside ? map_pixel(map, x - VX + sx, y - VY + sy) : ERASE)) wrong++;
+				drawn += hits[y][x] != 0;
+			}
+		}
+		if (step % 50 != 49 && step > 0 && drawn > most) most = drawn;
+	}
+	CHECK(wrong == 0);
+	CHECK(strays == 0);
+	// three columns and two rows of tiles at most, plus one changed cell
+	if (can_move) CHECK(most <= (3 + TILE) * VH + (2 + TILE) * VW + TILE * TILE);
+	else CHECK(most > VW * VH / 2);
+
+	movable = true;
+	free(map->tiles);
+	test_free32(map);
+	free_sheet(sheet);
+}
+
+static Color expected[LCD_HEIGHT][LCD_WIDTH];
+
+// a sprite, a map, a pixel buffer and a fill on top of each other
+static void draw_scene(Spritesheet* sheet, Tilemap* map, Pixelbuffer* buffer) {
+	draw_fill_rect(2, 3, 40, 20, TILE_GREEN);
+	draw_tilemap(10, 10, map, 0, 0, map->width * TILE, map->height * TILE, 0);
+	draw_sprite(30, 5, sheet, 1, DRAW_MIRROR_H);
+	draw_pixelbuffer(50, 12, buffer);
+}
+
+// a recorded list replays to the same pixels as drawing directly, and keeps
+// replaying safely once the objects it points to are closed
+static void test_list_replay() {
+	Spritesheet* sheet = new_tiles();
+	Tilemap* map = new_map(sheet, 4, 3, -1);
+	for (int i = 0; i < 4 * 3; i++) set_tile(map, i % 4, i / 4, i % 4 == 3 ? DRAW_TILE_EMPTY : i % 3);
+	Pixelbuffer* buffer = test_alloc32(sizeof(Pixelbuffer));
+	buffer->width = 7;
+	buffer->height = 5;
+	buffer->pixels = malloc(7 * 5 * sizeof(Color));
+	for (int i = 0; i < 7 * 5; i++) buffer->pixels[i] = 0x1000 + i;
+
+	lcd_clear_local();
+	draw_scene(sheet, map, buffer);
+	memcpy(expected, screen, sizeof(screen));
+
+	multicore_list_t* list = test_alloc32(sizeof(multicore_list_t));
+	host_core_num = 1;
+	multicore_recording = list;
+	draw_scene(sheet, map, buffer);
+	multicore_recording = NULL;
+	host_core_num = 0;
+	REQUIRE(!list->failed && list->count > 0);
+	CHECK(multicore_ring.head == multicore_ring.tail);
+
+	lcd_clear_local();
+	map->version++;
+	draw_list_local(list, 0, 0);
+	CHECK(memcmp(screen, expected, sizeof(screen)) == 0);
+
+	// what closing them from Lua does, replay skips what was closed
+	free(map->tiles);
+	map->tiles = map->dirty = NULL;
+	free(buffer->pixels);
+	buffer->pixels = NULL;
+	lcd_clear_local();
+	draw_fill_rect_local(2, 3, 40, 20, TILE_GREEN);
+	draw_sprite_local(30, 5, sheet, 1, DRAW_MIRROR_H);
+	memcpy(expected, screen, sizeof(screen));
+	lcd_clear_local();
+	draw_list_local(list, 0, 0);
+	CHECK(memcmp(screen, expected, sizeof(screen)) == 0);
+
+	free(sheet->bitmap);
+	sheet->bitmap = NULL;
+	lcd_clear_local();
+	draw_fill_rect_local(2, 3, 40, 20, TILE_GREEN);
+	memcpy(expected, screen, sizeof(screen));
+	lcd_clear_local();
+	draw_list_local(list, 0, 0);
+	CHECK(memcmp(screen, expected, sizeof(screen)) == 0);
+
+	multicore_list_free(list);
+	test_free32(list);
+	test_free32(buffer);
+	test_free32(map);
+	free_sheet(sheet);
+}
+
+// blits sent from core 1 land where they should, and once lcd_sync returns
+// core 0 is done with the pixels, which is what freeing a buffer relies on
+static void test_pixelbuffer_blit() {
+	static const int at[][2] = {{0, 0}, {100, 50}, {-3, 10}, {LCD_WIDTH - 4, LCD_HEIGHT - 2}, {20, -6}};
+	Pixelbuffer* buffer = test_alloc32(sizeof(Pixelbuffer));
+	buffer->width = 9;
+	buffer->height = 7;
+	buffer->pixels = malloc(9 * 7 * sizeof(Color));
+	for (int i = 0; i < 9 * 7; i++) buffer->pixels[i] = 0x2000 + i * 3;
+
+	memset(expected, 0, sizeof(expected));
+	for (int n = 0; n < 5; n++) {
+		for (int j = 0; j < 7; j++) {
+			for (int i = 0; i < 9; i++) {
+				int x = at[n][0] + i, y = at[n][1] + j;
+				if (x >= 0 && x < LCD_WIDTH && y >= 0 && y < LCD_HEIGHT) expected[y][x] = 0x2000 + (i + j * 9) * 3;
+			}
+		}
+	}
+
+	lcd_clear_local();
+	host_core_num = 1;
+	for (int n = 0; n < 5; n++) draw_pixelbuffer(at[n][0], at[n][1], buffer);
+	// what Pixelbuffer:__close does
+	lcd_sync();
+	memset(buffer->pixels, 0xff, 9 * 7 * sizeof(Color));
+	free(buffer->pixels);
+	buffer->pixels = NULL;
+	host_core_num = 0;
+
+	CHECK(memcmp(screen, expected, sizeof(screen)) == 0);
+	test_free32(buffer);
+}
+
+// the pixels of a line, stepped along its long axis with the short one
+// rounded, cut to the clip rect
+static void reference_line(int x0, int y0, int x1, int y1, Color color) {
+	bool steep = abs(y1 - y0) > abs(x1 - x0);
+	int da = steep ? abs(y1 - y0) : abs(x1 - x0), db = steep ? abs(x1 - x0) : abs(y1 - y0);
+	for (int k = 0; k <= da; k++) {
+		int a = (steep ? y0 : x0) + (steep ? (y1 > y0 ? k : -k) : (x1 > x0 ? k : -k));
+		int b = da ? (int)(((int64_t)2 * k * db + da) / (2 * da)) : 0;
+		b = (steep ? x0 : y0) + ((steep ? x1 > x0 : y1 > y0) ? b : -b);
+		int x = steep ? b : a, y = steep ? a : b;
+		if (x >= clip.x1 && y >= clip.y1 && x < clip.x2 && y < clip.y2) expected[y][x] = color;
+	}
+}
+
+static int line_end(bool far) {
+	return far ? (int)(test_rand() % 6000) - 3000 : (int)(test_rand() % (LCD_WIDTH + 80)) - 40;
+}
+
+// clipped lines have to hit exactly the pixels of the whole line that are
+// inside the clip, without sending anything outside it
+static void test_line_clipping() {
+	int wrong = 0;
+	for (int i = 0; i < 3000; i++) {
+		bool far = i % 3 == 0;
+		int x0 = line_end(far), y0 = line_end(far), x1 = line_end(far), y1 = line_end(far);
+		if (i % 7 == 1) y1 = y0;
+		if (i % 7 == 2) x1 = x0;
+		if (i % 7 == 3) y1 = y0 + (x1 - x0);
+
+		reset_clip();
+		if (i % 4) {
+			int cx = test_rand() % LCD_WIDTH, cy = test_rand() % LCD_HEIGHT;
+			set_clip(cx, cy, cx + 1 + test_rand() % (LCD_WIDTH - cx), cy + 1 + test_rand() % (LCD_HEIGHT - cy));
+		}
+		memset(screen, 0, sizeof(screen));
+		memset(expected, 0, sizeof(expected));
+		draw_line_local(x0, y0, x1, y1, 0xffff);
+		reference_line(x0, y0, x1, y1, 0xffff);
+		if (memcmp(screen, expected, sizeof(screen)) || strays) wrong++;
+	}
+	CHECK(wrong == 0);
+
+	// rows of a shallow line and axis aligned lines go out as single fills
+	reset_clip();
+	draw_line_local(0, 0, 300, 10, 0xffff);
+	CHECK(fills == 11);
+	fills = 0;
+	draw_line_local(5, 400, 5, -100, 0xffff);
+	draw_line_local(-100, 7, 500, 7, 0xffff);
+	CHECK(fills == 2 && strays == 0);
+	reset_clip();
+}
+
+// a mesh of triangles over a rect, with the inner vertices moved off the
+// pixel grid but every cell kept convex, must write every pixel of the rect
+// exactly once
+static void test_triangle_coverage() {
+	enum { COLS = 8, ROWS = 6, CELL_W = 28, CELL_H = 30, LEFT = 16, TOP = 16 };
+	static i32 vx[COLS + 1][ROWS + 1], vy[COLS + 1][ROWS + 1];
+	int wrong = 0;
+	for (int round = 0; round < 40; round++) {
+		// half pixel steps put edges right through pixel centers
+		i32 unit = round % 4 < 2 ? 1024 : 0x8000;
+		for (int i = 0; i <= COLS; i++) {
+			for (int j = 0; j <= ROWS; j++) {
+				vx[i][j] = (LEFT + i * CELL_W) << 16;
+				vy[i][j] = (TOP + j * CELL_H) << 16;
+				if (i > 0 && i < COLS) vx[i][j] += (i32)(test_rand() % ((12 << 16) / unit)) * unit - (6 << 16);
+				if (j > 0 && j < ROWS) vy[i][j] += (i32)(test_rand() % ((12 << 16) / unit)) * unit - (6 << 16);
+			}
+		}
+
+		reset_clip();
+		if (round & 1) set_clip(40 + round, 30, 200, 120 + round);
+		memset(hits, 0, sizeof(hits));
+		for (int i = 0; i < COLS; i++) {
+			for (int j = 0; j < ROWS; j++) {
+				// either diagonal, corners in any order, flat and shaded
+				int tri[2][3][2];
+				if (test_rand() & 1) {
+					int t[2][3][2] = {{{i, j}, {i + 1, j}, {i + 1, j + 1}}, {{i, j}, {i + 1, j + 1}, {i, j + 1}}};
+					memcpy(tri, t, sizeof(tri));
+				} else {
+					int t[2][3][2] = {{{i, j}, {i + 1, j}, {i, j + 1}}, {{i + 1, j}, {i + 1, j + 1}, {i, j + 1}}};
+					memcpy(tri, t, sizeof(tri));
+				}
+				for (int n = 0; n < 2; n++) {
+					int r = test_rand() % 3;
+					i32 x[3], y[3];
+					for (int k = 0; k < 3; k++) {
+						x[k] = vx[tri[n][(k + r) % 3][0]][tri[n][(k + r) % 3][1]];
+						y[k] = vy[tri[n][(k + r) % 3][0]][tri[n][(k + r) % 3][1]];
+					}
+					if (test_rand() & 1) draw_triangle_local(x[0], y[0], x[1], y[1], x[2], y[2], 0xffff);
+					else draw_triangle_shaded_local(0xf800, x[0], y[0], 0x07e0, x[1], y[1], 0x001f, x[2], y[2]);
+				}
+			}
+		}
+
+		for (int y = 0; y < LCD_HEIGHT; y++) {
+			for (int x = 0; x < LCD_WIDTH; x++) {
+				bool inside = x >= LEFT && y >= TOP && x < LEFT + COLS * CELL_W && y < TOP + ROWS * CELL_H &&
+					x >= clip.x1 && y >= clip.y1 && x < clip.x2 && y < clip.y2;
+				if (hits[y][x] != inside) wrong++;
+			}
+		}
+		wrong += strays;
+	}
+	CHECK(wrong == 0);
+	reset_clip();
+}
+
+// whether a pixel center is inside the polygon, by the crossings of the
+// edges at or left of it, or -1 when an edge passes too close to call
+static int reference_inside(int n, const float* points, u8 rule, int x, int y) {
+	double cx = x + 0.5, cy = y + 0.5;
+	int crossings = 0, winding = 0;
+	for (int i = 0, j = n - 1; i < n; j = i++) {
+		double xa = DRAW_FIX(points[j * 2]) / 65536.0, ya = DRAW_FIX(points[j * 2 + 1]) / 65536.0;
+		double xb = DRAW_FIX(points[i * 2]) / 65536.0, yb = DRAW_FIX(points[i * 2 + 1]) / 65536.0;
+		int dir = yb > ya ? 1 : -1;
+		if (yb < ya) {
+			double t = xa; xa = xb; xb = t;
+			t = ya; ya = yb; yb = t;
+		}
+		if (cy < ya || cy >= yb) continue;
+		double xi = xa + (cy - ya) * (xb - xa) / (yb - ya);
+		if (fabs(xi - cx) < 0.01) return -1;
+		if (xi <= cx) {
+			crossings++;
+			winding += dir;
+		}
+	}
+	return rule == DRAW_FILL_NONZERO ? winding != 0 : crossings & 1;
+}
+
+static int polygon_wrong(int n, float* points, u8 rule) {
+	memset(screen, 0, sizeof(screen));
+	strays = 0;
+	draw_fill_polygon_local(n * 2, points, 0xffff, rule);
+	int wrong = strays;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			int inside = reference_inside(n, points, rule, x, y);
+			if (x < clip.x1 || y < clip.y1 || x >= clip.x2 || y >= clip.y2) inside = 0;
+			if (inside >= 0 && (screen[y][x] != 0) != inside) wrong++;
+		}
+	}
+	return wrong;
+}
+
+static float polygon_coord(int range) {
+	return (int)(test_rand() % (range * 64)) / 64.0f - (range - LCD_WIDTH) / 2;
+}
+
+// convex, concave and self intersecting polygons, some reaching far off
+// screen, filled with both rules inside and outside a clip rect
+static void test_polygon_fill() {
+	static float points[64 * 2];
+	int wrong = 0;
+	for (int round = 0; round < 40; round++) {
+		int kind = round % 3, n = 3 + test_rand() % 30;
+		float mx = 40 + test_rand() % 240, my = 40 + test_rand() % 240;
+		float r = 20 + test_rand() % (round % 5 == 4 ? 600 : 150);
+		for (int i = 0; i < n; i++) {
+			if (kind == 2) {
+				// random points in random order cross each other
+				points[i * 2] = polygon_coord(round % 5 == 4 ? 1000 : LCD_WIDTH);
+				points[i * 2 + 1] = polygon_coord(round % 5 == 4 ? 1000 : LCD_WIDTH);
+				continue;
+			}
+			// around a center, convex at a fixed radius and concave when it varies
+			float a = 6.2831853f * i / n, d = kind == 0 ? r : r * (0.3f + (test_rand() % 70) / 100.0f);
+			points[i * 2] = (int)((mx + d * cosf(a)) * 64) / 64.0f;
+			points[i * 2 + 1] = (int)((my + d * sinf(a)) * 64) / 64.0f;
+		}
+
+		reset_clip();
+		if (round & 1) set_clip(30 + round, 50, 250, 200 + round);
+		wrong += polygon_wrong(n, points, DRAW_FILL_EVENODD);
+		wrong += polygon_wrong(n, points, DRAW_FILL_NONZERO);
+	}
+
+	// a pentagram only differs between the rules in its middle
+	float star[] = {160.3f, 20.1f, 250.7f, 290.2f, 20.4f, 120.6f, 300.2f, 120.9f, 70.8f, 290.5f};
+	reset_clip();
+	wrong += polygon_wrong(5, star, DRAW_FILL_EVENODD);
+	CHECK(screen[150][160] == 0);
+	wrong += polygon_wrong(5, star, DRAW_FILL_NONZERO);
+	CHECK(screen[150][160] != 0);
+	CHECK(wrong == 0);
+	reset_clip();
+}
+
+// the sprite pixel under each destination pixel center, worked out in
+// double precision, pixels too close to a texel edge to call are skipped
+static int rotozoom_wrong(Spritesheet* sheet, Color* texels, int id, i32 x, i32 y, i32 cos, i32 sin, i32 sx, i32 sy) {
+	memset(screen, 0, sizeof(screen));
+	strays = 0;
+	draw_sprite_transformed_local(x, y, sheet, id, cos, sin, sx, sy);
+	int wrong = strays;
+	double c = cos / 65536.0, s = sin / 65536.0, kx = sx / 65536.0, ky = sy / 65536.0;
+	for (int py = 0; py < LCD_HEIGHT; py++) {
+		for (int px = 0; px < LCD_WIDTH; px++) {
+			double dx = px + 0.5 - x / 65536.0, dy = py + 0.5 - y / 65536.0;
+			double u = (c * dx + s * dy) / kx + sheet->width / 2.0;
+			double v = (-s * dx + c * dy) / ky + sheet->height / 2.0;
+			double fu = u - floor(u), fv = v - floor(v);
+			if (fu < 0.01 || fu > 0.99 || fv < 0.01 || fv > 0.99) continue;
+			Color expect = 0;
+			if (u >= 0 && v >= 0 && u < sheet->width && v < sheet->height) {
+				Color t = texels[(int)u + (int)v * sheet->width];
+				if (t != MASK) expect = t;
+			}
+			if (px < clip.x1 || py < clip.y1 || px >= clip.x2 || py >= clip.y2) expect = 0;
+			if (screen[py][px] != expect) wrong++;
+		}
+	}
+	return wrong;
+}
+
+// rotated, scaled and mirrored sprites from plain and compiled sheets
+// against a nearest neighbour reference
+static void test_rotozoom() {
+	int wrong = 0, drawn = 0;
+	for (int round = 0; round < 60; round++) {
+		int width = 1 + test_rand() % 24, height = 1 + test_rand() % 24, count = 1 + test_rand() % 3;
+		Spritesheet* sheet = new_sheet(width, height, count);
+		int id = test_rand() % 256;
+		size_t size = width * height * count * sizeof(Color);
+		Color* original = malloc(size);
+		memcpy(original, sheet->bitmap, size);
+		if (round & 1) REQUIRE(draw_sprite_compile(sheet));
+
+		double angle = (test_rand() % 3600) / 3600.0 * 6.2831853;
+		if (round % 8 == 0) angle = (round / 8 % 4) * 1.5707963;
+		i32 cos = lround(cosf(angle) * 65536), sin = lround(sinf(angle) * 65536);
+		// scales from 1/4 to 4 in steps of 1/16
+		i32 sx = (i32)(4 + test_rand() % 61) << 12, sy = (i32)(4 + test_rand() % 61) << 12;
+		if (test_rand() & 1) sx = -sx;
+		if (test_rand() & 1) sy = -sy;
+		i32 x = (i32)(test_rand() % (LCD_WIDTH + 100)) * 0x10000 - 50 * 0x10000 + (test_rand() & 0xffff);
+		i32 y = (i32)(test_rand() % (LCD_HEIGHT + 100)) * 0x10000 - 50 * 0x10000 + (test_rand() & 0xffff);
+
+		reset_clip();
+		if (round % 3 == 1) set_clip(20 + round, 40, 280, 230);
+		wrong += rotozoom_wrong(sheet, original + id % count * width * height, id, x, y, cos, sin, sx, sy);
+		for (int py = 0; py < LCD_HEIGHT; py++) {
+			for (int px = 0; px < LCD_WIDTH; px++) drawn += screen[py][px] != 0;
+		}
+		free(original);
+		free_sheet(sheet);
+	}
+	CHECK(wrong == 0);
+	CHECK(drawn > 1000);
+	reset_clip();
+}
+
+#define SHEET_FILE "test_draw_sheet.bin"
+
+static long file_size(const char* filename) {
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) return -1;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+
+// sheets saved plain and compiled load back with the same pixels and mask
+static void test_sheet_files(int width, int height, int count) {
+	Spritesheet* sheet = new_sheet(width, height, count);
+	size_t size = width * height * count * sizeof(Color);
+	Color* original = malloc(size);
+	memcpy(original, sheet->bitmap, size);
+
+	for (int compiled = 0; compiled < 2; compiled++) {
+		if (compiled) REQUIRE(draw_sprite_compile(sheet));
+		REQUIRE(draw_sprite_save(sheet, SHEET_FILE) == FR_OK);
+		long saved = file_size(SHEET_FILE);
+
+		Spritesheet* loaded = test_alloc32(sizeof(Spritesheet));
+		memset(loaded, 0, sizeof(Spritesheet));
+		REQUIRE(draw_sprite_load(loaded, SHEET_FILE) == FR_OK);
+		CHECK(loaded->width == width && loaded->height == height && loaded->count == count);
+		CHECK(loaded->mask == MASK);
+		CHECK(loaded->compiled == compiled);
+		if (!compiled) {
+			// i16 width and height, u8 count, u16 mask
+			CHECK(saved == (long)(7 + size));
+			CHECK(memcmp(loaded->bitmap, original, size) == 0);
+		} else {
+			int rows = height * count;
+			CHECK(memcmp(loaded->run_index, sheet->run_index, (rows + 1) * sizeof(u32)) == 0);
+			CHECK(memcmp(loaded->runs, sheet->runs, sheet->run_index[rows] * 2 * sizeof(u16)) == 0);
+			check_runs(loaded, original, loaded->run_index, loaded->runs);
+		}
+		int wrong = 0;
+		for (int s = 0; s < count; s++) {
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) wrong += draw_sprite_get_pixel(loaded, x, y, s) != original[x + (y + s * height) * width];
+			}
+		}
+		CHECK(wrong == 0);
+
+		// and draw the same
+		memset(screen, 0, sizeof(screen));
+		for (int s = 0; s < count && s < 8; s++) draw_sprite_local(s * 30, 10, sheet, s, s & 3);
+		memcpy(expected, screen, sizeof(screen));
+		memset(screen, 0, sizeof(screen));
+		for (int s = 0; s < count && s < 8; s++) draw_sprite_local(s * 30, 10, loaded, s, s & 3);
+		CHECK(memcmp(screen, expected, sizeof(screen)) == 0);
+		free_sheet(loaded);
+	}
+	remove(SHEET_FILE);
+	free(original);
+	free_sheet(sheet);
+}
+
+static void test_sheet_file_errors() {
+	Spritesheet sheet = {0};
+	remove(SHEET_FILE);
+	CHECK(draw_sprite_load(&sheet, SHEET_FILE) == FR_NO_FILE);
+	CHECK(sheet.bitmap == NULL);
+}
+
+// a batch draws exactly what the same primitives drawn one at a time do,
+// with a shared color or one per primitive
+static void test_batch() {
+	// x, y for points, x, y, r for circles, four values for the rest
+	static const int strides[] = {2, 4, 4, 4, 3, 3};
+	static i16 data[200 * 5];
+	int wrong = 0;
+	for (int kind = DRAW_BATCH_POINTS; kind <= DRAW_BATCH_CIRCLESFILL; kind++) {
+		for (int per_item = 0; per_item < 2; per_item++) {
+			int count = 1 + test_rand() % 200, stride = strides[kind] + per_item;
+			for (int i = 0; i < count * stride; i++) data[i] = (i16)(test_rand() % 440) - 60;
+			for (int i = 0; i < count; i++) {
+				// sizes and radii stay small enough to leave gaps
+				if (kind == DRAW_BATCH_CIRCLES || kind == DRAW_BATCH_CIRCLESFILL) data[i * stride + 2] = test_rand() % 40;
+				if (kind == DRAW_BATCH_RECTS || kind == DRAW_BATCH_RECTSFILL) {
+					data[i * stride + 2] = test_rand() % 50 - 5;
+					data[i * stride + 3] = test_rand() % 50 - 5;
+				}
+				if (per_item) data[i * stride + stride - 1] = 1 + test_rand() % 0x7fff;
+			}
+			Color color = 0x07e0;
+
+			reset_clip();
+			if (kind & 1) set_clip(25, 35, 290, 260);
+			memset(screen, 0, sizeof(screen));
+			draw_batch_local(kind, count, data, per_item ? -1 : color);
+			memcpy(expected, screen, sizeof(screen));
+
+			memset(screen, 0, sizeof(screen));
+			for (int i = 0; i < count; i++) {
+				i16* d = data + i * stride;
+				Color c = per_item ? (Color)d[stride - 1] : color;
+				switch (kind) {
+					case DRAW_BATCH_POINTS: draw_point(d[0], d[1], c); break;
+					case DRAW_BATCH_LINES: draw_line_local(d[0], d[1], d[2], d[3], c); break;
+					case DRAW_BATCH_RECTS: draw_rect_local(d[0], d[1], d[2], d[3], c); break;
+					case DRAW_BATCH_RECTSFILL: draw_fill_rect_local(d[0], d[1], d[2], d[3], c); break;
+					case DRAW_BATCH_CIRCLES: draw_circle_local(d[0], d[1], d[2], c); break;
+					case DRAW_BATCH_CIRCLESFILL: draw_fill_circle_local(d[0], d[1], d[2], c); break;
+				}
+			}
+			if (memcmp(screen, expected, sizeof(screen))) wrong++;
+			int drawn = 0;
+			for (int y = 0; y < LCD_HEIGHT; y++) {
+				for (int x = 0; x < LCD_WIDTH; x++) drawn += expected[y][x] != 0;
+			}
+			if (drawn == 0) wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+	reset_clip();
+}
+
+int main() {
+	pthread_t thread;
+	multicore_init();
+	pthread_create(&thread, NULL, core0, NULL);
+
+	test_build_runs(1, 1, 1);
+	test_build_runs(8, 8, 4);
+	test_build_runs(13, 5, 3);
+	test_build_runs(LCD_WIDTH, 2, 1);
+	test_runs_version();
+	test_compile(1, 1, 1);
+	test_compile(8, 8, 4);
+	test_compile(17, 9, 5);
+	test_tilemap_redraw();
+	test_tilemap_scroll(-1, true);
+	test_tilemap_scroll(2, true);
+	test_tilemap_scroll(2, false);
+	test_list_replay();
+	test_pixelbuffer_blit();
+	test_line_clipping();
+	test_triangle_coverage();
+	test_polygon_fill();
+	test_rotozoom();
+	test_sheet_files(1, 1, 1);
+	test_sheet_files(8, 8, 4);
+	test_sheet_files(17, 9, 5);
+	test_sheet_files(LCD_WIDTH, 2, 1);
+	test_sheet_file_errors();
+	test_batch();
+
+	core0_stop = true;
+	multicore_fifo_push_blocking_inline(MULTICORE_DOORBELL);
+	pthread_join(thread, NULL);
+	return test_report("test_draw");
+}
@@ -0,0 +1,929 @@
+// runs lcd.c against the fake panel, DMA and PSRAM of stubs/panel.c, lcd.c is
+// included to get at its static helpers
+#include <math.h>
+
+#include "../drivers/lcd.c"
+#include "../drivers/draw.h"
+
+#include "panel.h"
+#include "test.h"
+
+int draw_fifo_receiver(uint32_t message);
+
+// what the panel should have received, data bytes have bit 8 set
+static bool log_matches(const uint16_t* expect, uint32_t count) {
+	if (host_panel.log_count != count) return false;
+	return memcmp(host_panel.log, expect, count * sizeof(uint16_t)) == 0;
+}
+
+#define D(b) (0x100 | (b))
+
+// pixels go out by DMA as big endian RGB565 after a CASET, RASET, RAMWR
+// sequence, commands are written by the CPU
+static void test_byte_stream() {
+	u16 pixels[6] = {0x1234, 0xabcd, 0x00ff, 0xff00, 0x8001, 0x0000};
+	static const uint16_t draw[] = {
+		0x2a, D(0), D(5), D(0), D(7),
+		0x2b, D(1), D(0x2c), D(1), D(0x2d),
+		0x2c,
+		D(0x12), D(0x34), D(0xab), D(0xcd), D(0x00), D(0xff),
+		D(0xff), D(0x00), D(0x80), D(0x01), D(0x00), D(0x00),
+	};
+	lcd_buffer_enable_local(LCD_BUFFERMODE_DIRECT, false);
+	lcd_reset_clip_local();
+	host_panel_reset_counters();
+	lcd_draw_local(pixels, 5, 300, 3, 2);
+	lcd_wait_dma();
+	CHECK(log_matches(draw, sizeof(draw) / sizeof(draw[0])));
+	CHECK(host_dma.bytes == 12);
+	CHECK(host_panel.mem[300][5] == 0x1234 && host_panel.mem[301][7] == 0x0000);
+
+	// fills repeat the same two bytes out of a DMA ring
+	host_panel_reset_counters();
+	lcd_fill_local(0xbeef, 10, 20, 30, 40);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == 30 * 40 * 2);
+	CHECK(host_dma.bytes == 30 * 40 * 2);
+	for (uint32_t i = 11; i < host_panel.log_count && i < HOST_PANEL_LOG_SIZE; i++) {
+		CHECK(host_panel.log[i] == D(i % 2 ? 0xbe : 0xef));
+	}
+	int wrong = 0;
+	for (int y = 15; y < 65; y++) {
+		for (int x = 5; x < 45; x++) {
+			bool inside = x >= 10 && x < 40 && y >= 20 && y < 60;
+			if (inside != (host_panel.mem[y][x] == 0xbeef)) wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+
+	// a whole frame is one region with every pixel streamed through the
+	// line buffers
+	lcd_buffer_enable_local(LCD_BUFFERMODE_PSRAM, false);
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		u16 row[LCD_WIDTH];
+		for (int x = 0; x < LCD_WIDTH; x++) row[x] = x * 7 + y * 13;
+		lcd_draw_local(row, 0, y, LCD_WIDTH, 1);
+	}
+	host_panel_reset_counters();
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == LCD_WIDTH * LCD_HEIGHT * 2);
+	CHECK(host_dma.transfers == LCD_HEIGHT);
+	wrong = 0;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			if (host_panel_pixel(x, y) != (u16)(x * 7 + y * 13)) wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+}
+
+#define POISON 0xdead
+
+// poisons the visible panel memory, so anything not sent by the next blit
+// stays POISON
+static void panel_poison() {
+	for (int y = 0; y < HOST_PANEL_HEIGHT; y++) {
+		for (int x = 0; x < HOST_PANEL_WIDTH; x++) host_panel.mem[y][x] = POISON;
+	}
+}
+
+// pixels the panel got that weren't in any of the rects, or rects that
+// don't show color
+static int panel_diff(const int (*rects)[4], int count, u16 color) {
+	int wrong = 0;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			bool inside = false;
+			for (int i = 0; i < count; i++) {
+				const int* r = rects[i];
+				if (x >= r[0] && y >= r[1] && x < r[0] + r[2] && y < r[1] + r[3]) inside = true;
+			}
+			if (host_panel_pixel(x, y) != (inside ? color : POISON)) wrong++;
+		}
+	}
+	return wrong;
+}
+
+static void blit() {
+	host_panel_reset_counters();
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+}
+
+// a blit only opens regions around what was drawn since the last one and
+// counts what it didn't have to send
+static void test_dirty_blit(int mode) {
+	// exact in RGB332 so the RAM framebuffer keeps it, indexed modes draw the
+	// index and the default palette maps it back
+	bool indexed = mode == LCD_BUFFERMODE_INDEXED8 || mode == LCD_BUFFERMODE_INDEXED4;
+	int index = mode == LCD_BUFFERMODE_INDEXED4 ? 0x0d : 0x6d;
+	u16 color = indexed ? index : lcd_to16[index];
+	u16 shown = lcd_to16[index];
+	static const int one[][4] = {{100, 100, 20, 20}};
+	static const int two[][4] = {{10, 10, 5, 5}, {200, 250, 8, 3}};
+	const uint32_t frame = LCD_WIDTH * LCD_HEIGHT * 2;
+
+	REQUIRE(lcd_buffer_enable_local(mode, true));
+	lcd_reset_clip_local();
+	lcd_clear_local();
+	blit();
+	CHECK(host_panel.regions == 1 && host_panel.pixel_bytes == frame);
+	CHECK(lcd_stats.blit_saved == 0);
+
+	panel_poison();
+	lcd_fill_local(color, 100, 100, 20, 20);
+	blit();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == 20 * 20 * 2);
+	CHECK(lcd_stats.blit_regions == 1 && lcd_stats.blit_bytes == 20 * 20 * 2);
+	CHECK(lcd_stats.blit_saved == frame - 20 * 20 * 2);
+	CHECK(panel_diff(one, 1, shown) == 0);
+
+	// nothing drawn, nothing sent
+	blit();
+	CHECK(host_panel.commands == 0 && host_panel.pixel_bytes == 0);
+	CHECK(lcd_stats.blit_saved == frame);
+
+	// far apart rects get their own regions
+	lcd_clear_local();
+	blit();
+	panel_poison();
+	lcd_fill_local(color, 10, 10, 5, 5);
+	for (int i = 0; i < 3; i++) {
+		u16 pixels[8] = {color, color, color, color, color, color, color, color};
+		lcd_draw_local(pixels, 200, 250 + i, 8, 1);
+	}
+	blit();
+	CHECK(host_panel.regions == 2);
+	CHECK(host_panel.pixel_bytes == (5 * 5 + 8 * 3) * 2);
+	CHECK(panel_diff(two, 2, shown) == 0);
+
+	// a row is sent as one span from its leftmost to its rightmost dirty pixel
+	lcd_clear_local();
+	blit();
+	panel_poison();
+	lcd_fill_local(color, 0, 50, 4, 4);
+	for (int y = 50; y < 54; y++) {
+		for (int x = 300; x < 304; x++) lcd_point_local(color, x, y);
+	}
+	blit();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == 304 * 4 * 2);
+
+	// without tracking every blit is a full frame
+	REQUIRE(lcd_buffer_enable_local(mode, false));
+	blit();
+	blit();
+	CHECK(host_panel.regions == 1 && host_panel.pixel_bytes == frame);
+	CHECK(lcd_stats.blit_saved == 0);
+}
+
+static u16 pattern(int frame, int x, int y) {
+	return (u16)(frame * 0x1111 + x * 3 + y * 0x40);
+}
+
+static void draw_pattern(int frame) {
+	u16 row[LCD_WIDTH];
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) row[x] = pattern(frame, x, y);
+		lcd_draw_local(row, 0, y, LCD_WIDTH, 1);
+	}
+}
+
+static int panel_wrong(int frame) {
+	int wrong = 0;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			if (host_panel_pixel(x, y) != pattern(frame, x, y)) wrong++;
+		}
+	}
+	return wrong;
+}
+
+// blitting hands the back buffer to the present running in the background,
+// drawing carries on in the other buffer without touching what's being sent
+static void test_double_buffer() {
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_DOUBLE, true));
+	lcd_reset_clip_local();
+	uint32_t frames = lcd_stats.frames;
+
+	draw_pattern(1);
+	host_panel_reset_counters();
+	lcd_buffer_blit_local();
+	CHECK(lcd_present_active);
+	CHECK(host_panel.regions == 1);
+	// the next frame is drawn while the last one is still going out
+	draw_pattern(2);
+	CHECK(lcd_present_active);
+	lcd_wait_dma();
+	CHECK(!lcd_present_active);
+	CHECK(host_panel.pixel_bytes == LCD_WIDTH * LCD_HEIGHT * 2);
+	CHECK(panel_wrong(1) == 0);
+
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+	CHECK(panel_wrong(2) == 0);
+	CHECK(lcd_stats.frames == frames + 2);
+
+	// the buffer drawn to next holds the frame before last
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+	CHECK(panel_wrong(1) == 0);
+
+	// blits and mode switches wait for the present before touching the panel
+	draw_pattern(3);
+	lcd_buffer_blit_local();
+	draw_pattern(4);
+	lcd_buffer_blit_local();
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_DIRECT, false));
+	CHECK(!lcd_present_active);
+	CHECK(panel_wrong(4) == 0);
+}
+
+#define CHUNKS(bytes, max) (((bytes) + (max) - 1) / (max))
+
+static uint32_t psram_mark;
+
+// PSRAM transactions since the last call
+static uint32_t psram_count() {
+	uint32_t count = host_psram.transactions - psram_mark;
+	psram_mark = host_psram.transactions;
+	return count;
+}
+
+// PSRAM transactions per operation, each as long as rp2040-psram allows, and
+static uint64_t fake_now;
+
+// every reading is a millisecond after the last
+static uint64_t fake_clock() {
+	return fake_now += 1000;
+}
+
+// blit and present times come from lcd_clock_us, so a fake clock makes them
+// exact no matter how fast the host runs
+static void test_stats_clock() {
+	lcd_clock_us = &fake_clock;
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_PSRAM, true));
+	lcd_fill_local(0xffff, 0, 0, 10, 10);
+	lcd_buffer_blit_local();
+	CHECK(lcd_stats.blit_us == 1000);
+
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_DOUBLE, true));
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+	// read at the blit start, around the stall, at the present start, the
+	// blit end and when the present is done
+	CHECK(lcd_stats.present_stall_us == 1000);
+	CHECK(lcd_stats.blit_us == 4000);
+	CHECK(lcd_stats.present_us == 2000);
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_DIRECT, false));
+	lcd_clock_us = &lcd_time_us;
+}
+
+// lcd_stats counts the same ones the PSRAM sees
+static void test_psram_transactions() {
+	u16 row[LCD_WIDTH], back[LCD_WIDTH];
+	for (int x = 0; x < LCD_WIDTH; x++) row[x] = x;
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_PSRAM, true));
+	lcd_reset_clip_local();
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+
+	host_panel_reset_counters();
+	uint32_t before = lcd_stats.psram_transactions;
+	psram_count();
+	lcd_draw_local(row, 0, 0, LCD_WIDTH, 1);
+	CHECK(psram_count() == CHUNKS(LCD_WIDTH * 2, LCD_PSRAM_WRITE_MAX));
+	CHECK(host_psram.bytes == LCD_WIDTH * 2);
+	lcd_psram_read(back, 0, 0, LCD_WIDTH);
+	CHECK(psram_count() == CHUNKS(LCD_WIDTH * 2, LCD_PSRAM_READ_MAX));
+	CHECK(memcmp(back, row, sizeof(row)) == 0);
+
+	// rows of a narrow rect each start a new transaction
+	lcd_draw_local(row, 30, 30, 20, 20);
+	CHECK(psram_count() == 20 * CHUNKS(20 * 2, LCD_PSRAM_WRITE_MAX));
+
+	lcd_point_local(0xffff, 5, 5);
+	CHECK(psram_count() == 1);
+
+	// full width fills are one span
+	lcd_clear_local();
+	uint32_t clear = psram_count();
+	CHECK(clear == CHUNKS(LCD_WIDTH * LCD_HEIGHT, LCD_PSRAM_WRITE_MAX / 2));
+
+	// a full frame blit reads each row in as few transactions as it can
+	uint32_t bytes = host_psram.bytes;
+	lcd_buffer_blit_local();
+	lcd_wait_dma();
+	uint32_t blit = psram_count();
+	CHECK(blit == LCD_HEIGHT * CHUNKS(LCD_WIDTH * 2, LCD_PSRAM_READ_MAX));
+	CHECK(host_psram.bytes - bytes == LCD_WIDTH * LCD_HEIGHT * 2);
+
+	CHECK(host_psram.oversized == 0);
+	CHECK(lcd_stats.psram_transactions - before == host_psram.transactions);
+	// 20 byte transactions took 10240 each to clear or blit a frame
+	printf("psram transactions: clear %u, frame blit %u\n", clear, blit);
+}
+
+static u16 captured[LCD_HEIGHT][LCD_WIDTH];
+static u16 reference[LCD_HEIGHT][LCD_WIDTH];
+static int captured_draws;
+
+// stands in for the backend to see exactly what text drawing hands it
+static void capture_draw(u16* pixels, int x, int y, int width, int height, int stride) {
+	captured_draws++;
+	for (int j = 0; j < height; j++) memcpy(&captured[y + j][x], pixels + j * stride, width * sizeof(u16));
+}
+
+static void null_draw(u16* pixels, int x, int y, int width, int height, int stride) {
+	captured_draws++;
+}
+
+// what drawing a glyph a bit at a time gives
+static void reference_glyph(u16* out, int stride, char c, u16 fg, u16 bg) {
+	if (c > font.glyph_count + font.firstcode) c = 0;
+	const u8* bits = font.glyphs + ((u8)(c - font.firstcode)) * font.bytewidth * font.glyph_height;
+	for (int j = 0; j < font.glyph_height; j++) {
+		for (int i = 0; i < font.glyph_width; i++) {
+			out[i + j * stride] = bits[j * font.bytewidth + i / 8] & (0x80 >> (i % 8)) ? fg : bg;
+		}
+	}
+}
+
+static void reference_text(int x, int y, u16 fg, u16 bg, const char* text, int len) {
+	u16 glyph[32 * 32];
+	for (int n = 0; n < len; n++) {
+		reference_glyph(glyph, font.glyph_width, text[n], fg, bg);
+		for (int j = 0; j < font.glyph_height; j++) {
+			for (int i = 0; i < font.glyph_width; i++) {
+				int px = x + n * font.glyph_width + i, py = y + j;
+				if (px >= 0 && py >= 0 && px < LCD_WIDTH && py < LCD_HEIGHT) reference[py][px] = glyph[i + j * font.glyph_width];
+			}
+		}
+	}
+}
+
+// every glyph of the font in a few colors, partly off both sides of the screen
+static void check_font(int first, int count) {
+	static const u16 colors[][2] = {{0xffff, 0x0000}, {0xf800, 0x001f}, {0x1234, 0x1234}};
+	char text[64];
+	memset(captured, 0, sizeof(captured));
+	memset(reference, 0, sizeof(reference));
+	int y = 0;
+	for (int c = first; c < first + count && y + font.glyph_height <= LCD_HEIGHT; y += font.glyph_height) {
+		int len = 0;
+		while (len < 60 && c < first + count) text[len++] = (char)c++;
+		int x = (y / font.glyph_height) % 2 ? -7 : 3;
+		const u16* color = colors[(y / font.glyph_height) % 3];
+		lcd_draw_text_local(x, y, color[0], color[1], text, len, LCD_ALIGN_LEFT);
+		reference_text(x, y, color[0], color[1], text, len);
+	}
+	CHECK(memcmp(captured, reference, sizeof(captured)) == 0);
+}
+
+// glyphs expanded a nibble at a time match the font bit for bit
+static void test_glyphs() {
+	lcd_buffer_enable_local(LCD_BUFFERMODE_DIRECT, false);
+	lcd_reset_clip_local();
+	void (*draw)(u16*, int, int, int, int, int) = lcd_draw_ptr;
+	lcd_draw_ptr = capture_draw;
+
+	check_font(0, 256);
+
+	// 10 pixel wide glyphs take two bytes a row and end on half a nibble
+	FILE* file = fopen("test_lcd_font.bin", "wb");
+	REQUIRE(file);
+	u8 header[] = {0, 0, 96, 32, 10, 7, 14};
+	fwrite(header, 1, sizeof(header), file);
+	for (int i = 0; i < 96 * 14; i++) fputc(test_rand(), file);
+	fclose(file);
+	REQUIRE(lcd_load_font("test_lcd_font.bin") == FR_OK);
+	CHECK(font.glyph_width == 10 && font.bytewidth == 2);
+	check_font(32, 96);
+	remove("test_lcd_font.bin");
+	lcd_load_font(NULL);
+
+	lcd_draw_ptr = draw;
+}
+
+static double now_s() {
+	return time_us_64() / 1e6;
+}
+
+// characters per second through lcd_draw_text_local against a bit at a
+// time expansion drawn a character at a time, with the backend taken out
+static void bench_text() {
+	char line[LCD_WIDTH / 6];
+	for (int i = 0; i < (int)sizeof(line); i++) line[i] = 'A' + i % 26;
+	const int lines = 20000;
+	void (*draw)(u16*, int, int, int, int, int) = lcd_draw_ptr;
+	lcd_draw_ptr = null_draw;
+
+	double start = now_s();
+	for (int n = 0; n < lines; n++) lcd_draw_text_local(0, (n * 8) % (LCD_HEIGHT - 8), 0xffff, n, line, sizeof(line), LCD_ALIGN_LEFT);
+	double text = now_s() - start;
+
+	start = now_s();
+	for (int n = 0; n < lines; n++) {
+		for (int i = 0; i < (int)sizeof(line); i++) {
+			reference_glyph(font.glyph_colorbuf, font.glyph_width, line[i], 0xffff, n);
+			lcd_draw_local(font.glyph_colorbuf, i * 6, (n * 8) % (LCD_HEIGHT - 8), font.glyph_width, font.glyph_height);
+		}
+	}
+	double bits = now_s() - start;
+
+	lcd_draw_ptr = draw;
+	double chars = (double)lines * sizeof(line);
+	printf("text: %.0f chars/s, a bit and a char at a time: %.0f chars/s\n", chars / text, chars / bits);
+}
+
+// a run of text goes out as one region holding only its visible pixels
+static void test_text_regions() {
+	char text[60];
+	for (int i = 0; i < 60; i++) text[i] = 'a' + i % 26;
+	int gw = font.glyph_width, gh = font.glyph_height;
+	lcd_buffer_enable_local(LCD_BUFFERMODE_DIRECT, false);
+	lcd_reset_clip_local();
+
+	host_panel_reset_counters();
+	lcd_draw_text_local(12, 40, 0xffff, 0x0010, text, 40, LCD_ALIGN_LEFT);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == 40 * gw * gh * 2);
+	memset(reference, 0, sizeof(reference));
+	reference_text(12, 40, 0xffff, 0x0010, text, 40);
+	int wrong = 0;
+	for (int y = 40; y < 40 + gh; y++) {
+		for (int x = 12; x < 12 + 40 * gw; x++) {
+			if (host_panel.mem[y][x] != reference[y][x]) wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+
+	// the same text a character at a time opens a region per character
+	host_panel_reset_counters();
+	for (int i = 0; i < 40; i++) lcd_draw_char_local(12 + i * gw, 40, 0xffff, 0x0010, text[i]);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 40);
+	CHECK(host_panel.pixel_bytes == 40 * gw * gh * 2);
+
+	// hanging off both sides, only what's on screen is sent
+	host_panel_reset_counters();
+	lcd_draw_text_local(-10, 60, 0xffff, 0, text, 60, LCD_ALIGN_LEFT);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == LCD_WIDTH * gh * 2);
+
+	// centered and right aligned runs are placed before clipping
+	host_panel_reset_counters();
+	lcd_draw_text_local(20, 80, 0xffff, 0, text, 10, LCD_ALIGN_CENTER);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.x1 == 0 && host_panel.x2 == 20 + 5 * gw - 1);
+	host_panel_reset_counters();
+	lcd_draw_text_local(LCD_WIDTH, 90, 0xffff, 0, text, 10, LCD_ALIGN_RIGHT);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == 10 * gw * gh * 2);
+	CHECK(host_panel.x1 == LCD_WIDTH - 10 * gw && host_panel.x2 == LCD_WIDTH - 1);
+
+	// inside a clip rect, and nothing at all when clipped away
+	host_panel_reset_counters();
+	lcd_set_clip_local(50, 0, 100, LCD_HEIGHT);
+	lcd_draw_text_local(0, 100, 0xffff, 0, text, 50, LCD_ALIGN_LEFT);
+	lcd_draw_text_local(0, -20, 0xffff, 0, text, 50, LCD_ALIGN_LEFT);
+	lcd_draw_text_local(200, 120, 0xffff, 0, text, 50, LCD_ALIGN_LEFT);
+	lcd_wait_dma();
+	CHECK(host_panel.regions == 1);
+	CHECK(host_panel.pixel_bytes == 100 * gh * 2);
+	CHECK(host_panel.x1 == 50 && host_panel.x2 == 149);
+	lcd_reset_clip_local();
+}
+
+// a terminal keeps logical line n at row n % ring, scrolling only moves the
+// top and draws the lines that came into view
+static int scroll_index(int mode, int line) {
+	return (line * 7 + line / 16 * 3) % (mode == LCD_BUFFERMODE_INDEXED4 ? 16 : 256);
+}
+
+static void scroll_draw_line(int mode, int line) {
+	bool indexed = mode == LCD_BUFFERMODE_INDEXED8 || mode == LCD_BUFFERMODE_INDEXED4;
+	int a = scroll_index(mode, line), b = scroll_index(mode, line + 5);
+	int y = line % lcd_current_height;
+	lcd_fill_local(indexed ? a : lcd_to16[a], 0, y, LCD_WIDTH, 1);
+	lcd_fill_local(indexed ? b : lcd_to16[b], line % 300, y, 10, 1);
+}
+
+static int scroll_wrong(int mode, int top) {
+	int wrong = 0;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		int line = top + y;
+		u16 a = lcd_to16[scroll_index(mode, line)], b = lcd_to16[scroll_index(mode, line + 5)];
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			u16 expect = x >= line % 300 && x < line % 300 + 10 ? b : a;
+			if (host_panel_pixel(x, y) != expect) wrong++;
+		}
+	}
+	return wrong;
+}
+
+static void test_scroll(int mode) {
+	static const int steps[] = {16, 16, 7, 1, 33, 100, 250, 16, 320};
+	REQUIRE(lcd_buffer_enable_local(mode, true));
+	lcd_reset_clip_local();
+	lcd_scroll_local(0);
+	panel_poison();
+	for (int line = 0; line < LCD_HEIGHT; line++) scroll_draw_line(mode, line);
+	blit();
+	CHECK(scroll_wrong(mode, 0) == 0);
+
+	int top = 0;
+	for (int i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])); i++) {
+		lcd_scroll_local(top + steps[i]);
+		for (int line = top + LCD_HEIGHT; line < top + steps[i] + LCD_HEIGHT; line++) scroll_draw_line(mode, line);
+		top += steps[i];
+		blit();
+		CHECK(scroll_wrong(mode, top) == 0);
+	}
+	lcd_scroll_local(0);
+}
+
+static u8 indices[LCD_HEIGHT][LCD_WIDTH];
+
+static int palette_wrong(const u16* palette) {
+	int wrong = 0;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			if (host_panel_pixel(x, y) != palette[indices[y][x]]) wrong++;
+		}
+	}
+	return wrong;
+}
+
+static void test_palette(int mode) {
+	int n = mode == LCD_BUFFERMODE_INDEXED4 ? 16 : 256;
+	static u16 palette[256];
+	// odd multipliers are a bijection on 16 bits, so every entry differs
+	for (int i = 0; i < 256; i++) palette[i] = i * 0x9e37 + 0x1234;
+	REQUIRE(lcd_buffer_enable_local(mode, true));
+	lcd_reset_clip_local();
+	lcd_set_palette_local(0, 256, palette);
+	lcd_clear_local();
+	memset(indices, 0, sizeof(indices));
+
+	// spans starting and ending on both odd and even pixels
+	for (int r = 0; r < 40; r++) {
+		int x = r * 7 % 50, y = 10 + r * 5, width = 1 + r * 13 % 61;
+		u16 pixels[64];
+		for (int i = 0; i < width; i++) {
+			pixels[i] = ((x + i) * 3 + r) % n;
+			indices[y][x + i] = pixels[i];
+		}
+		lcd_draw_local(pixels, x, y, width, 1);
+	}
+	const int fills[][5] = {{33, 220, 5, 7, 9}, {100, 230, 8, 3, n - 1}, {201, 240, 1, 4, 1}};
+	for (int i = 0; i < 3; i++) {
+		const int* f = fills[i];
+		lcd_fill_local(f[4], f[0], f[1], f[2], f[3]);
+		for (int y = f[1]; y < f[1] + f[3]; y++) memset(&indices[y][f[0]], f[4], f[2]);
+	}
+	for (int x = 250; x < 260; x++) {
+		lcd_point_local(x % n, x, 300);
+		indices[300][x] = x % n;
+	}
+	// 4bpp only keeps the low nibble
+	if (n == 16) {
+		lcd_point_local(0x13, 270, 300);
+		indices[300][270] = 3;
+	}
+	blit();
+	CHECK(palette_wrong(palette) == 0);
+	// only the drawn spans go out again
+	panel_poison();
+	lcd_fill_local(5, 41, 100, 3, 1);
+	memset(&indices[100][41], 5, 3);
+	blit();
+	CHECK(host_panel.pixel_bytes == 3 * 2);
+	CHECK(host_panel_pixel(40, 100) == POISON && host_panel_pixel(44, 100) == POISON);
+	for (int x = 41; x < 44; x++) CHECK(host_panel_pixel(x, 100) == palette[5]);
+
+	// changing entries redraws every pixel through the new palette
+	u16 changed[] = {0xf800, 0x07e0, 0x001f};
+	lcd_set_palette_local(5, 3, changed);
+	memcpy(&palette[5], changed, sizeof(changed));
+	blit();
+	CHECK(host_panel.pixel_bytes == LCD_WIDTH * LCD_HEIGHT * 2);
+	CHECK(palette_wrong(palette) == 0);
+	// a negative start drops the entries before 0
+	u16 shifted[] = {1, 2, 3, 4};
+	lcd_set_palette_local(-2, 4, shifted);
+	palette[0] = 3;
+	palette[1] = 4;
+	blit();
+	CHECK(palette_wrong(palette) == 0);
+
+	lcd_set_palette_local(0, 256, lcd_to16);
+}
+
+// every primitive is drawn once unclipped as the reference, then again
+// inside a clip rect and moved by an origin, which has to give the same
+// pixels masked and shifted
+#define MASK 0xf81f
+
+static Spritesheet clip_sheet;
+static Tilemap clip_map;
+static Pixelbuffer clip_buffer;
+
+static void clip_setup() {
+	static Color sheet_pixels[16 * 16 * 2], buffer_pixels[40 * 30];
+	static u8 tiles[6 * 4 * 2];
+	for (int y = 0; y < 32; y++) {
+		for (int x = 0; x < 16; x++) sheet_pixels[x + y * 16] = (x + y) % 5 == 0 ? MASK : 0x0841 * (x + 1) + y;
+	}
+	clip_sheet = (Spritesheet){.width = 16, .height = 16, .count = 2, .mask = MASK, .bitmap = sheet_pixels};
+	for (int i = 0; i < 6 * 4; i++) tiles[i] = i % 3 == 2 ? DRAW_TILE_EMPTY : i % 2;
+	clip_map = (Tilemap){.width = 6, .height = 4, .sheet = &clip_sheet, .underlay = -1, .tiles = tiles, .dirty = tiles + 6 * 4};
+	for (int i = 0; i < 40 * 30; i++) buffer_pixels[i] = 0x1000 + i;
+	clip_buffer = (Pixelbuffer){.width = 40, .height = 30, .pixels = buffer_pixels};
+}
+
+static void clip_primitives(int n) {
+	static float star[] = {100, 40, 130, 160, 40, 80, 160, 80, 70, 160};
+	static i16 lines[] = {40, 40, 180, 170, 0x07e0, 180, 40, 40, 170, 0x001f, 50, 100, 170, 100, 0xfc00};
+	i32 coords[] = {40 << 16, 50 << 16, 0, 0, 170 << 16, 70 << 16, 15 << 16, 0, 90 << 16, 170 << 16, 15 << 16, 15 << 16};
+	switch (n) {
+		case 0: lcd_draw_text_local(30, 90, 0xffff, 0x0010, "clipped text run", 16, LCD_ALIGN_LEFT); break;
+		case 1: for (int i = 0; i < 150; i++) lcd_point_local(0xffe0, 40 + i, 40 + i * 7 % 130); break;
+		case 2: draw_rect_local(50, 45, 120, 110, 0xf800); break;
+		case 3: draw_fill_rect_local(50, 45, 120, 110, 0x07e0); break;
+		case 4: draw_line_local(40, 170, 180, 45, 0xffff); break;
+		case 5: draw_circle_local(110, 100, 60, 0x001f); break;
+		case 6: draw_fill_circle_local(110, 100, 60, 0xfc00); break;
+		case 7: draw_polygon_local(10, star, 0xffe0); break;
+		case 8: draw_fill_polygon_local(10, star, 0x07ff, DRAW_FILL_EVENODD); break;
+		case 9: draw_fill_polygon_local(10, star, 0x07ff, DRAW_FILL_NONZERO); break;
+		case 10: draw_triangle_local(45 << 16, 50 << 16, 175 << 16, 100 << 16, 80 << 16, 170 << 16, 0xf800); break;
+		case 11: draw_triangle_shaded_local(0xf800, 45 << 16, 50 << 16, 0x07e0, 175 << 16, 100 << 16, 0x001f, 80 << 16, 170 << 16); break;
+		case 12: draw_triangle_textured_local(&clip_sheet, 1, coords); break;
+		case 13: draw_sprite_local(62, 54, &clip_sheet, 0, 0); draw_sprite_local(140, 120, &clip_sheet, 1, 3); break;
+		case 14: draw_sprite_transformed_local(110 << 16, 100 << 16, &clip_sheet, 0, 56756, 32768, 5 << 16, 4 << 16); break;
+		case 15: clip_map.version++; draw_tilemap_local(30, 50, &clip_map, 0, 0, 6 * 16, 4 * 16, 0); break;
+		case 16: draw_pixelbuffer_local(80, 80, &clip_buffer); break;
+		case 17: draw_batch_local(DRAW_BATCH_LINES, 3, lines, -1); break;
+	}
+}
+#define CLIP_PRIMITIVES 18
+
+static void clip_snapshot(u16 out[LCD_HEIGHT][LCD_WIDTH]) {
+	for (int y = 0; y < LCD_HEIGHT; y++) lcd_psram_read(out[y], 0, y, LCD_WIDTH);
+}
+
+// pixels of the capture that differ from the reference moved by ox, oy and
+// cut to the screen rect x1, y1, x2, y2
+static int clip_wrong(int ox, int oy, int x1, int y1, int x2, int y2) {
+	int wrong = 0;
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) {
+			int rx = x - ox, ry = y - oy;
+			bool inside = x >= x1 && y >= y1 && x < x2 && y < y2 && rx >= 0 && ry >= 0 && rx < LCD_WIDTH && ry < LCD_HEIGHT;
+			if (captured[y][x] != (inside ? reference[ry][rx] : 0)) wrong++;
+		}
+	}
+	return wrong;
+}
+
+static void clip_draw(int n, int ox, int oy, int x, int y, int width, int height) {
+	lcd_reset_clip_local();
+	lcd_clear_local();
+	lcd_set_origin_local(ox, oy);
+	if (width >= 0) lcd_set_clip_local(x, y, width, height);
+	clip_primitives(n);
+	lcd_reset_clip_local();
+	clip_snapshot(captured);
+}
+
+static void test_clipping() {
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_PSRAM, false));
+	clip_setup();
+	for (int n = 0; n < CLIP_PRIMITIVES; n++) {
+		clip_draw(n, 0, 0, 0, 0, -1, -1);
+		memcpy(reference, captured, sizeof(reference));
+		int drawn = 0;
+		for (int y = 0; y < LCD_HEIGHT; y++) {
+			for (int x = 0; x < LCD_WIDTH; x++) drawn += reference[y][x] != 0;
+		}
+		CHECK(drawn > 100);
+
+		clip_draw(n, 0, 0, 70, 60, 90, 70);
+		int wrong = clip_wrong(0, 0, 70, 60, 160, 130);
+		// pushed off the top left, the clip rect is relative to the origin
+		clip_draw(n, -60, -50, 20, 15, 200, 100);
+		wrong += clip_wrong(-60, -50, 0, 0, 160, 65);
+		// and off the bottom right
+		clip_draw(n, 200, 180, 0, 0, -1, -1);
+		wrong += clip_wrong(200, 180, 0, 0, LCD_WIDTH, LCD_HEIGHT);
+		// an empty clip rect draws nothing
+		clip_draw(n, 0, 0, 100, 100, 0, 0);
+		wrong += clip_wrong(0, 0, 0, 0, 0, 0);
+		if (wrong) printf("clipping primitive %d: %d pixels wrong\n", n, wrong);
+		CHECK(wrong == 0);
+	}
+}
+
+// moved pixels come from inside the rect and the clip, what they uncover and
+// everything outside is left alone
+static void test_move(int mode) {
+	static const int moves[][2] = {{3, 0}, {-7, 0}, {0, 5}, {0, -11}, {17, -4}, {-2, 9}, {0, 0}, {119, 1}, {-120, 0}};
+	REQUIRE(lcd_buffer_enable_local(mode, false));
+	lcd_reset_clip_local();
+	if (!lcd_read_ptr || mode == LCD_BUFFERMODE_DOUBLE) {
+		CHECK(!lcd_move_local(0, 0, 10, 10, 1, 1));
+		return;
+	}
+	u16 row[LCD_WIDTH];
+	for (int y = 0; y < LCD_HEIGHT; y++) {
+		for (int x = 0; x < LCD_WIDTH; x++) row[x] = test_rand() << 1 ^ test_rand();
+		lcd_draw_local(row, 0, y, LCD_WIDTH, 1);
+	}
+
+	int wrong = 0;
+	for (int m = 0; m < (int)(sizeof(moves) / sizeof(moves[0])); m++) {
+		int dx = moves[m][0], dy = moves[m][1];
+		for (int y = 0; y < LCD_HEIGHT; y++) lcd_read_ptr(reference[y], 0, y, LCD_WIDTH);
+		// the rect at 15, 8 on screen cut to the clip at 25..155, 13..113
+		lcd_set_origin_local(5, 3);
+		lcd_set_clip_local(20, 10, 130, 100);
+		CHECK(lcd_move_local(10, 5, 120, 90, dx, dy));
+		lcd_reset_clip_local();
+		for (int y = 0; y < LCD_HEIGHT; y++) {
+			lcd_read_ptr(captured[y], 0, y, LCD_WIDTH);
+			for (int x = 0; x < LCD_WIDTH; x++) {
+				int fx = x - dx, fy = y - dy;
+				bool moved = x >= 25 && y >= 13 && x < 135 && y < 98 && fx >= 25 && fy >= 13 && fx < 135 && fy < 98;
+				if (captured[y][x] != (moved ? reference[fy][fx] : reference[y][x])) wrong++;
+			}
+		}
+	}
+	if (wrong) printf("move in mode %d: %d pixels wrong\n", mode, wrong);
+	CHECK(wrong == 0);
+}
+
+// a list replayed with the clip stack already full still leaves the origin
+// and clip as they were, pushes that deep save nothing for the pop to restore
+static void test_list_nesting() {
+	int x1, y1, x2, y2, ox, oy;
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_PSRAM, false));
+	lcd_reset_clip_local();
+	lcd_clear_local();
+
+	multicore_list_t* list = test_alloc32(sizeof(multicore_list_t));
+	host_core_num = 1;
+	multicore_recording = list;
+	draw_fill_rect(0, 0, 4, 4, 0xf800);
+	lcd_set_origin(0, 0);
+	lcd_set_clip(0, 0, 2, 2);
+	multicore_recording = NULL;
+	host_core_num = 0;
+	REQUIRE(!list->failed && list->count > 0);
+
+	for (int i = 0; i < LCD_CLIP_DEPTH; i++) lcd_push_clip_local();
+	lcd_set_origin_local(20, 10);
+	lcd_set_clip_local(5, 5, 100, 80);
+	draw_list_local(list, 30, 20);
+	lcd_get_origin(&ox, &oy);
+	lcd_clip_bounds(&x1, &y1, &x2, &y2);
+	CHECK(ox == 20 && oy == 10);
+	CHECK(x1 == 5 && y1 == 5 && x2 == 105 && y2 == 85);
+	draw_fill_rect_local(4, 4, 4, 4, 0x07e0);
+	for (int i = 0; i < LCD_CLIP_DEPTH; i++) lcd_pop_clip_local();
+	lcd_reset_clip_local();
+
+	clip_snapshot(captured);
+	CHECK(captured[30][50] == 0xf800 && captured[33][53] == 0xf800);
+	CHECK(captured[15][25] == 0x07e0 && captured[14][24] == 0 && captured[17][27] == 0x07e0);
+	multicore_list_free(list);
+}
+
+// channels of an RGB565 pixel blended in floating point, in 0..1
+static void blend_reference(int mode, double alpha, u16 src, u16 dst, double out[3]) {
+	static const int shift[3] = {11, 5, 0}, max[3] = {31, 63, 31};
+	for (int c = 0; c < 3; c++) {
+		double s = (src >> shift[c] & max[c]) / (double)max[c], d = (dst >> shift[c] & max[c]) / (double)max[c];
+		if (mode == LCD_BLEND_ALPHA) out[c] = s * alpha + d * (1 - alpha);
+		else if (mode == LCD_BLEND_ADD) out[c] = s + d > 1 ? 1 : s + d;
+		else out[c] = s * d;
+	}
+}
+
+// how many steps of its channel the blended pixel is off the reference at most
+static double blend_error(int mode, double alpha, u16 src, u16 dst, u16 got) {
+	static const int shift[3] = {11, 5, 0}, max[3] = {31, 63, 31};
+	double out[3], worst = 0;
+	blend_reference(mode, alpha, src, dst, out);
+	for (int c = 0; c < 3; c++) {
+		double e = fabs((got >> shift[c] & max[c]) - out[c] * max[c]);
+		if (e > worst) worst = e;
+	}
+	return worst;
+}
+
+static u16 blend_rand() {
+	return test_rand() << 1 ^ test_rand();
+}
+
+static void test_blend() {
+	static const int alphas[] = {0, 1, 4, 37, 100, 128, 200, 251, 255};
+	double worst[4] = {0}, worst_quantized = 0;
+	int exact = 0;
+	for (int mode = LCD_BLEND_ALPHA; mode <= LCD_BLEND_MULTIPLY; mode++) {
+		for (int a = 0; a < (int)(sizeof(alphas) / sizeof(alphas[0])); a++) {
+			lcd_set_blend_local(mode, alphas[a]);
+			for (int round = 0; round < 500; round++) {
+				// odd length spans go through both the pair and the single pixel path
+				u16 src[7], dst[7], got[7], color = blend_rand();
+				for (int i = 0; i < 7; i++) {
+					src[i] = blend_rand();
+					dst[i] = blend_rand();
+				}
+				if (round == 0) src[0] = 0xffff, src[1] = 0, dst[2] = 0xffff, dst[3] = 0;
+				for (int from_color = 0; from_color < 2; from_color++) {
+					memcpy(got, dst, sizeof(got));
+					lcd_blend_span(got, from_color ? NULL : src, color, 7);
+					for (int i = 0; i < 7; i++) {
+						u16 s = from_color ? color : src[i];
+						double e = blend_error(mode, alphas[a] / 255.0, s, dst[i], got[i]);
+						if (e > worst[mode]) worst[mode] = e;
+						if (mode == LCD_BLEND_ALPHA) {
+							e = blend_error(mode, lcd_blend_alpha / 32.0, s, dst[i], got[i]);
+							if (e > worst_quantized) worst_quantized = e;
+							if (alphas[a] == 0 && got[i] != dst[i]) exact++;
+							if (alphas[a] == 255 && got[i] != s) exact++;
+						}
+						if (mode == LCD_BLEND_MULTIPLY && s == 0xffff && got[i] != dst[i]) exact++;
+					}
+				}
+			}
+		}
+	}
+	lcd_set_blend_local(LCD_BLEND_NONE, 255);
+	printf("blend error in channel steps: alpha %.2f (%.2f at 5 bit alpha), add %.2f, multiply %.2f\n",
+		worst[LCD_BLEND_ALPHA], worst_quantized, worst[LCD_BLEND_ADD], worst[LCD_BLEND_MULTIPLY]);
+	// alpha is kept in 5 bits and every result is truncated
+	CHECK(worst_quantized < 1);
+	CHECK(worst[LCD_BLEND_ALPHA] < 2);
+	CHECK(worst[LCD_BLEND_ADD] < 1e-9);
+	CHECK(worst[LCD_BLEND_MULTIPLY] < 1);
+	CHECK(exact == 0);
+
+	// fills blend with what's already in the framebuffer
+	REQUIRE(lcd_buffer_enable_local(LCD_BUFFERMODE_PSRAM, false));
+	lcd_reset_clip_local();
+	u16 row[LCD_WIDTH], got[LCD_WIDTH];
+	for (int x = 0; x < LCD_WIDTH; x++) row[x] = blend_rand();
+	lcd_draw_local(row, 0, 10, LCD_WIDTH, 1);
+	lcd_set_blend_local(LCD_BLEND_ALPHA, 128);
+	lcd_fill_local(0x07e0, 5, 10, 101, 1);
+	lcd_set_blend_local(LCD_BLEND_NONE, 255);
+	lcd_psram_read(got, 0, 10, LCD_WIDTH);
+	int wrong = 0;
+	for (int x = 0; x < LCD_WIDTH; x++) {
+		if (x < 5 || x >= 106) wrong += got[x] != row[x];
+		else wrong += blend_error(LCD_BLEND_ALPHA, 16 / 32.0, 0x07e0, row[x], got[x]) >= 1;
+	}
+	CHECK(wrong == 0);
+}
+
+int main() {
+	lcd_init();
+
+	test_byte_stream();
+	test_dirty_blit(LCD_BUFFERMODE_PSRAM);
+	test_dirty_blit(LCD_BUFFERMODE_RAM);
+	test_dirty_blit(LCD_BUFFERMODE_INDEXED8);
+	test_dirty_blit(LCD_BUFFERMODE_INDEXED4);
+	test_double_buffer();
+	test_stats_clock();
+	test_psram_transactions();
+	test_glyphs();
+	bench_text();
+	test_text_regions();
+	test_scroll(LCD_BUFFERMODE_DIRECT);
+	test_scroll(LCD_BUFFERMODE_PSRAM);
+	test_scroll(LCD_BUFFERMODE_RAM);
+	test_scroll(LCD_BUFFERMODE_INDEXED8);
+	test_scroll(LCD_BUFFERMODE_INDEXED4);
+	test_palette(LCD_BUFFERMODE_INDEXED8);
+	test_palette(LCD_BUFFERMODE_INDEXED4);
+	test_clipping();
+	test_move(LCD_BUFFERMODE_DIRECT);
+	test_move(LCD_BUFFERMODE_PSRAM);
+	test_move(LCD_BUFFERMODE_RAM);
+	test_move(LCD_BUFFERMODE_DOUBLE);
+	test_move(LCD_BUFFERMODE_INDEXED8);
+	test_list_nesting();
+	test_blend();
+	return test_report("test_lcd");
+}
@@ -0,0 +1,205 @@
+// runs the command ring between two threads, the main thread plays core 1
+// and pushes commands while a second thread plays core 0 and runs them
+#include <pthread.h>
+#include <unistd.h>
+
+#include "multicore.h"
+#include "lcd.h"
+#include "draw.h"
+
+#include "test.h"
+
+enum {
+	TEST_RING = 0x1000,
+	TEST_ARENA,
+};
+
+// commands carry 32 bit words, so arena tests send an index into this
+// instead of the pointer. Fewer commands than this fit into the ring
+#define ARENA_SLOTS 1024
+static uint8_t* arena_blocks[ARENA_SLOTS];
+
+// checks made on core 0, read back once it's stopped
+static int core0_failures;
+static volatile bool core0_stop;
+static uint32_t ring_next;
+// core 0 naps now and then, and fences only follow every 100th command
+static volatile bool core0_slow;
+
+int lcd_fifo_receiver(uint32_t message) {
+	if (message != FIFO_LCD_FENCE) return 0;
+	uint32_t fence = multicore_cmd_pop();
+	// fences pass one by one, never skipped or out of order
+	if (fence != multicore_fence_done + 1) core0_failures++;
+	if (core0_slow && (ring_next - 1) % 100 != 0) core0_failures++;
+	multicore_fence_done = fence;
+	return 1;
+}
+
+// every command carries its number and a few words made from it
+static uint32_t ring_arg(uint32_t seq, uint32_t i) {
+	return seq * 0x9e3779b9 + i;
+}
+
+int draw_fifo_receiver(uint32_t message) {
+	switch (message) {
+		case TEST_RING: {
+			uint32_t seq = multicore_cmd_pop();
+			if (seq != ring_next) core0_failures++;
+			ring_next = seq + 1;
+			if (core0_slow && seq % 16 == 0) usleep(50);
+			for (uint32_t i = 0; i < seq % 7; i++) {
+				if (multicore_cmd_pop() != ring_arg(seq, i)) core0_failures++;
+			}
+			return 1;
+		}
+		case TEST_ARENA: {
+			uint32_t seq = multicore_cmd_pop();
+			uint32_t size = multicore_cmd_pop();
+			uint8_t* data = arena_blocks[seq % ARENA_SLOTS];
+			for (uint32_t i = 0; i < size; i++) {
+				if (data[i] != (uint8_t)(seq + i)) {
+					core0_failures++;
+					break;
+				}
+			}
+			multicore_cmd_free(data);
+			return 1;
+		}
+	}
+	core0_failures++;
+	return 0;
+}
+
+static void* core0(void* arg) {
+	while (!core0_stop) {
+		// sleep until the doorbell when the ring ran dry
+		if (!multicore_service(64)) multicore_fifo_pop_blocking_inline();
+	}
+	return NULL;
+}
+
+static void push_ring(uint32_t seq) {
+	multicore_cmd_push(TEST_RING);
+	multicore_cmd_push(seq);
+	for (uint32_t i = 0; i < seq % 7; i++) multicore_cmd_push(ring_arg(seq, i));
+}
+
+// the ring wraps many times over, both full and drained with core 0 asleep
+static void test_ring() {
+	const uint32_t count = 200000;
+	for (uint32_t seq = 0; seq < count; seq++) {
+		push_ring(seq);
+		// let core 0 catch up and go idle now and then so the doorbell is used
+		if (seq % 20000 == 0) usleep(1000);
+	}
+	multicore_fence_wait(multicore_fence());
+
+	CHECK(ring_next == count);
+	CHECK(!multicore_cmd_pending());
+	CHECK(multicore_stats.ring_peak > 0 && multicore_stats.ring_peak <= MULTICORE_RING_SIZE);
+}
+
+// a fence only passes once everything before it ran
+static void test_fence() {
+	uint32_t start = ring_next;
+	for (uint32_t seq = start; seq < start + 500; seq++) push_ring(seq);
+	uint32_t fence = multicore_fence();
+	multicore_fence_wait(fence);
+	CHECK(multicore_fence_passed(fence));
+	CHECK(ring_next == start + 500);
+}
+
+// core 1 runs far ahead of a slow core 0 and has to wait for room in the
+// ring, nothing gets lost and fences pass in the order they were made
+static void test_slow_consumer() {
+	enum { FENCES = 200 };
+	uint32_t fences[FENCES];
+	int made = 0, ahead = 0, unordered = 0;
+	multicore_stats_t before = multicore_stats;
+	uint32_t first = ring_next, last = (first / 100 + FENCES) * 100;
+
+	core0_slow = true;
+	for (uint32_t seq = first; seq <= last; seq++) {
+		push_ring(seq);
+		if (seq % 100 != 0 || made == FENCES) continue;
+		fences[made++] = multicore_fence();
+		if (!multicore_fence_passed(fences[made - 1])) ahead++;
+		// the fences that passed are always the oldest ones
+		for (int i = 1; i < made; i++) {
+			if (multicore_fence_passed(fences[i]) && !multicore_fence_passed(fences[i - 1])) unordered++;
+		}
+	}
+	multicore_fence_wait(multicore_fence());
+	core0_slow = false;
+
+	CHECK(ring_next == last + 1);
+	CHECK(made == FENCES);
+	for (int i = 0; i < made; i++) CHECK(multicore_fence_passed(fences[i]));
+	CHECK(unordered == 0);
+	CHECK(ahead > FENCES / 2);
+	CHECK(multicore_stats.ring_stalls > before.ring_stalls);
+	CHECK(multicore_stats.ring_stall_us > before.ring_stall_us);
+}
+
+static uint8_t* alloc_block(uint32_t seq, uint32_t size) {
+	uint8_t* data = multicore_cmd_alloc(size);
+	if (!data) return NULL;
+	for (uint32_t i = 0; i < size; i++) data[i] = seq + i;
+	return data;
+}
+
+// blocks of all sizes wrap around the arena many times while core 0 frees
+// them in order, the biggest ones go to the heap instead
+static void test_arena() {
+	const uint32_t count = 50000;
+	multicore_stats_t before = multicore_stats;
+	uint32_t heap = 0, arena = 0;
+
+	for (uint32_t seq = 0; seq < count; seq++) {
+		uint32_t size = 1 + test_rand() % 700;
+		if (seq % 100 == 0) size = MULTICORE_ARENA_SIZE / 2 + test_rand() % 1000;
+		bool in_arena = size + 8 <= MULTICORE_ARENA_SIZE / 2;
+		if (in_arena) arena++;
+		else heap++;
+
+		uint8_t* data = alloc_block(seq, size);
+		REQUIRE(data);
+		// data that was never sent goes back and is handed out again
+		if (seq % 10 == 0 && in_arena) {
+			multicore_cmd_discard(data);
+			arena++;
+			uint8_t* again = alloc_block(seq, size);
+			CHECK(again == data);
+			data = again;
+		}
+
+		arena_blocks[seq % ARENA_SLOTS] = data;
+		multicore_cmd_push(TEST_ARENA);
+		multicore_cmd_push(seq);
+		multicore_cmd_push(size);
+		if (seq % 5000 == 0) usleep(1000);
+	}
+	multicore_fence_wait(multicore_fence());
+
+	CHECK(multicore_stats.heap_allocs - before.heap_allocs == heap);
+	CHECK(multicore_stats.arena_allocs - before.arena_allocs == arena);
+	CHECK(multicore_stats.arena_bytes - before.arena_bytes > 4 * MULTICORE_ARENA_SIZE);
+}
+
+int main() {
+	pthread_t thread;
+	multicore_init();
+	pthread_create(&thread, NULL, core0, NULL);
+
+	test_ring();
+	test_fence();
+	test_slow_consumer();
+	test_arena();
+
+	core0_stop = true;
+	multicore_fifo_push_blocking_inline(MULTICORE_DOORBELL);
+	pthread_join(thread, NULL);
+	CHECK(core0_failures == 0);
+	return test_report("test_multicore");
+}
@@ -0,0 +1,171 @@
+// runs the core 0 scheduler on the host, threads stand in for core 1 and
+// for interrupts pushing work
+#include <pthread.h>
+
+#include "multicore.h"
+#include "workqueue.h"
+
+#include "test.h"
+
+enum {
+	TEST_DRAW = 0x1000,
+};
+
+// what ran on core 0, in order: draws are their number, work items their
+// argument with the top bit set
+#define LOG_SIZE 256
+#define LOG_WORK 0x80000000u
+static uint32_t run_log[LOG_SIZE];
+static int run_count;
+
+int lcd_fifo_receiver(uint32_t message) {
+	if (message != FIFO_LCD_FENCE) return 0;
+	multicore_fence_done = multicore_cmd_pop();
+	return 1;
+}
+
+int draw_fifo_receiver(uint32_t message) {
+	if (message != TEST_DRAW) return 0;
+	uint32_t seq = multicore_cmd_pop();
+	if (run_count < LOG_SIZE) run_log[run_count] = seq;
+	run_count++;
+	return 1;
+}
+
+static void log_work(void* arg) {
+	if (run_count < LOG_SIZE) run_log[run_count] = LOG_WORK | (uint32_t)(uintptr_t)arg;
+	run_count++;
+}
+
+static void run_all() {
+	while (workqueue_step());
+}
+
+// higher priorities first, in order within a priority
+static void test_priorities() {
+	run_count = 0;
+	workqueue_push(log_work, (void*)1, WORK_PRIORITY_LOW);
+	workqueue_push(log_work, (void*)2, WORK_PRIORITY_NORMAL);
+	workqueue_push(log_work, (void*)3, WORK_PRIORITY_HIGH);
+	workqueue_push(log_work, (void*)4, WORK_PRIORITY_LOW);
+	workqueue_push(log_work, (void*)5, WORK_PRIORITY_NORMAL);
+	workqueue_push(log_work, (void*)6, WORK_PRIORITY_HIGH);
+	// out of range priorities are treated as low
+	workqueue_push(log_work, (void*)7, 200);
+
+	static const uint32_t expected[] = { 3, 6, 2, 5, 1, 4, 7 };
+	for (int i = 0; i < 7; i++) CHECK(workqueue_step());
+	CHECK(!workqueue_step());
+	REQUIRE(run_count == 7);
+	for (int i = 0; i < 7; i++) CHECK(run_log[i] == (LOG_WORK | expected[i]));
+}
+
+// a full priority drops and counts new items, the others still take them
+static void test_overflow() {
+	uint32_t dropped = workqueue_stats.dropped;
+	run_count = 0;
+	for (int i = 0; i < WORKQUEUE_SIZE; i++) CHECK(workqueue_push(log_work, (void*)(uintptr_t)i, WORK_PRIORITY_NORMAL));
+	CHECK(!workqueue_push(log_work, (void*)99, WORK_PRIORITY_NORMAL));
+	CHECK(workqueue_stats.dropped == dropped + 1);
+	workqueue_stats_t stats;
+	workqueue_get_stats(&stats);
+	CHECK(stats.dropped == dropped + 1);
+	CHECK(workqueue_push(log_work, (void*)100, WORK_PRIORITY_HIGH));
+
+	run_all();
+	REQUIRE(run_count == WORKQUEUE_SIZE + 1);
+	CHECK(run_log[0] == (LOG_WORK | 100));
+	for (int i = 0; i < WORKQUEUE_SIZE; i++) CHECK(run_log[i + 1] == (LOG_WORK | i));
+}
+
+// drawing goes first, but only up to its budget per pass so work still runs
+static void test_draw_budget() {
+	const int draws = WORKQUEUE_DRAW_BUDGET + 36;
+	run_count = 0;
+	for (int i = 0; i < draws; i++) {
+		multicore_cmd_push(TEST_DRAW);
+		multicore_cmd_push(i);
+	}
+	workqueue_push(log_work, (void*)1, WORK_PRIORITY_LOW);
+
+	CHECK(workqueue_step());
+	REQUIRE(run_count == WORKQUEUE_DRAW_BUDGET + 1);
+	for (int i = 0; i < WORKQUEUE_DRAW_BUDGET; i++) CHECK(run_log[i] == i);
+	CHECK(run_log[WORKQUEUE_DRAW_BUDGET] == (LOG_WORK | 1));
+
+	run_all();
+	REQUIRE(run_count == draws + 1);
+	for (int i = WORKQUEUE_DRAW_BUDGET; i < draws; i++) CHECK(run_log[i + 1] == i);
+}
+
+// producers on other threads, each with its own priority, retry when their
+// ring is full. Every item has to run once and in the order it was pushed
+#define PRODUCERS 3
+#define PRODUCER_ITEMS 20000
+static uint32_t consumed_next[PRODUCERS];
+static int consumed_failures;
+static uint32_t push_failures[PRODUCERS];
+static volatile bool consumer_stop;
+
+static void count_work(void* arg) {
+	uint32_t v = (uint32_t)(uintptr_t)arg;
+	uint32_t producer = v >> 24, seq = v & 0xffffff;
+	if (producer >= PRODUCERS || seq != consumed_next[producer]) consumed_failures++;
+	else consumed_next[producer]++;
+}
+
+static void* producer(void* arg) {
+	uint32_t id = (uint32_t)(uintptr_t)arg;
+	for (uint32_t seq = 0; seq < PRODUCER_ITEMS; seq++) {
+		while (!workqueue_push(count_work, (void*)(uintptr_t)(id << 24 | seq), id)) {
+			push_failures[id]++;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void* consumer(void* arg) {
+	while (!consumer_stop) {
+		if (!workqueue_step()) sched_yield();
+	}
+	return NULL;
+}
+
+static void test_threads() {
+	uint32_t items = workqueue_stats.items, dropped = workqueue_stats.dropped;
+	pthread_t threads[PRODUCERS], core0;
+	pthread_create(&core0, NULL, consumer, NULL);
+	for (uintptr_t i = 0; i < PRODUCERS; i++) pthread_create(&threads[i], NULL, producer, (void*)i);
+	for (int i = 0; i < PRODUCERS; i++) pthread_join(threads[i], NULL);
+
+	// the last items can still be queued, wait for core 0 to run them
+	while (true) {
+		bool done = true;
+		for (int i = 0; i < PRODUCERS; i++) if (consumed_next[i] != PRODUCER_ITEMS) done = false;
+		if (done || consumed_failures) break;
+		sched_yield();
+	}
+	consumer_stop = true;
+	pthread_join(core0, NULL);
+
+	CHECK(consumed_failures == 0);
+	uint32_t failures = 0;
+	for (int i = 0; i < PRODUCERS; i++) {
+		CHECK(consumed_next[i] == PRODUCER_ITEMS);
+		failures += push_failures[i];
+	}
+	CHECK(workqueue_stats.items - items == PRODUCERS * PRODUCER_ITEMS);
+	CHECK(workqueue_stats.dropped - dropped == failures);
+}
+
+int main() {
+	multicore_init();
+	workqueue_init();
+
+	test_priorities();
+	test_overflow();
+	test_draw_budget();
+	test_threads();
+	return test_report("test_workqueue");
+}